@@ -1,63 +1,267 @@
 #include <assert.h>
+#include <malloc.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "HashMap.h"
+#ifdef TREE_ARENA
+#include "arena.h"
+#endif
 
-// We fix the number of hash buckets for simplicity.
-#define N_BUCKETS 8
+// Number of hash buckets allocated by the first insertion.
+#define INITIAL_BUCKETS 8
+
+// The number of buckets is doubled when the average bucket holds more entries.
+#define MAX_LOAD 2
 
 typedef struct Pair Pair;
 
 struct Pair {
-    char* key;
-    void* value;
     Pair* next; // Next item in a single-linked list.
+    void* value;
+    // Followed by the packed key, see `pair_key`.
 };
 
 struct HashMap {
-    Pair* buckets[N_BUCKETS]; // Linked lists of key-value pairs.
+    Pair** buckets; // Linked lists of key-value pairs, NULL until the first insertion.
+    size_t n_buckets; // Zero or a power of two.
     size_t size; // total number of entries in map.
+    size_t key_bytes; // Sum of packed key sizes.
+    size_t overhead; // Allocator overhead of the buckets and pairs.
+    _Atomic(HashMapIndex*) index; // Installed by readers, kept sorted by modifications.
 };
 
-static unsigned int get_hash(const char* key);
+// The key is stored in the same allocation, right after the pair.
+static inline PackedName* pair_key(Pair* p)
+{
+    return (PackedName*)(p + 1);
+}
 
-HashMap* hmap_new()
+// All memory of a map goes through these. In arena builds (TREE_ARENA) the buckets
+// and pairs are placed near the map itself, see arena.h.
+static void* map_alloc(const HashMap* map, size_t size)
 {
-    HashMap* map = malloc(sizeof(HashMap));
-    if (!map)
+#ifdef TREE_ARENA
+    return arena_alloc_near(size, map);
+#else
+    (void)map;
+    void* p = malloc(size);
+    if (!p)
         exit(1);
-        //return NULL;
+    return p;
+#endif
+}
+
+static void map_dealloc(void* p, size_t size)
+{
+#ifdef TREE_ARENA
+    arena_free(p, size);
+#else
+    (void)size;
+    free(p);
+#endif
+}
+
+// Bytes lost to the allocator by a block of `size` bytes at `p`: its chunk header
+// and the rounding up of its size.
+static size_t alloc_overhead(void* p, size_t size)
+{
+#ifdef TREE_ARENA
+    return arena_overhead(p, size);
+#else
+    return p ? malloc_usable_size(p) - size + sizeof(size_t) : 0;
+#endif
+}
+
+// The smallest capacity of a cached index, so that a small map does not
+// reallocate it on every insertion.
+#define MIN_INDEX_CAPACITY 8
+
+static size_t index_size(size_t capacity)
+{
+    return sizeof(HashMapIndex) + capacity * sizeof(const PackedName*);
+}
+
+// Free the cached index. Called only by modifications, so no reader uses it.
+static void drop_index(HashMap* map)
+{
+    HashMapIndex* index = atomic_load_explicit(&map->index, memory_order_relaxed);
+    if (index) {
+        map_dealloc(index, index_size(index->capacity));
+        atomic_store_explicit(&map->index, NULL, memory_order_relaxed);
+    }
+}
+
+// Position of the first key in the index greater than or equal to `key`.
+static size_t index_lower_bound(const HashMapIndex* index, const PackedName* key)
+{
+    size_t low = 0, high = index->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (packed_name_compare(index->keys[mid], key) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+// Move the cached index to a block of `capacity` keys. Called only by modifications.
+static HashMapIndex* index_resize(HashMap* map, HashMapIndex* index, size_t capacity)
+{
+    HashMapIndex* resized = map_alloc(map, index_size(capacity));
+    resized->count = index->count;
+    resized->capacity = capacity;
+    memcpy(resized->keys, index->keys, index->count * sizeof(const PackedName*));
+    map_dealloc(index, index_size(index->capacity));
+    atomic_store_explicit(&map->index, resized, memory_order_relaxed);
+    return resized;
+}
+
+// Add the key of a new pair to the cached index, if there is one, keeping it
+// sorted. Shifting pointers is cheaper than sorting the whole index again at the
+// next read in order.
+static void index_insert(HashMap* map, const PackedName* key)
+{
+    HashMapIndex* index = atomic_load_explicit(&map->index, memory_order_relaxed);
+    if (!index)
+        return;
+    if (index->count == index->capacity)
+        index = index_resize(map, index, 2 * index->capacity);
+    size_t i = index_lower_bound(index, key);
+    memmove(&index->keys[i + 1], &index->keys[i], (index->count - i) * sizeof(const PackedName*));
+    index->keys[i] = key;
+    index->count++;
+}
+
+// Remove the key of a pair about to be freed from the cached index, if there is one.
+static void index_remove(HashMap* map, const PackedName* key)
+{
+    HashMapIndex* index = atomic_load_explicit(&map->index, memory_order_relaxed);
+    if (!index)
+        return;
+    size_t i = index_lower_bound(index, key);
+    assert(i < index->count && index->keys[i] == key);
+    index->count--;
+    memmove(&index->keys[i], &index->keys[i + 1], (index->count - i) * sizeof(const PackedName*));
+    if (index->capacity > MIN_INDEX_CAPACITY && index->count <= index->capacity / 4)
+        index_resize(map, index, index->capacity / 2);
+}
+
+HashMap* hmap_new()
+{
+    return hmap_new_near(NULL);
+}
+
+HashMap* hmap_new_near(const void* hint)
+{
+    HashMap* map = map_alloc(hint, sizeof(HashMap));
     memset(map, 0, sizeof(HashMap));
     return map;
 }
 
 void hmap_free(HashMap* map)
 {
-    for (int h = 0; h < N_BUCKETS; ++h) {
+    hmap_clear(map);
+    map_dealloc(map, sizeof(HashMap));
+}
+
+void hmap_clear(HashMap* map)
+{
+    drop_index(map);
+    for (size_t h = 0; h < map->n_buckets; ++h) {
         for (Pair* p = map->buckets[h]; p;) {
             Pair* q = p;
             p = p->next;
-            free(q->key);
-            free(q);
+            map_dealloc(q, sizeof(Pair) + packed_name_size(pair_key(q)->len));
         }
     }
-    free(map);
+    map_dealloc(map->buckets, map->n_buckets * sizeof(Pair*));
+    memset(map, 0, sizeof(HashMap));
+}
+
+void hmap_memory(HashMap* map, HashMapMemory* mem)
+{
+    mem->table = sizeof(HashMap) + map->n_buckets * sizeof(Pair*);
+    mem->entries = map->size * sizeof(Pair);
+    mem->keys = map->key_bytes;
+    mem->overhead = alloc_overhead(map, sizeof(HashMap)) + map->overhead;
+    HashMapIndex* index = atomic_load_explicit(&map->index, memory_order_acquire);
+    mem->index = index ? index_size(index->capacity) : 0;
+    mem->overhead += index ? alloc_overhead(index, mem->index) : 0;
+}
+
+const HashMapIndex* hmap_index(HashMap* map)
+{
+    return atomic_load_explicit(&map->index, memory_order_acquire);
+}
+
+HashMapIndex* hmap_index_new(HashMap* map)
+{
+    size_t capacity = map->size > MIN_INDEX_CAPACITY ? map->size : MIN_INDEX_CAPACITY;
+    HashMapIndex* index = map_alloc(map, index_size(capacity));
+    index->count = 0;
+    index->capacity = capacity;
+    HashMapIterator it = hmap_iterator(map);
+    void* value;
+    while (hmap_next(map, &it, &index->keys[index->count], &value))
+        index->count++;
+    assert(index->count == map->size);
+    return index;
 }
 
-static Pair* hmap_find(HashMap* map, int h, const char* key)
+const HashMapIndex* hmap_install_index(HashMap* map, HashMapIndex* index)
 {
-    for (Pair* p = map->buckets[h]; p; p = p->next) {
-        if (strcmp(key, p->key) == 0)
+    HashMapIndex* expected = NULL;
+    if (atomic_compare_exchange_strong_explicit(
+            &map->index, &expected, index, memory_order_acq_rel, memory_order_acquire))
+        return index;
+    map_dealloc(index, index_size(index->capacity));
+    return expected;
+}
+
+static Pair* hmap_find(HashMap* map, const PackedName* key)
+{
+    if (!map->n_buckets)
+        return NULL;
+    for (Pair* p = map->buckets[key->hash & (map->n_buckets - 1)]; p; p = p->next) {
+        if (packed_name_equal(key, pair_key(p)))
             return p;
     }
     return NULL;
 }
 
+static void hmap_resize(HashMap* map, size_t n_buckets)
+{
+    Pair** buckets = map_alloc(map, n_buckets * sizeof(Pair*));
+    memset(buckets, 0, n_buckets * sizeof(Pair*));
+    for (size_t h = 0; h < map->n_buckets; ++h) {
+        for (Pair* p = map->buckets[h]; p;) {
+            Pair* next = p->next;
+            size_t new_h = pair_key(p)->hash & (n_buckets - 1);
+            p->next = buckets[new_h];
+            buckets[new_h] = p;
+            p = next;
+        }
+    }
+    map->overhead -= alloc_overhead(map->buckets, map->n_buckets * sizeof(Pair*));
+    map->overhead += alloc_overhead(buckets, n_buckets * sizeof(Pair*));
+    map_dealloc(map->buckets, map->n_buckets * sizeof(Pair*));
+    map->buckets = buckets;
+    map->n_buckets = n_buckets;
+}
+
 void* hmap_get(HashMap* map, const char* key)
 {
-    int h = get_hash(key);
-    Pair* p = hmap_find(map, h, key);
+    PackedNameBuffer packed;
+    packed_name_encode(&packed.name, key, strlen(key));
+    return hmap_get_packed(map, &packed.name);
+}
+
+void* hmap_get_packed(HashMap* map, const PackedName* key)
+{
+    Pair* p = hmap_find(map, key);
     if (p)
         return p->value;
     else
@@ -65,35 +269,58 @@ void* hmap_get(HashMap* map, const char* key)
 }
 
 bool hmap_insert(HashMap* map, const char* key, void* value)
+{
+    PackedNameBuffer packed;
+    packed_name_encode(&packed.name, key, strlen(key));
+    return hmap_insert_packed(map, &packed.name, value);
+}
+
+bool hmap_insert_packed(HashMap* map, const PackedName* key, void* value)
 {
     if (!value)
         return false;
-    int h = get_hash(key);
-    Pair* p = hmap_find(map, h, key);
+    Pair* p = hmap_find(map, key);
     if (p)
         return false; // Already exists.
-    Pair* new_p = malloc(sizeof(Pair));
-    new_p->key = strdup(key);
-    if (!new_p->key)
-        exit(1);
+    if (map->size >= map->n_buckets * MAX_LOAD)
+        hmap_resize(map, map->n_buckets ? 2 * map->n_buckets : INITIAL_BUCKETS);
 
+    size_t key_size = packed_name_size(key->len);
+    Pair* new_p = map_alloc(map, sizeof(Pair) + key_size);
+    memcpy(pair_key(new_p), key, key_size);
+
+    size_t h = key->hash & (map->n_buckets - 1);
     new_p->value = value;
     new_p->next = map->buckets[h];
     map->buckets[h] = new_p;
     map->size++;
+    map->key_bytes += key_size;
+    map->overhead += alloc_overhead(new_p, sizeof(Pair) + key_size);
+    index_insert(map, pair_key(new_p));
     return true;
 }
 
 bool hmap_remove(HashMap* map, const char* key)
 {
-    int h = get_hash(key);
-    Pair** pp = &(map->buckets[h]);
+    PackedNameBuffer packed;
+    packed_name_encode(&packed.name, key, strlen(key));
+    return hmap_remove_packed(map, &packed.name);
+}
+
+bool hmap_remove_packed(HashMap* map, const PackedName* key)
+{
+    if (!map->n_buckets)
+        return false;
+    Pair** pp = &(map->buckets[key->hash & (map->n_buckets - 1)]);
     while (*pp) {
         Pair* p = *pp;
-        if (strcmp(key, p->key) == 0) {
+        if (packed_name_equal(key, pair_key(p))) {
+            index_remove(map, pair_key(p));
             *pp = p->next;
-            free(p->key);
-            free(p);
+            size_t key_size = packed_name_size(key->len);
+            map->key_bytes -= key_size;
+            map->overhead -= alloc_overhead(p, sizeof(Pair) + key_size);
+            map_dealloc(p, sizeof(Pair) + key_size);
             map->size--;
             return true;
         }
@@ -102,6 +329,23 @@ bool hmap_remove(HashMap* map, const char* key)
     return false;
 }
 
+void* hmap_replace(HashMap* map, const char* key, void* value)
+{
+    PackedNameBuffer packed;
+    packed_name_encode(&packed.name, key, strlen(key));
+    return hmap_replace_packed(map, &packed.name, value);
+}
+
+void* hmap_replace_packed(HashMap* map, const PackedName* key, void* value)
+{
+    Pair* p = hmap_find(map, key);
+    if (!p || !value)
+        return NULL;
+    void* old = p->value;
+    p->value = value;
+    return old;
+}
+
 size_t hmap_size(HashMap* map)
 {
     return map->size;
@@ -109,30 +353,20 @@ size_t hmap_size(HashMap* map)
 
 HashMapIterator hmap_iterator(HashMap* map)
 {
-    HashMapIterator it = { 0, map->buckets[0] };
+    HashMapIterator it = { 0, map->n_buckets ? map->buckets[0] : NULL };
     return it;
 }
 
-bool hmap_next(HashMap* map, HashMapIterator* it, const char** key, void** value)
+bool hmap_next(HashMap* map, HashMapIterator* it, const PackedName** key, void** value)
 {
     Pair* p = it->pair;
-    while (!p && it->bucket < N_BUCKETS - 1) {
+    while (!p && it->bucket + 1 < (int)map->n_buckets) {
         p = map->buckets[++it->bucket];
     }
     if (!p)
         return false;
-    *key = p->key;
+    *key = pair_key(p);
     *value = p->value;
     it->pair = p->next;
     return true;
 }
-
-static unsigned int get_hash(const char* key)
-{
-    unsigned int hash = 17;
-    while (*key) {
-        hash = (hash << 3) + hash + *key;
-        ++key;
-    }
-    return hash % N_BUCKETS;
-}
@@ -2,54 +2,110 @@
 #include <stdbool.h>
 #include <sys/types.h>
 
+#include "packed_name.h"
+
 // A structure representing a mapping from keys to values.
-// Keys are C-strings (null-terminated char*), all distinct.
+// Keys are folder names, all distinct. They are given as C-strings (null-terminated
+// char*) of 'a'-'z' characters, but stored packed (see packed_name.h).
 // Values are non-null pointers (void*, which you can cast to any other pointer type).
 typedef struct HashMap HashMap;
 
 // Create a new, empty map.
 HashMap* hmap_new();
 
+// Like `hmap_new`. In arena builds (TREE_ARENA) the map, and later its buckets
+// and entries, are allocated near `hint` (which must come from the arena too).
+HashMap* hmap_new_near(const void* hint);
+
 // Clear the map and free its memory. This frees the map and the keys
-// copied by hmap_insert, but does not free any values.
+// packed by hmap_insert, but does not free any values.
 void hmap_free(HashMap* map);
 
+// Remove all entries (without freeing values), leaving the map as if just created.
+void hmap_clear(HashMap* map);
+
 // Get the value stored under `key`, or NULL if not present.
 void* hmap_get(HashMap* map, const char* key);
+void* hmap_get_packed(HashMap* map, const PackedName* key);
 
 // Insert a `value` under `key` and return true,
 // or do nothing and return false if `key` already exists in the map.
 // `value` must not be NULL.
-// (The caller can free `key` at any time - the map internally uses a copy of it).
+// (The caller can free `key` at any time - the map internally uses a packed copy of it).
 bool hmap_insert(HashMap* map, const char* key, void* value);
+bool hmap_insert_packed(HashMap* map, const PackedName* key, void* value);
 
 // Remove the value under `key` and return true (the value is not free'd),
 // or do nothing and return false if `key` was not present.
 bool hmap_remove(HashMap* map, const char* key);
+bool hmap_remove_packed(HashMap* map, const PackedName* key);
+
+// Replace the value under `key` with `value` and return the old value, or do
+// nothing and return NULL if `key` was not present. `value` must not be NULL.
+// Only the value changes, so iterators of the map stay valid.
+void* hmap_replace(HashMap* map, const char* key, void* value);
+void* hmap_replace_packed(HashMap* map, const PackedName* key, void* value);
 
 // Return the number of elements in the map.
 size_t hmap_size(HashMap* map);
 
+// Memory used by a map, in bytes.
+typedef struct HashMapMemory {
+    size_t table;    // The map structure and its bucket array.
+    size_t entries;  // Pairs, without the keys stored in them.
+    size_t keys;     // Packed keys.
+    size_t index;    // The cached index of keys, see `hmap_index`.
+    size_t overhead; // Allocator overhead: chunk headers and rounding up.
+} HashMapMemory;
+
+// Fill `*mem` with the memory currently used by the map. Takes constant time,
+// the map keeps these numbers up to date.
+void hmap_memory(HashMap* map, HashMapMemory* mem);
+
+// Keys of a map in some order (sorted, as built by `make_map_index` in path_utils.h).
+// A map can cache one sorted index, so that a large map is sorted once for many
+// reads of its keys in order. Once cached, insertions and removals keep it sorted
+// (a binary search and a shift of the later keys), so it is never sorted again.
+typedef struct HashMapIndex {
+    size_t count;
+    size_t capacity; // Allocated room in `keys`.
+    const PackedName* keys[];
+} HashMapIndex;
+
+// Return the index cached in the map, or NULL if there is none.
+const HashMapIndex* hmap_index(HashMap* map);
+
+// Allocate an index holding all keys of the map, in iteration order.
+// The caller should sort `keys` and pass the index to `hmap_install_index`.
+HashMapIndex* hmap_index_new(HashMap* map);
+
+// Cache `index` (from `hmap_index_new` on this map) in the map and return it,
+// unless another index was cached in the meantime: then free `index` and return
+// the cached one. Can be called concurrently with other reads of the map (including
+// other calls to this function), but not with modifications, which update the index.
+const HashMapIndex* hmap_install_index(HashMap* map, HashMapIndex* index);
+
 typedef struct HashMapIterator HashMapIterator;
 
 // Return an iterator to the map. See `hmap_next`.
 HashMapIterator hmap_iterator(HashMap* map);
 
 // Set `*key` and `*value` to the current element pointed by iterator and
-// move the iterator to the next element.
+// move the iterator to the next element. The key is the packed copy owned by
+// the map, use `packed_name_decode` to get its characters.
 // If there are no more elements, leaves `*key` and `*value` unchanged and
 // returns false.
 //
 // The map cannot be modified between calls to `hmap_iterator` and `hmap_next`.
 //
 // Usage: ```
-//     const char* key;
+//     const PackedName* key;
 //     void* value;
 //     HashMapIterator it = hmap_iterator(map);
 //     while (hmap_next(map, &it, &key, &value))
 //         foo(key, value);
 // ```
-bool hmap_next(HashMap* map, HashMapIterator* it, const char** key, void** value);
+bool hmap_next(HashMap* map, HashMapIterator* it, const PackedName** key, void** value);
 
 struct HashMapIterator {
     int bucket;
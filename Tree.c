@@ -1,10 +1,24 @@
 #include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
 #include "Tree.h"
 #include "HashMap.h"
+#include "node_pool.h"
+#include "node_sync.h"
+#include "lock_table.h"
+#include "mem_account.h"
+#include "work_pool.h"
+#include "work_steal.h"
+#include "watch_queue.h"
+#include "name_match.h"
+#include "arena.h"
+#include "batch_plan.h"
 #include "path_utils.h"
 #include "err.h"
 /**
@@ -16,564 +30,3849 @@
  * Każdy pisarz czeka przed wejściem do wierzchołka, w którym
  * musi coś zmienić aż wątki w jego poddrzewie się skończą.
  */
+#if defined(TREE_USE_MALLOC) && defined(TREE_ARENA)
+#error "TREE_USE_MALLOC and TREE_ARENA are mutually exclusive"
+#elif !defined(TREE_USE_MALLOC) && !defined(TREE_ARENA)
+#define TREE_NODE_POOL // wierzchołki z puli (node_pool.h)
+#endif
+
+#ifdef TREE_LOCK_TABLE
+/**
+ * w trybie tablicy zamków wierzchołek trzyma tylko małe liczniki,
+ * a zamek i zmienne warunkowe bierze z paska tablicy (lock_table.h)
+ */
+typedef int16_t counter_t;
+#else
+typedef int counter_t;
+#endif
+
+/**
+ * Najpierw pola czytane przy wyszukiwaniu (zmieniają je tylko pisarze
+ * rodzica lub samego wierzchołka), potem stan synchronizacji, który
+ * zmienia każdy przechodzący wątek. Wierzchołki płytsze niż
+ * TREE_HOT_DEPTH (korzeń ma głębokość 0), przez które przechodzi
+ * najwięcej wątków, są umieszczane tak, że obie części leżą w osobnych
+ * liniach pamięci podręcznej, a sąsiednich obiektów nie ma w żadnej
+ * z nich (zob. hot_node_new). Pozostałe wierzchołki są ciasno upakowane.
+ * Przeniesienie, zamiana i kopia umieszczają na nowo wierzchołki, których
+ * głębokość przeszła przez TREE_HOT_DEPTH (place_linked).
+ * Korzeń jest umieszczany tak zawsze, bo w jego bloku leży też stan
+ * wspólny drzewa (TreeShared).
+ */
+#ifndef TREE_HOT_DEPTH
+#define TREE_HOT_DEPTH 2
+#endif
+
+/**
+ * Obserwator folderu (tree_watch). Listę obserwatorów wierzchołka zmienia
+ * się pod pisarzem w nim, a czytają ją pisarze zmieniający jego poddrzewo,
+ * którzy trzymają na nim licznik no_threads (lub pisarza w nim albo jego
+ * przodku), więc lista nie potrzebuje własnego zamka.
+ */
+typedef struct Watch Watch;
+struct Watch {
+    WatchQueue *queue;
+    bool recursive; // także zmiany w głębi poddrzewa
+    Watch *next;
+};
+
+/**
+ * Dawna mapa dzieci wierzchołka, zachowana dla migawek o epokach z (from, to]
+ * (tree_snapshot). Wersje wierzchołka tworzą listę od najnowszej, a ich
+ * przedziały przylegają do siebie: to najnowszej to epoka obecnej mapy.
+ */
+typedef struct ContentVersion ContentVersion;
+struct ContentVersion {
+    _Atomic(HashMap *) map; // NULL, gdy już żadna migawka jej nie czyta
+    uint64_t from, to;
+    _Atomic(ContentVersion *) older;
+};
+
+typedef struct TreeShared TreeShared;
+
+/**
+ * Sumy poddrzewa wierzchołka (razem z nim): liczba potomków i pamięć map
+ * dzieci, nazw i narzutu alokatora. Pamięć struktur i obiektów
+ * synchronizacji wynika z liczby wierzchołków, więc jej nie trzymamy.
+ */
+typedef struct SubtreeSums {
+    atomic_size_t descendants;
+    atomic_size_t container_bytes;
+    atomic_size_t key_bytes;
+    atomic_size_t overhead_bytes;
+} SubtreeSums;
+
 struct Tree {
     HashMap *content; // zawartość folderu
-    pthread_mutex_t lock;
-    pthread_cond_t readers;
-    pthread_cond_t writers;
-    int rcount, wcount, rwait, wwait;
-    int change;
-    int no_threads;
     Tree *parent;
+    uint64_t version; // zwiększana przy każdej zmianie zbioru dzieci
+    Watch *watches;
+
+#ifndef TREE_LOCK_TABLE
+    NodeMutex lock;
+    NodeCond readers;
+    NodeCond writers;
+#endif
+    counter_t rcount, wcount, rwait, wwait;
+    counter_t change;
+    counter_t no_threads;
+    bool hot; // umieszczony przez hot_node_new
+    atomic_uint watched; // obserwatorzy wierzchołka i całego jego poddrzewa
+    SubtreeSums sums; // poza gorącymi wierzchołkami
+    _Atomic(ContentVersion *) history; // dawne mapy czytane przez migawki
+    atomic_uint_fast64_t born; // epoka zmiany, od której obowiązuje obecna mapa
 };
 
-static Tree *find_node_r(Tree *tree, const char *path);
-static Tree *find_child(Tree *tree, const char *path);
-static Tree *find_node_w(Tree *tree, const char *dest, bool lock_first, Tree *bound);
-static void update_no_threads(Tree *tree, Tree *bound);
+#ifdef TREE_LOCK_TABLE
+#define SYNC_BYTES 0
+#else
+#define SYNC_BYTES (sizeof(NodeMutex) + 2 * sizeof(NodeCond))
+#endif
 
-Tree *tree_new() {
+#define CACHE_LINE 64
+// rozmiar części czytanej przy wyszukiwaniu
+#define LOOKUP_BYTES (offsetof(Tree, watches) + sizeof(Watch *))
+// przesunięcie wierzchołka w bloku, przy którym stan synchronizacji zaczyna linię
+#define HOT_OFFSET (CACHE_LINE - LOOKUP_BYTES)
+#define HOT_BYTES ((HOT_OFFSET + sizeof(Tree) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE)
 
-    Tree *new = malloc(sizeof(Tree));
-    if (!new)
-        exit(1);
+_Static_assert(LOOKUP_BYTES <= CACHE_LINE, "lookup fields must fit in one cache line");
 
-    new->content = hmap_new();
-    assert(new->content);
-    
-    if (pthread_mutex_init(&new->lock, NULL) != 0)
-        syserr("lock init failed");
-    if (pthread_cond_init(&new->readers, NULL) != 0)
-        syserr ("cond init failed");
-    if (pthread_cond_init(&new->writers, NULL) != 0)
-        syserr ("cond init failed");
-
-    new->rcount = new->rwait = new->wcount = new->wwait = 0;
-    new->change = 0;
-    new->no_threads = 0;
-    new->parent = NULL;
-    return new;
+/**
+ * Sumy poddrzewa wierzchołka zmienia każde utworzenie, usunięcie
+ * i przeniesienie w jego poddrzewie, na całej ścieżce do korzenia. Przez
+ * gorące wierzchołki przechodzą wszystkie takie zmiany, więc ich sumy
+ * są podzielone na paski w osobnych liniach za wierzchołkiem (jak konta,
+ * mem_account.h): wątek pisze zawsze do swojego paska, a odczyt je sumuje.
+ * Pozostałe wierzchołki mają jeden zestaw sum w stanie synchronizacji.
+ * Liczniki przekręcają się, więc pojedynczy pasek może być "ujemny".
+ */
+#define COUNT_STRIPES 8
+
+typedef struct CountStripe {
+    _Alignas(CACHE_LINE) SubtreeSums sums;
+} CountStripe;
+
+static atomic_uint next_count_stripe;
+static _Thread_local unsigned count_stripe = COUNT_STRIPES;
+
+static CountStripe *hot_stripes(Tree *node) {
+
+    return (CountStripe *) ((char *) node - HOT_OFFSET + HOT_BYTES);
 }
 
-void tree_free(Tree *tree) {
+static unsigned thread_stripe(void) {
 
-    assert(tree);
-    
-    if (pthread_cond_destroy(&tree->readers) != 0)
-        syserr ("cond destroy 1 failed");
-    if (pthread_cond_destroy(&tree->writers) != 0)
-        syserr ("cond destroy 2 failed");
-    if (pthread_mutex_destroy(&tree->lock) != 0)
-        syserr ("lock destroy failed");
+    if (count_stripe == COUNT_STRIPES)
+        count_stripe = atomic_fetch_add_explicit(&next_count_stripe, 1, memory_order_relaxed) % COUNT_STRIPES;
+    return count_stripe;
+}
 
-    HashMapIterator it = hmap_iterator(tree->content);
-    const char *key;
-    void *value;
-    while (hmap_next(tree->content, &it, &key, &value))
-        tree_free(value);
+static SubtreeSums *sums_counter(Tree *node) {
 
-    hmap_free(tree->content);
-    free(tree);
+    return node->hot ? &hot_stripes(node)[thread_stripe()].sums : &node->sums;
 }
-/**
- * protokół początkowy czytelników
- */
-static void reader_pp(Tree *tree) {
 
-    
-    if (pthread_mutex_lock(&tree->lock) != 0)
-        syserr("mutex lock failed");
-    if (tree->wcount > 0 || (tree->change == 1 && (tree->rcount > 0 || tree->wwait > 0))) {
-        tree->rwait++;
-        do {
-            if (pthread_cond_wait(&tree->readers, &tree->lock) != 0)
-                syserr("cond wait failed");
-        } while (tree->wcount > 0 || (tree->rcount > 0 && tree->change == 1)
-                 || (tree->wwait > 0 && tree->change == 1));
-        tree->rwait--;
-    }
-    tree->rcount++;
-    if (tree->rwait > 0) {
-        tree->change = 0;
-        if (pthread_cond_signal(&tree->readers) != 0)
-            syserr("cond signal failed");
-    } else if (tree->wwait > 0)
-        tree->change = 1;
-    tree->no_threads++;
-    if (pthread_mutex_unlock(&tree->lock) != 0)
-        syserr("");
+static void sums_init(SubtreeSums *sums) {
+
+    atomic_init(&sums->descendants, 0);
+    atomic_init(&sums->container_bytes, 0);
+    atomic_init(&sums->key_bytes, 0);
+    atomic_init(&sums->overhead_bytes, 0);
 }
 
 /**
- * protokół końcowy czytelników
+ * zapisuje do *stats pamięć całego poddrzewa node (razem z nim)
  */
-static void reader_fp(Tree *tree) {
+static void node_sums(Tree *node, MemStats *stats) {
+
+    size_t stripes = node->hot ? COUNT_STRIPES : 1;
+    memset(stats, 0, sizeof(MemStats));
+    for (size_t s = 0; s < stripes; s++) {
+        SubtreeSums *sums = node->hot ? &hot_stripes(node)[s].sums : &node->sums;
+        stats->nodes += atomic_load_explicit(&sums->descendants, memory_order_relaxed);
+        stats->container_bytes += atomic_load_explicit(&sums->container_bytes, memory_order_relaxed);
+        stats->key_bytes += atomic_load_explicit(&sums->key_bytes, memory_order_relaxed);
+        stats->overhead_bytes += atomic_load_explicit(&sums->overhead_bytes, memory_order_relaxed);
+    }
+    stats->nodes++;
+    stats->node_bytes = stats->nodes * (sizeof(Tree) - SYNC_BYTES);
+    stats->sync_bytes = stats->nodes * SYNC_BYTES;
+}
 
-    
-    if (pthread_mutex_lock(&tree->lock) != 0)
-        syserr("mutex lock failed");
-    tree->rcount--;
-    // jesli jestesmy ostatnim czytelnikiem to budzimy pisarza (drzwi sa zamknięte)
-    if (tree->rcount == 0 && pthread_cond_signal(&tree->writers) != 0)
-        syserr("reader_fp_signal");//return err;
+static size_t node_descendants(Tree *node) {
 
-    if (pthread_mutex_unlock(&tree->lock) != 0)
-        syserr("reader_fp_unlock");//return err;
+    MemStats stats;
+    node_sums(node, &stats);
+    return stats.nodes - 1;
+}
+
+static void add_counter(atomic_size_t *counter, size_t delta) {
+
+    if (delta)
+        atomic_fetch_add_explicit(counter, delta, memory_order_relaxed);
 }
 
 /**
- * protokół początkowy pisarzy
+ * dodaje delta (także "ujemną") do sum node i jego przodków aż do bound
+ * (bez niego; NULL - do korzenia); delta->nodes zmienia liczbę potomków,
+ * a node_bytes i sync_bytes pomijamy; wołający trzyma liczniki no_threads
+ * na tej ścieżce albo pisarza w bound, więc nikt jej nie zmienia
  */
-static void writer_pp(Tree *tree) {
-
-    
-    if (pthread_mutex_lock(&tree->lock) != 0)
-        syserr("");
-    // czekamy jesli sala jest niepusta
-    if (tree->wcount + tree->rcount + tree->no_threads > 0) {
-        tree->wwait++;
-        do {
-            if (pthread_cond_wait(&tree->writers, &tree->lock) != 0)
-                syserr("");
-        } while (tree->wcount + tree->rcount + tree->no_threads > 0);
-        tree->wwait--;
+static void add_sums(Tree *node, Tree *bound, const MemStats *delta) {
+
+    for (; node != bound; node = node->parent) {
+        SubtreeSums *sums = sums_counter(node);
+        add_counter(&sums->descendants, delta->nodes);
+        add_counter(&sums->container_bytes, delta->container_bytes);
+        add_counter(&sums->key_bytes, delta->key_bytes);
+        add_counter(&sums->overhead_bytes, delta->overhead_bytes);
     }
-    assert(tree->wcount == 0);
-    assert(tree->no_threads == 0);
-    tree->wcount++;
-    tree->no_threads++;
-    if (pthread_mutex_unlock(&tree->lock) != 0)
-        syserr("");
 }
 
 /**
- * protokół końcowy pisarzy
+ * zmienia znak wszystkich pól stats (liczniki się przekręcają)
  */
-static void writer_fp(Tree *tree) {
+static void negate_stats(MemStats *stats) {
+
+    stats->nodes = -stats->nodes;
+    stats->node_bytes = -stats->node_bytes;
+    stats->container_bytes = -stats->container_bytes;
+    stats->key_bytes = -stats->key_bytes;
+    stats->sync_bytes = -stats->sync_bytes;
+    stats->overhead_bytes = -stats->overhead_bytes;
+}
 
-    
-    if (pthread_mutex_lock(&tree->lock) != 0)
-        syserr("mutex lock failed");
-    tree->wcount--;
-    tree->no_threads--;
-    if (tree->rwait > 0) {
-        tree->change = 0;
-        if (pthread_cond_signal(&tree->readers) != 0) {
-            syserr("cond signal failed");//return err;
-        }
-    } else if (pthread_cond_signal(&tree->writers) != 0)
-        syserr("cond signal failed");//return err;
+/**
+ * Migawki (tree_snapshot) dzielą z drzewem wierzchołki i ich mapy dzieci.
+ * Każda migawka ma epokę: utworzenie migawki zwiększa epokę drzewa
+ * i czeka tylko na zmiany, które zaczęły się we wcześniejszej epoce
+ * (zmiana zapisuje się w liczniku swojej epoki dopiero po zajęciu
+ * wszystkich zmienianych wierzchołków, change_begin). Migawka widzi więc
+ * dokładnie zmiany z epok mniejszych od swojej. Pisarz, zanim zmieni mapę,
+ * którą może widzieć żywa migawka, odkłada ją do historii wierzchołka
+ * i dalej zmienia jej kopię (unshare_content), więc mapa widziana przez
+ * migawkę już się nie zmienia i migawkę czyta się bez żadnych zamków.
+ * Usuniętych wierzchołków, które może widzieć żywa migawka, nie zwalniamy
+ * od razu, tylko je odkładamy (retire). Dawne mapy i odłożone wierzchołki
+ * zwalnia zwalnianie migawek (collect), gdy nie potrzebuje ich już żadna
+ * żywa migawka; do tego czasu ich pamięć jest na koncie drzewa.
+ */
+typedef struct ChangeStripe {
+    _Alignas(CACHE_LINE) atomic_size_t active[2]; // trwające zmiany według parzystości epoki
+} ChangeStripe;
 
-    if (pthread_mutex_unlock(&tree->lock) != 0)
-        syserr("mutex unlock failed");
-}
+/**
+ * wierzchołek z niepustą historią map
+ */
+typedef struct Versioned {
+    Tree *node;
+    struct Versioned *next;
+} Versioned;
 
 /**
- * znajduje wierzchołek schodząc po drzewie jako czytelnik
+ * wierzchołek (subtree - z poddrzewem) odłączony przez zmianę z epoki
+ * epoch, który może jeszcze widzieć żywa migawka
  */
-static Tree *find_node_r(Tree *tree, const char *path) {
+typedef struct Retired {
+    Tree *node;
+    uint64_t epoch;
+    bool subtree;
+    struct Retired *next;
+} Retired;
+
+struct TreeShared {
+    ChangeStripe changes[COUNT_STRIPES];
+    atomic_uint_fast64_t epoch; // epoka najnowszej migawki
+    // najnowsza i najstarsza żywa migawka (0 - nie ma żadnej), do szybkiego
+    // sprawdzenia przez pisarzy, czy jakaś może widzieć zmieniany wierzchołek
+    atomic_uint_fast64_t newest_live, oldest_live;
+    pthread_mutex_t snap_lock; // tworzenie i zwalnianie migawek
+    TreeSnapshot *snapshots; // żywe, od najnowszej
+    _Atomic(Versioned *) versioned;
+    _Atomic(Retired *) retired;
+    // odłączone poddrzewa, odłożone wierzchołki i dawne mapy
+    MemAccount *account;
+    atomic_size_t refs; // drzewo i zadania zwalniające jego poddrzewa
+};
 
-    assert(is_path_valid(path));
+/**
+ * zmiana drzewa wykonywana przez wątek (NULL - żadna)
+ */
+static _Thread_local struct {
+    TreeShared *shared;
+    uint64_t epoch;
+} changing;
 
-    reader_pp(tree);
+/**
+ * stan wspólny drzewa leży w bloku korzenia, za paskami jego sum
+ */
+static TreeShared *tree_shared(Tree *root) {
 
-    Tree *child = find_child(tree, path);
+    assert(root->hot && !root->parent);
+    return (TreeShared *) ((char *) root - HOT_OFFSET + HOT_BYTES + COUNT_STRIPES * sizeof(CountStripe));
+}
 
-    if (child == tree)
-        return tree;
+static Tree *shared_root(TreeShared *shared) {
 
-    reader_fp(tree);
-    if (!child) {
-        update_no_threads(tree, NULL);
-        return NULL;
-    } else {
-        return find_node_r(child, split_path(path, NULL));
-    }
+    return (Tree *) ((char *) shared - COUNT_STRIPES * sizeof(CountStripe) - HOT_BYTES + HOT_OFFSET);
 }
 
+static Tree *find_node_r(Tree *tree, const char *path);
+static Tree *find_child(Tree *tree, const char *path);
+static Tree *find_node_w(Tree *tree, const char *dest, bool lock_first, Tree *bound);
+static void update_no_threads(Tree *tree, Tree *bound);
+static HashMap *content_at(Tree *node, uint64_t epoch);
+
 /**
- * jeśli istnieje w tree dziecko o podanej
- * ścieżce zwraca na nie wskaźnik, wpp NULL.
+ * inicjuje pamięć wierzchołka: obiekty synchronizacji i pustą zawartość
+ * (w trybie TREE_ARENA przydzieloną obok hint)
  */
-static Tree *find_child(Tree *tree, const char *path) {
+static void node_init_near(Tree *node, const void *hint) {
 
-    if (path && strlen(path) == 1 && *path == '/')
-        return tree;
+    node->content = hmap_new_near(hint);
+    assert(node->content);
 
-    HashMapIterator it = hmap_iterator(tree->content);
-    const char *key;
-    void *value;
-    char component[MAX_FOLDER_NAME_LENGTH + 1];
-    path = split_path(path, component); assert(path);
+#ifndef TREE_LOCK_TABLE
+    node_mutex_init(&node->lock);
+    node_cond_init(&node->readers);
+    node_cond_init(&node->writers);
+#endif
+}
 
-    while (hmap_next(tree->content, &it, &key, &value))
-        if (!strcmp(component, key))
-            return value;
+static void node_init(void *p) {
+
+    node_init_near(p, p);
+}
+
+static void node_destroy(void *p) {
 
-    return NULL;
+    Tree *node = p;
+    hmap_free(node->content);
 }
 
+#ifdef TREE_NODE_POOL
 /**
- * aktualizuje atrybut zliczający liczbę wątków w poddrzewie
- * zmniejszając go o 1 na ścieżce w górę od tree do bound lub
- * do korzenia drzewa jeśli bound == NULL
+ * wierzchołki wszystkich drzew pochodzą ze wspólnej puli,
+ * wracają do niej zainicjowane (z pustą zawartością)
  */
-static void update_no_threads(Tree *tree, Tree *bound) {
+static NodePool *node_pool;
+static pthread_once_t node_pool_once = PTHREAD_ONCE_INIT;
 
-    if (tree && tree != bound) {
-        if (pthread_mutex_lock(&tree->lock) != 0)
-            syserr("mutex lock failed");
-        
-        tree->no_threads--;
-        assert(tree->no_threads >= 0);
-        Tree *parent = tree->parent;
-        if (tree->no_threads + tree->rwait + tree->rcount + tree->wcount + tree->change == 0
-            && tree->wwait > 0 && pthread_cond_signal(&tree->writers) != 0)
-                syserr("cond signal failed");
-        
-        if (pthread_mutex_unlock(&tree->lock) != 0)
-            syserr("mutex unlock failed");
-        
-        return update_no_threads(parent, bound);
+static void make_node_pool(void) {
+
+    node_pool = node_pool_new(sizeof(Tree), node_init, node_destroy);
+}
+#endif
+
+/**
+ * Zużycie pamięci liczymy na bieżąco, w sumach poddrzew (SubtreeSums):
+ * poddrzewo wierzchołka to jego struktura i mapa dzieci (z ich nazwami)
+ * oraz poddrzewa dzieci. Zmiany mapy dopisuje na całej ścieżce do korzenia
+ * pisarz, który ją zmienia, a posortowany indeks nazw czytelnik, który
+ * go zbudował (tree_list_page). Przeniesienie przepisuje tylko sumy
+ * przenoszonego poddrzewa między ścieżkami do wspólnego przodka.
+ */
+static void map_memory(HashMap *map, MemStats *stats) {
+
+    HashMapMemory mem;
+    hmap_memory(map, &mem);
+    memset(stats, 0, sizeof(MemStats));
+    stats->container_bytes = mem.table + mem.entries + mem.index;
+    stats->key_bytes = mem.keys;
+    stats->overhead_bytes = mem.overhead;
+}
+
+static void node_memory(Tree *node, MemStats *stats) {
+
+    map_memory(node->content, stats);
+    stats->nodes = 1;
+    stats->node_bytes = sizeof(Tree) - SYNC_BYTES;
+    stats->sync_bytes = SYNC_BYTES;
+    if (node->hot) {
+        stats->overhead_bytes += malloc_usable_size((char *) node - HOT_OFFSET) - sizeof(Tree) + sizeof(size_t);
+        return;
     }
+#if defined(TREE_USE_MALLOC)
+    stats->overhead_bytes += malloc_usable_size(node) - sizeof(Tree) + sizeof(size_t);
+#elif defined(TREE_ARENA)
+    stats->overhead_bytes += arena_overhead(node, sizeof(Tree));
+#else
+    stats->overhead_bytes += node_pool_object_size(node_pool) - sizeof(Tree);
+#endif
 }
 
-char *tree_list(Tree *tree, const char *path) {
+/**
+ * dopisuje do delta zmianę pamięci mapy node od stanu before
+ */
+static void map_change(Tree *node, const MemStats *before, MemStats *delta) {
+
+    MemStats now;
+    map_memory(node->content, &now);
+    // liczniki przekręcają się, więc ujemna różnica też jest dobra
+    delta->container_bytes += now.container_bytes - before->container_bytes;
+    delta->key_bytes += now.key_bytes - before->key_bytes;
+    delta->overhead_bytes += now.overhead_bytes - before->overhead_bytes;
+}
 
-    if (!is_path_valid(path))
-        return NULL;
+/**
+ * dopisuje do sum node i jego przodków zmianę pamięci jego mapy od stanu before
+ */
+static void charge_map(Tree *node, const MemStats *before) {
 
-    Tree *dest = find_node_r(tree, path);
+    MemStats delta;
+    memset(&delta, 0, sizeof(MemStats));
+    map_change(node, before, &delta);
+    add_sums(node, NULL, &delta);
+}
 
-    if (!dest)
-        return NULL;
+/**
+ * dopisuje do sum node (i tylko jego) pamięć jego struktury i mapy
+ */
+static void own_memory(Tree *node) {
 
-    char *res = make_map_contents_string(dest->content);
-    reader_fp(dest);
-    update_no_threads(dest, NULL);
+    MemStats mem;
+    node_memory(node, &mem);
+    mem.nodes = 0; // wierzchołek nie jest swoim potomkiem
+    add_sums(node, node->parent, &mem);
+}
 
-    return res;
+/**
+ * czy wierzchołek o rodzicu parent ma głębokość mniejszą niż TREE_HOT_DEPTH
+ */
+static bool is_hot_position(Tree *parent) {
+
+    int depth = 0;
+    for (Tree *node = parent; node && depth < TREE_HOT_DEPTH; node = node->parent)
+        depth++;
+    return depth < TREE_HOT_DEPTH;
 }
 
-int tree_create(Tree *tree, const char *path) {
+/**
+ * Wierzchołek w bloku wyrównanym do linii, przesunięty o HOT_OFFSET:
+ * pola wyszukiwania kończą pierwszą linię, a stan synchronizacji zaczyna
+ * drugą; reszta obu linii to wypełnienie. Za nimi leżą paski sum
+ * poddrzewa i extra bajtów wołającego (w korzeniu stan wspólny drzewa).
+ * Takich wierzchołków jest niewiele, więc zawsze biorą pamięć
+ * z aligned_alloc.
+ */
+static Tree *hot_node_new(size_t extra) {
 
-    if (strlen(path) == 1 && *path == '/')
-        return EEXIST;
-    if (!is_path_valid(path))
-        return EINVAL;
+    char *block = aligned_alloc(CACHE_LINE, HOT_BYTES + COUNT_STRIPES * sizeof(CountStripe) + extra);
+    if (!block)
+        syserr("allocation failed");
+    Tree *node = (Tree *) (block + HOT_OFFSET);
+    node_init_near(node, NULL);
+    node->hot = true;
+    for (size_t s = 0; s < COUNT_STRIPES; s++)
+        sums_init(&hot_stripes(node)[s].sums);
+    return node;
+}
 
-    
-    char component[MAX_FOLDER_NAME_LENGTH + 1];
-    char *path_to_par = make_path_to_parent(path, component);
-    Tree *parent = find_node_w(tree, path_to_par, true, NULL);
-    free(path_to_par);
+static Tree *cold_node_new(Tree *parent) {
 
-    if (!parent)
-        return ENOENT;
-    assert(parent->no_threads == 1);
-    if (hmap_get(parent->content, component)) { // folder już istnieje
-        writer_fp(parent);
-        update_no_threads(parent->parent, NULL);
-        return EEXIST;
-    }
+    (void) parent;
+#if defined(TREE_USE_MALLOC)
     Tree *new = malloc(sizeof(Tree));
     if (!new)
         syserr("allocation failed");
+    node_init(new);
+#elif defined(TREE_ARENA)
+    // dzieci w miarę możliwości w tym samym kawałku areny co rodzic
+    // (gorące wierzchołki nie leżą w arenie)
+    Tree *new = arena_alloc_near(sizeof(Tree), parent && !parent->hot ? parent : NULL);
+    node_init(new);
+#else
+    pthread_once(&node_pool_once, make_node_pool);
+    Tree *new = node_pool_get(node_pool);
+#endif
+    new->hot = false;
+    return new;
+}
 
-    if (pthread_mutex_init(&new->lock, NULL) != 0)
-        syserr("lock init failed");
-    if (pthread_cond_init(&new->readers, NULL) != 0)
-        syserr ("cond init failed");
-    if (pthread_cond_init(&new->writers, NULL) != 0)
-        syserr ("cond init failed");
+static void node_reset(Tree *node, Tree *parent) {
+
+    assert(hmap_size(node->content) == 0);
+    node->rcount = node->rwait = node->wcount = node->wwait = 0;
+    node->change = 0;
+    node->no_threads = 0;
+    node->parent = parent;
+    node->version = 0;
+    node->watches = NULL;
+    atomic_init(&node->watched, 0);
+    sums_init(&node->sums);
+    atomic_init(&node->history, NULL);
+    atomic_init(&node->born, 0);
+}
 
-    new->rcount = new->rwait = new->wcount = new->wwait = 0;
-    new->change = 0;
-    new->no_threads = 0;
-    new->content = hmap_new();
-    new->parent = parent;
+/**
+ * tworzy pusty wierzchołek o rodzicu parent
+ */
+static Tree *node_new(Tree *parent) {
 
-    assert(hmap_insert(parent->content, component, new));
+    Tree *new = is_hot_position(parent) ? hot_node_new(0) : cold_node_new(parent);
+    node_reset(new, parent);
+    if (changing.shared)
+        atomic_store_explicit(&new->born, changing.epoch, memory_order_relaxed);
 
-    writer_fp(parent);
-    update_no_threads(parent->parent, NULL);
-    return 0;
+    own_memory(new);
+    return new;
 }
 
 /**
- * schodzi po drzewie jako czytelnik szukając wierzchołka dest,
- * jeśli go znajdzie to blokuje go jako pisarz, wpp zwraca NULL
+ * tworzy pusty wierzchołek kopii (tree_copy) bez sum; kopie są zwykłymi
+ * wierzchołkami, bo ich głębokość nie jest jeszcze znana, a gorące robi
+ * z nich dopiero dołączenie kopii (place_linked).
+ * born to epoka drzewa z początku kopiowania: kopię dołączamy później,
+ * więc nie zobaczy jej żadna migawka z epoki nie większej niż born
  */
-Tree *find_node_w(Tree *tree, const char *dest, bool lock_first, Tree *bound) {
-
-    assert(is_path_valid(dest));
-    if (strlen(dest) == 1 && *dest == '/') {
-        writer_pp(tree);
-        return tree;
-    }
-    if (lock_first)
-        reader_pp(tree);
+static Tree *clone_node_new(Tree *parent, uint64_t born) {
 
-    Tree *child = find_child(tree, dest);
-    if (lock_first)
-        reader_fp(tree);
-    if (!child) {
-        if (lock_first)
-            update_no_threads(tree, bound);
-        else if (tree != bound)
-            update_no_threads(tree->parent, bound);
-        return NULL;
-    }
-    return find_node_w(child, split_path(dest, NULL), true, bound);
+    Tree *new = cold_node_new(parent);
+    node_reset(new, parent);
+    atomic_init(&new->born, born);
+    return new;
 }
 
-int tree_remove(Tree *tree, const char *path) {
+static atomic_uint_fast64_t next_move_cookie;
 
-    if (!is_path_valid(path))
-        return EINVAL;
-    if (path && strlen(path) == 1 && *path == '/')
-        return EBUSY;
+/**
+ * zapisuje zmianę zbioru dzieci node (zajętego jako pisarz)
+ */
+static void content_changed(Tree *node) {
 
-    
-    char component[MAX_FOLDER_NAME_LENGTH + 1];
-    char *path_to_par = make_path_to_parent(path, component);
+    node->version++;
+}
 
-    Tree *dest_par = find_node_w(tree, path_to_par, true, NULL);
-    free(path_to_par);
+/**
+ * Licznik watched wierzchołka to liczba obserwatorów w jego poddrzewie
+ * (z nim samym), więc w korzeniu - w całym drzewie. Zmienia go każde
+ * dodanie i usunięcie obserwatora oraz przeniesienie i usunięcie
+ * obserwowanego poddrzewa, na ścieżce do bound (jak liczbę potomków).
+ */
+static void add_watched(Tree *node, Tree *bound, unsigned delta) {
 
-    if (!dest_par)
-        return ENOENT;
-    assert(dest_par->no_threads == 1);
-    Tree *dest = hmap_get(dest_par->content, component);
+    if (delta == 0)
+        return;
+    for (; node != bound; node = node->parent)
+        atomic_fetch_add_explicit(&node->watched, delta, memory_order_relaxed);
+}
 
-    if (!dest) {
-        writer_fp(dest_par);
-        update_no_threads(dest_par->parent, NULL);
-        return ENOENT;
-    }
+static unsigned node_watched(Tree *node) {
 
-    if (pthread_mutex_trylock(&dest->lock) != 0)
-        fatal("mutex lock failed");
+    return atomic_load_explicit(&node->watched, memory_order_relaxed);
+}
 
-    assert(dest->no_threads == 0);
+/**
+ * zwalnia listę obserwatorów wierzchołka; liczniki watched poprawia
+ * wołający, odłączając wierzchołek od drzewa
+ */
+static void free_watches(Tree *node) {
+
+    while (node->watches) {
+        Watch *watch = node->watches;
+        node->watches = watch->next;
+        free(watch);
+    }
+}
+
+/**
+ * wysyła zdarzenie o folderze path[0..len), którego rodzicem jest parent,
+ * obserwatorom parent i obserwatorom całych poddrzew jego przodków;
+ * wołający trzyma pisarza w parent (lub jego przodku) i liczniki nad nim.
+ * Obserwatorzy na ścieżce wołającego nie mogą się wtedy zmienić, a są
+ * liczeni w korzeniu tree, więc w drzewie bez obserwatorów zmiana kosztuje
+ * tylko odczyt tego licznika.
+ */
+static void notify(Tree *tree, Tree *parent, TreeEventType type, uint64_t cookie, const char *path, size_t len) {
+
+    if (node_watched(tree) == 0)
+        return;
+    for (Tree *node = parent; node; node = node->parent)
+        for (Watch *watch = node->watches; watch; watch = watch->next)
+            if (node == parent || watch->recursive)
+                watch_queue_push(watch->queue, type, cookie, path, len);
+}
+
+/**
+ * zwalnia wierzchołek, nie patrząc na jego konto ani dzieci
+ * (jego obserwatorzy znikają razem z nim)
+ */
+static void node_put(Tree *node) {
+
+    free_watches(node);
+    if (node->hot) {
+        node_destroy(node);
+        free((char *) node - HOT_OFFSET);
+        return;
+    }
+#if defined(TREE_USE_MALLOC)
+    node_destroy(node);
+    free(node);
+#elif defined(TREE_ARENA)
+    node_destroy(node);
+    arena_free(node, sizeof(Tree));
+#else
+    hmap_clear(node->content); // zwalnia wpisy i tablicę kubełków
+    node_pool_put(node_pool, node);
+#endif
+}
+
+/**
+ * zwalnia wierzchołek z pustą zawartością
+ */
+static void node_delete(Tree *node) {
+
+    assert(hmap_size(node->content) == 0);
+    node_put(node);
+}
+
+static void lock_snapshots(TreeShared *shared) {
+
+    if (pthread_mutex_lock(&shared->snap_lock) != 0)
+        syserr("snapshot lock failed");
+}
+
+static void unlock_snapshots(TreeShared *shared) {
+
+    if (pthread_mutex_unlock(&shared->snap_lock) != 0)
+        syserr("snapshot unlock failed");
+}
+
+static void shared_init(TreeShared *shared) {
+
+    for (size_t s = 0; s < COUNT_STRIPES; s++) {
+        atomic_init(&shared->changes[s].active[0], 0);
+        atomic_init(&shared->changes[s].active[1], 0);
+    }
+    atomic_init(&shared->epoch, 0);
+    atomic_init(&shared->newest_live, 0);
+    atomic_init(&shared->oldest_live, 0);
+    if (pthread_mutex_init(&shared->snap_lock, NULL) != 0)
+        syserr("lock init failed");
+    shared->snapshots = NULL;
+    atomic_init(&shared->versioned, NULL);
+    atomic_init(&shared->retired, NULL);
+    shared->account = mem_account_new();
+    atomic_init(&shared->refs, 1);
+}
+
+static void shared_release(TreeShared *shared);
+
+Tree *tree_new() {
+
+    Tree *root = hot_node_new(sizeof(TreeShared));
+    node_reset(root, NULL);
+    own_memory(root);
+    shared_init(tree_shared(root));
+    return root;
+}
+
+/**
+ * zaczyna zmianę drzewa o korzeniu tree; wołający zajął już wszystkie
+ * wierzchołki, które zmieni, więc kolejne zmiany wierzchołka mają
+ * niemalejące epoki
+ */
+static void change_begin(Tree *tree) {
+
+    TreeShared *shared = tree_shared(tree);
+    ChangeStripe *stripe = &shared->changes[thread_stripe()];
+    uint64_t epoch = atomic_load(&shared->epoch);
+    while (true) {
+        atomic_fetch_add(&stripe->active[epoch & 1], 1);
+        // migawka, która zwiększyła epokę w międzyczasie, mogła już
+        // sprawdzić nasz licznik, więc zapisujemy się w nowej epoce
+        uint64_t now = atomic_load(&shared->epoch);
+        if (now == epoch)
+            break;
+        atomic_fetch_sub(&stripe->active[epoch & 1], 1);
+        epoch = now;
+    }
+    changing.shared = shared;
+    changing.epoch = epoch;
+}
+
+static void change_end(void) {
+
+    ChangeStripe *stripe = &changing.shared->changes[thread_stripe()];
+    atomic_fetch_sub_explicit(&stripe->active[changing.epoch & 1], 1, memory_order_release);
+    changing.shared = NULL;
+}
+
+/**
+ * czy może istnieć żywa migawka o epoce z (from, to]; fałszywie dodatni
+ * wynik kosztuje tylko zbędną kopię, a migawek utworzonych przed
+ * rozpoczęciem zmiany wołającego nie pomija
+ */
+static bool snap_may_see(TreeShared *shared, uint64_t from, uint64_t to) {
+
+    if (from >= to)
+        return false;
+    uint64_t oldest = atomic_load(&shared->oldest_live);
+    return oldest != 0 && oldest <= to && atomic_load(&shared->newest_live) > from;
+}
+
+static void push_versioned(TreeShared *shared, Versioned *cell) {
+
+    cell->next = atomic_load_explicit(&shared->versioned, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&shared->versioned, &cell->next, cell,
+                                                  memory_order_release, memory_order_relaxed))
+        ;
+}
+
+static void push_retired(TreeShared *shared, Retired *retired) {
+
+    retired->next = atomic_load_explicit(&shared->retired, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&shared->retired, &retired->next, retired,
+                                                  memory_order_release, memory_order_relaxed))
+        ;
+}
+
+/**
+ * odkłada node (subtree - z poddrzewem) odłączony przez zmianę z epoki
+ * epoch do zwolnienia przez collect
+ */
+static void retire(TreeShared *shared, Tree *node, uint64_t epoch, bool subtree) {
+
+    Retired *retired = malloc(sizeof(Retired));
+    if (!retired)
+        syserr("allocation failed");
+    retired->node = node;
+    retired->epoch = epoch;
+    retired->subtree = subtree;
+    push_retired(shared, retired);
+}
+
+static HashMap *copy_map(Tree *node) {
+
+    HashMap *copy = hmap_new_near(node->hot ? NULL : node);
+    HashMapIterator it = hmap_iterator(node->content);
+    const PackedName *key;
+    void *value;
+    while (hmap_next(node->content, &it, &key, &value))
+        hmap_insert_packed(copy, key, value);
+    // indeks przechodzi na kopię, inaczej zbudowałaby go od nowa najbliższa
+    // strona tree_list_page
+    if (hmap_index(node->content)) {
+        bool built;
+        make_map_index(copy, &built);
+    }
+    return copy;
+}
+
+/**
+ * przygotowuje mapę node (zajętego jako pisarz w bieżącej zmianie) do
+ * zmiany: jeśli może ją widzieć żywa migawka, odkłada ją do historii
+ * i podstawia jej kopię, której zmiany migawki już nie zobaczą
+ */
+static void unshare_content(Tree *node) {
+
+    TreeShared *shared = changing.shared;
+    assert(shared);
+    uint64_t born = atomic_load_explicit(&node->born, memory_order_relaxed);
+    if (!snap_may_see(shared, born, changing.epoch)) {
+        // żywe migawki z epok do bieżącej włącznie tej mapy nie widzą
+        atomic_store_explicit(&node->born, changing.epoch, memory_order_relaxed);
+        return;
+    }
+
+    ContentVersion *version = malloc(sizeof(ContentVersion));
+    if (!version)
+        syserr("allocation failed");
+    MemStats before;
+    map_memory(node->content, &before);
+    // kopiujemy przed dołożeniem do historii, bo od tej chwili collect
+    // może zwolnić mapę, gdy migawki z jej epok już zniknęły
+    HashMap *copy = copy_map(node);
+    atomic_init(&version->map, node->content);
+    version->from = born;
+    version->to = changing.epoch;
+    MemStats kept = before;
+    kept.container_bytes += sizeof(ContentVersion);
+    mem_account_add(shared->account, &kept);
+
+    ContentVersion *older = atomic_load_explicit(&node->history, memory_order_relaxed);
+    do
+        atomic_store_explicit(&version->older, older, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&node->history, &older, version,
+                                                  memory_order_release, memory_order_relaxed));
+    if (!older) {
+        Versioned *cell = malloc(sizeof(Versioned));
+        if (!cell)
+            syserr("allocation failed");
+        cell->node = node;
+        push_versioned(shared, cell);
+    }
+    // migawki czytają bez zamków najpierw mapę, potem epokę, a na końcu
+    // historię, więc publikujemy je w odwrotnej kolejności (zob. content_at)
+    atomic_store_explicit(&node->born, changing.epoch, memory_order_release);
+    __atomic_store_n(&node->content, copy, __ATOMIC_RELEASE);
+    charge_map(node, &before);
+}
+
+/**
+ * zwalnia pusty wierzchołek odłączony w bieżącej zmianie albo odkłada
+ * go, jeśli może go jeszcze widzieć żywa migawka; sumy poprawił już
+ * wołający
+ */
+static void drop_node(Tree *node) {
+
+    TreeShared *shared = changing.shared;
+    if (!atomic_load_explicit(&node->history, memory_order_relaxed)
+        && !snap_may_see(shared, atomic_load_explicit(&node->born, memory_order_relaxed), changing.epoch)) {
+        node_delete(node);
+        return;
+    }
+    free_watches(node);
+    MemStats mem;
+    node_memory(node, &mem);
+    mem_account_add(shared->account, &mem);
+    retire(shared, node, changing.epoch, false);
+}
+
+// co tyle zwolnionych wierzchołków zadanie sprawdza, czy oddać część pracy
+#define TEARDOWN_SPLIT_INTERVAL 1024
+
+/**
+ * zadanie zwolnienia poddrzewa; przy zwalnianiu odłączonego poddrzewa
+ * shared to wspólny stan drzewa, z którego konta odejmujemy zwolnioną
+ * pamięć (zadanie trzyma do niego odwołanie), przy zwalnianiu całego
+ * drzewa NULL
+ */
+typedef struct Reclaim {
+    Tree *node;
+    TreeShared *shared;
+} Reclaim;
+
+static Reclaim *reclaim_new(Tree *node, TreeShared *shared) {
+
+    Reclaim *job = malloc(sizeof(Reclaim));
+    if (!job)
+        syserr("allocation failed");
+    job->node = node;
+    job->shared = shared;
+    if (shared)
+        atomic_fetch_add_explicit(&shared->refs, 1, memory_order_relaxed);
+    return job;
+}
+
+/**
+ * zwalnia poddrzewo job->node w głąb, trzymając czekające wierzchołki na
+ * własnym stosie; gdy w puli są bezczynne wątki, oddaje im wierzchołki
+ * z dna stosu (najwyżej położone, więc zwykle z największymi poddrzewami).
+ * Wierzchołki z historią map odkłada, bo ich mapy mogą czytać migawki.
+ */
+static void free_subtree(WorkGroup *group, void *arg) {
+
+    Reclaim *job = arg;
+    MemStats freed, mem;
+    memset(&freed, 0, sizeof(MemStats));
+    size_t capacity = 64, n = 1, count = 0;
+    Tree **stack = malloc(capacity * sizeof(Tree *));
+    if (!stack)
+        syserr("allocation failed");
+    stack[0] = job->node;
+
+    while (n > 0) {
+        Tree *node = stack[--n];
+        HashMapIterator it = hmap_iterator(node->content);
+        const PackedName *key;
+        void *value;
+        while (hmap_next(node->content, &it, &key, &value)) {
+            if (n == capacity && !(stack = realloc(stack, (capacity *= 2) * sizeof(Tree *))))
+                syserr("allocation failed");
+            stack[n++] = value;
+        }
+        if (job->shared && atomic_load_explicit(&node->history, memory_order_acquire)) {
+            // pamięć zostaje na koncie do zwolnienia przez collect
+            retire(job->shared, node, 0, false);
+        } else {
+            assert(!atomic_load_explicit(&node->history, memory_order_relaxed));
+            if (job->shared) {
+                node_memory(node, &mem);
+                mem_stats_add(&freed, &mem);
+            }
+            node_put(node);
+        }
+
+        if (++count % TEARDOWN_SPLIT_INTERVAL == 0 && n > 1) {
+            size_t given = work_pool_idle();
+            if (given > n / 2)
+                given = n / 2;
+            for (size_t i = 0; i < given; i++)
+                work_submit(group, free_subtree, reclaim_new(stack[i], job->shared));
+            memmove(stack, stack + given, (n - given) * sizeof(Tree *));
+            n -= given;
+        }
+    }
+    free(stack);
+    if (job->shared) {
+        mem_account_sub(job->shared->account, &freed);
+        shared_release(job->shared);
+    }
+    free(job);
+}
+
+static void collect(TreeShared *shared);
+
+/**
+ * migawki drzewa są już zwolnione, więc collect zwalnia wszystkie dawne
+ * mapy i zleca zwolnienie odłożonych poddrzew; poddrzewa dzieci korzenia
+ * zwalniamy bez liczenia pamięci, a sam korzeń leży w bloku ze stanem
+ * wspólnym, więc zwalnia go ostatnie shared_release
+ */
+static void free_tree(WorkGroup *group, void *arg) {
+
+    Tree *tree = arg;
+    TreeShared *shared = tree_shared(tree);
+    lock_snapshots(shared);
+    assert(!shared->snapshots);
+    collect(shared);
+    unlock_snapshots(shared);
+
+    HashMapIterator it = hmap_iterator(tree->content);
+    const PackedName *key;
+    void *value;
+    while (hmap_next(tree->content, &it, &key, &value))
+        work_submit(group, free_subtree, reclaim_new(value, NULL));
+    shared_release(shared);
+}
+
+/**
+ * wspólna grupa zadań zwalniających w tle: drzewa z tree_free_parallel
+ * bez czekania i poddrzewa z tree_remove_recursive
+ */
+static WorkGroup *reclaim_group;
+static pthread_once_t reclaim_once = PTHREAD_ONCE_INIT;
+
+static void make_reclaim_group(void) {
+
+    reclaim_group = work_group_new();
+}
+
+void tree_free_parallel(Tree *tree, bool wait) {
+
+    assert(tree);
+
+    if (wait) {
+        WorkGroup *group = work_group_new();
+        free_tree(group, tree);
+        work_group_wait(group);
+    } else {
+        pthread_once(&reclaim_once, make_reclaim_group);
+        work_submit(reclaim_group, free_tree, tree);
+    }
+}
+
+void tree_reclaim_wait(void) {
+
+    pthread_once(&reclaim_once, make_reclaim_group);
+    work_group_drain(reclaim_group);
+}
+
+void tree_free(Tree *tree) {
+
+    tree_free_parallel(tree, true);
+}
+
+int tree_set_lock_table_size(size_t size) {
+
+#ifdef TREE_LOCK_TABLE
+    return lock_table_configure(size) ? 0 : EBUSY;
+#else
+    (void) size;
+    return ENOTSUP;
+#endif
+}
+
+void tree_pool_stats(NodePoolStats *stats) {
+
+#ifndef TREE_NODE_POOL
+    memset(stats, 0, sizeof(NodePoolStats));
+#else
+    pthread_once(&node_pool_once, make_node_pool);
+    node_pool_stats(node_pool, stats);
+#endif
+}
+
+#ifdef TREE_LOCK_TABLE
+static void lock_node(Tree *tree) {
+
+    node_mutex_lock(&lock_table_stripe(tree)->lock);
+}
+
+static void unlock_node(Tree *tree) {
+
+    node_mutex_unlock(&lock_table_stripe(tree)->lock);
+}
+
+static void wait_readers(Tree *tree) {
+
+    LockStripe *stripe = lock_table_stripe(tree);
+    node_cond_wait(&stripe->readers, &stripe->lock);
+}
+
+static void wait_writers(Tree *tree) {
+
+    LockStripe *stripe = lock_table_stripe(tree);
+    node_cond_wait(&stripe->writers, &stripe->lock);
+}
+
+/**
+ * na pasku mogą czekać wątki innych wierzchołków,
+ * więc budzimy wszystkich, a każdy sprawdza swój warunek
+ */
+static void signal_readers(Tree *tree) {
+
+    node_cond_broadcast(&lock_table_stripe(tree)->readers);
+}
+
+static void signal_writers(Tree *tree) {
+
+    node_cond_broadcast(&lock_table_stripe(tree)->writers);
+}
+#else
+static void lock_node(Tree *tree) {
+
+    node_mutex_lock(&tree->lock);
+}
+
+static void unlock_node(Tree *tree) {
+
+    node_mutex_unlock(&tree->lock);
+}
+
+static void wait_readers(Tree *tree) {
+
+    node_cond_wait(&tree->readers, &tree->lock);
+}
+
+static void wait_writers(Tree *tree) {
+
+    node_cond_wait(&tree->writers, &tree->lock);
+}
+
+static void signal_readers(Tree *tree) {
+
+    node_cond_signal(&tree->readers);
+}
+
+static void signal_writers(Tree *tree) {
+
+    node_cond_signal(&tree->writers);
+}
+#endif
+
+/**
+ * protokół początkowy czytelników
+ */
+static void reader_pp(Tree *tree) {
+
+    
+    lock_node(tree);
+    if (tree->wcount > 0 || (tree->change == 1 && (tree->rcount > 0 || tree->wwait > 0))) {
+        tree->rwait++;
+        do {
+            wait_readers(tree);
+        } while (tree->wcount > 0 || (tree->rcount > 0 && tree->change == 1)
+                 || (tree->wwait > 0 && tree->change == 1));
+        tree->rwait--;
+    }
+    tree->rcount++;
+    if (tree->rwait > 0) {
+        tree->change = 0;
+        signal_readers(tree);
+    } else if (tree->wwait > 0)
+        tree->change = 1;
+    tree->no_threads++;
+    unlock_node(tree);
+}
+
+/**
+ * protokół końcowy czytelników
+ */
+static void reader_fp(Tree *tree) {
+
+    
+    lock_node(tree);
+    tree->rcount--;
+    // jesli jestesmy ostatnim czytelnikiem to budzimy pisarza (drzwi sa zamknięte)
+    if (tree->rcount == 0) {
+        if (tree->wwait > 0)
+            signal_writers(tree);
+        else if (tree->rwait > 0) {
+            tree->change = 0;
+            signal_readers(tree);
+        }
+    }
+
+    unlock_node(tree);
+}
+
+/**
+ * protokół początkowy pisarzy
+ */
+static void writer_pp(Tree *tree) {
+
+    
+    lock_node(tree);
+    // czekamy jesli sala jest niepusta
+    if (tree->wcount + tree->rcount + tree->no_threads > 0) {
+        tree->wwait++;
+        do {
+            wait_writers(tree);
+        } while (tree->wcount + tree->rcount + tree->no_threads > 0);
+        tree->wwait--;
+    }
+    assert(tree->wcount == 0);
+    assert(tree->no_threads == 0);
+    tree->wcount++;
+    tree->no_threads++;
+    unlock_node(tree);
+}
+
+/**
+ * protokół końcowy pisarzy
+ */
+static void writer_fp(Tree *tree) {
+
+    
+    lock_node(tree);
+    tree->wcount--;
+    tree->no_threads--;
+    // change zostawione na 1 wstrzymywałoby kolejnych czytelników na zawsze
+    tree->change = 0;
+    if (tree->rwait > 0) {
+        signal_readers(tree);
+    } else
+        signal_writers(tree);
+
+    unlock_node(tree);
+}
+
+/**
+ * protokół początkowy czytelników bez czekania: false (i nic nie
+ * zmienia), gdy reader_pp musiałby czekać
+ */
+static bool reader_try(Tree *tree) {
+
+    lock_node(tree);
+    if (tree->wcount > 0 || (tree->change == 1 && (tree->rcount > 0 || tree->wwait > 0))) {
+        unlock_node(tree);
+        return false;
+    }
+    tree->rcount++;
+    if (tree->rwait > 0) {
+        tree->change = 0;
+        signal_readers(tree);
+    } else if (tree->wwait > 0)
+        tree->change = 1;
+    tree->no_threads++;
+    unlock_node(tree);
+    return true;
+}
+
+/**
+ * kończy pisarza, ale zostawia jego licznik no_threads, jakby wątek tylko
+ * przechodził przez wierzchołek w głąb; czekający czytelnicy wchodzą,
+ * pisarze czekają dalej na licznik
+ */
+static void writer_downgrade(Tree *tree) {
+
+    lock_node(tree);
+    tree->wcount--;
+    tree->change = 0;
+    if (tree->rwait > 0)
+        signal_readers(tree);
+    unlock_node(tree);
+}
+
+/**
+ * protokół początkowy pisarzy bez czekania: false, gdy sala jest niepusta
+ */
+static bool writer_try(Tree *tree) {
+
+    lock_node(tree);
+    bool entered = tree->wcount + tree->rcount + tree->no_threads == 0;
+    if (entered) {
+        tree->wcount++;
+        tree->no_threads++;
+    }
+    unlock_node(tree);
+    return entered;
+}
+
+/**
+ * znajduje wierzchołek schodząc po drzewie jako czytelnik
+ */
+static Tree *find_node_r(Tree *tree, const char *path) {
+
+    assert(is_path_valid(path));
+
+    reader_pp(tree);
+
+    Tree *child = find_child(tree, path);
+
+    if (child == tree)
+        return tree;
+
+    reader_fp(tree);
+    if (!child) {
+        update_no_threads(tree, NULL);
+        return NULL;
+    } else {
+        return find_node_r(child, split_path(path, NULL));
+    }
+}
+
+/**
+ * jeśli istnieje w tree dziecko o podanej
+ * ścieżce zwraca na nie wskaźnik, wpp NULL.
+ */
+static Tree *find_child(Tree *tree, const char *path) {
+
+    if (path && strlen(path) == 1 && *path == '/')
+        return tree;
+
+    char component[MAX_FOLDER_NAME_LENGTH + 1];
+    path = split_path(path, component); assert(path);
+
+    return hmap_get(tree->content, component);
+}
+
+/**
+ * aktualizuje atrybut zliczający liczbę wątków w poddrzewie
+ * zmniejszając go o 1 na ścieżce w górę od tree do bound lub
+ * do korzenia drzewa jeśli bound == NULL
+ */
+static void update_no_threads(Tree *tree, Tree *bound) {
+
+    if (tree && tree != bound) {
+        lock_node(tree);
+        
+        tree->no_threads--;
+        assert(tree->no_threads >= 0);
+        Tree *parent = tree->parent;
+        // pisarz czeka dokładnie na ten warunek; rwait i change nie mogą go
+        // tu blokować, bo nikt inny nie obudziłby już czekającego pisarza
+        if (tree->no_threads + tree->rcount + tree->wcount == 0 && tree->wwait > 0)
+            signal_writers(tree);
+        
+        unlock_node(tree);
+        
+        return update_no_threads(parent, bound);
+    }
+}
+
+/**
+ * zwiększa licznik no_threads o 1 na ścieżce w górę od tree do bound
+ * (bez niego; NULL - do korzenia); wołający trzyma już licznik lub pisarza
+ * w każdym z tych wierzchołków, więc żaden pisarz w nich nie pracuje
+ */
+static void add_no_threads(Tree *tree, Tree *bound) {
+
+    for (; tree != bound; tree = tree->parent) {
+        lock_node(tree);
+        tree->no_threads++;
+        unlock_node(tree);
+    }
+}
+
+char *tree_list(Tree *tree, const char *path) {
+
+    if (!is_path_valid(path))
+        return NULL;
+
+    Tree *dest = find_node_r(tree, path);
+
+    if (!dest)
+        return NULL;
+
+    char *res = make_map_contents_string(dest->content);
+    reader_fp(dest);
+    update_no_threads(dest, NULL);
+
+    return res;
+}
+
+int tree_list_into(Tree *tree, const char *path, char *buf, size_t size, size_t *needed) {
+
+    if (!is_path_valid(path))
+        return EINVAL;
+
+    Tree *dest = find_node_r(tree, path);
+
+    if (!dest)
+        return ENOENT;
+
+    size_t res = make_map_contents_into(dest->content, buf, size);
+    reader_fp(dest);
+    update_no_threads(dest, NULL);
+
+    if (needed)
+        *needed = res;
+    return res > size ? ERANGE : 0;
+}
+
+int tree_list_names(Tree *tree, const char *path, TreeNameBuffer *out) {
+
+    if (!is_path_valid(path))
+        return EINVAL;
+
+    Tree *dest = find_node_r(tree, path);
+
+    if (!dest)
+        return ENOENT;
+
+    size_t count;
+    const PackedName **views = make_map_contents_views(dest->content, &count);
+    size_t needed = 0;
+    for (size_t i = 0; i < count; i++)
+        needed += views[i]->len + 1;
+
+    int err = ERANGE;
+    if (count <= out->max_names && needed <= out->size) {
+        char *position = out->chars;
+        for (size_t i = 0; i < count; i++) {
+            out->names[i].name = position;
+            out->names[i].length = packed_name_decode(views[i], position);
+            position += out->names[i].length + 1;
+        }
+        err = 0;
+    }
+    reader_fp(dest);
+    update_no_threads(dest, NULL);
+
+    out->count = count;
+    out->needed = needed;
+    return err;
+}
+
+TreeListing *tree_list_entries(Tree *tree, const char *path) {
+
+    if (!is_path_valid(path))
+        return NULL;
+
+    Tree *dest = find_node_r(tree, path);
+
+    if (!dest)
+        return NULL;
+
+    size_t count;
+    const PackedName **views = make_map_contents_views(dest->content, &count);
+    size_t chars = 0;
+    for (size_t i = 0; i < count; i++)
+        chars += views[i]->len + 1;
+
+    TreeListing *res = malloc(sizeof(TreeListing) + (count + 1) * sizeof(size_t) + chars);
+    if (!res)
+        syserr("allocation failed");
+    res->count = count;
+    char *position = (char *) (res->offsets + count + 1);
+    res->chars = position;
+    for (size_t i = 0; i < count; i++) {
+        res->offsets[i] = position - res->chars;
+        position += packed_name_decode(views[i], position) + 1;
+    }
+    res->offsets[count] = position - res->chars;
+    reader_fp(dest);
+    update_no_threads(dest, NULL);
+
+    return res;
+}
+
+void tree_listing_free(TreeListing *listing) {
+
+    free(listing);
+}
+
+static bool is_name_valid(const char *name) {
+
+    size_t len = strlen(name);
+    return len > 0 && len <= MAX_FOLDER_NAME_LENGTH && strspn(name, "abcdefghijklmnopqrstuvwxyz") == len;
+}
+
+/**
+ * indeks pierwszej nazwy w index większej od cursor
+ */
+static size_t index_after(const HashMapIndex *index, const char *cursor) {
+
+    PackedNameBuffer packed;
+    packed_name_encode(&packed.name, cursor, strlen(cursor));
+    size_t low = 0, high = index->count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (packed_name_compare(index->keys[mid], &packed.name) <= 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+int tree_list_page(Tree *tree, const char *path, const char *cursor, size_t max_entries, TreeNameBuffer *out) {
+
+    if (!is_path_valid(path) || (cursor && *cursor && !is_name_valid(cursor)))
+        return EINVAL;
+
+    Tree *dest = find_node_r(tree, path);
+
+    if (!dest)
+        return ENOENT;
+
+    // indeks buduje tylko pierwsza strona folderu; potem utrzymują go
+    // posortowanym wstawienia i usunięcia, a strony tylko wyszukują kursor
+    MemStats before;
+    map_memory(dest->content, &before);
+    bool built;
+    const HashMapIndex *index = make_map_index(dest->content, &built);
+    if (built)
+        charge_map(dest, &before);
+
+    size_t i = cursor && *cursor ? index_after(index, cursor) : 0;
+    size_t count = 0, used = 0;
+    for (; i < index->count && count < max_entries && count < out->max_names; i++) {
+        size_t length = index->keys[i]->len;
+        if (used + length + 1 > out->size) {
+            if (count == 0)
+                used = length + 1;
+            break;
+        }
+        out->names[count].name = out->chars + used;
+        out->names[count].length = packed_name_decode(index->keys[i], out->chars + used);
+        used += length + 1;
+        count++;
+    }
+    // pusta strona oznacza koniec listy, więc nie może wynikać z braku miejsca
+    int err = count == 0 && i < index->count && max_entries > 0 ? ERANGE : 0;
+    reader_fp(dest);
+    update_no_threads(dest, NULL);
+
+    out->count = count;
+    out->needed = used;
+    return err;
+}
+
+int tree_count(Tree *tree, const char *path, size_t *count) {
+
+    if (!is_path_valid(path))
+        return EINVAL;
+
+    Tree *dest = find_node_r(tree, path);
+
+    if (!dest)
+        return ENOENT;
+
+    if (count)
+        *count = node_descendants(dest);
+    reader_fp(dest);
+    update_no_threads(dest, NULL);
+    return 0;
+}
+
+int tree_stat(Tree *tree, const char *path, TreeStat *stat) {
+
+    if (!is_path_valid(path))
+        return EINVAL;
+
+    Tree *dest = find_node_r(tree, path);
+
+    if (!dest)
+        return ENOENT;
+
+    if (stat) {
+        stat->children = hmap_size(dest->content);
+        stat->version = dest->version;
+    }
+    reader_fp(dest);
+    update_no_threads(dest, NULL);
+    return 0;
+}
+
+/**
+ * Folder czekający na skopiowanie przez tree_copy; remaining liczy
+ * niezakończone dzieci i sam folder. node to wierzchołek z licznikiem
+ * no_threads, który trzymamy aż do końca całej kopii (wskaźnik jest więc
+ * ważny, a pisarze są wykluczeni z wierzchołka i jego mapę czytamy bez
+ * zamka), a clone to już utworzona kopia wierzchołka.
+ */
+typedef struct WalkItem WalkItem;
+struct WalkItem {
+    Tree *node;
+    WalkItem *parent;
+    WalkItem *next; // na liście zakończonych
+    atomic_size_t remaining;
+    Tree *clone;
+};
+
+/**
+ * Zadanie zwykłego przejścia (tree_walk, tree_find): poddrzewa dzieci
+ * folderu path, który sam jest już odwiedzony (albo jest początkowym
+ * folderem, którego nie odwiedzamy). names to nazwy dzieci, które zostały
+ * do przejścia, gdy wątek oddał resztę swojej pracy (NULL - wszystkie
+ * dzieci). Folder szukamy od korzenia raz na zadanie, a jego poddrzewo
+ * przechodzimy w głąb pod licznikami no_threads; node to początkowy
+ * folder, już wzięty jako czytelnik. Przy przejściu migawki node to
+ * zawsze folder zadania: migawka trzyma swoje wierzchołki i mapy przy
+ * życiu, więc niczego nie szukamy ani nie bierzemy.
+ */
+typedef struct WalkTask {
+    Tree *node;
+    const PackedName **names; // nazwy i ich kopie w jednym bloku
+    size_t count;
+    struct WalkTask *next;    // na liście zadań do oddania
+    bool visit;               // migawka: sam folder path też do odwiedzenia
+    char path[];
+} WalkTask;
+
+/**
+ * stan przejścia; wątki puli, które dołączą już po jego końcu, tylko
+ * zwalniają swoje odwołanie, więc wołający nie czeka na zadania
+ * stojące jeszcze w kolejce puli
+ */
+typedef struct WalkState {
+    WorkDeque *deques;     // po jednej na wątek
+    size_t threads;
+    atomic_size_t next_deque;
+    atomic_size_t refs;    // wołający i zlecone zadania
+    atomic_size_t pending; // zwykłe przejście: zadania w kolejkach i w toku
+    atomic_size_t idle;    // wątki szukające pracy lub śpiące na idle_cond
+    NodeMutex idle_lock;
+    NodeCond idle_cond;
+    atomic_bool done;      // zakończyło się poddrzewo początkowego folderu
+    Tree *tree;            // korzeń, od którego szukamy folderów
+    TreeWalkFunction visit; // NULL przy kopiowaniu
+    void *ctx;
+    const NameMatcher *match; // NULL - odwiedzamy wszystkie foldery
+    bool hold;             // kopiowanie: liczniki zwalniamy po całym przejściu
+    _Atomic(WalkItem *) held; // zakończone foldery z licznikami
+    uint64_t epoch;        // przejście migawki o tej epoce (0 - drzewa)
+} WalkState;
+
+/**
+ * Stos przejścia w głąb jednego wątku: foldery od folderu zadania do
+ * bieżącego, każdy z licznikiem no_threads, oraz ścieżki folderów już
+ * przepisanych, ale jeszcze nieodwiedzonych. Bufory zostają między
+ * zadaniami wątku.
+ */
+typedef struct WalkFrame {
+    Tree *node;
+    HashMap *content;    // mapa node: bieżąca (pod licznikiem) albo z migawki
+    size_t len;          // długość ścieżki node w path
+    HashMapIterator it;  // następne dziecko (poza folderem zadania z names)
+} WalkFrame;
+
+typedef struct Walker {
+    WalkState *state;
+    WorkDeque *deque;
+    WalkFrame *frames;
+    size_t depth, frames_capacity;
+    char *path;
+    size_t path_capacity;
+    char *visits;        // ścieżki zakończone '\0', w kolejności przejścia
+    size_t visits_len, visits_capacity;
+    size_t folders;      // przepisane od ostatniego oddania pracy
+    const PackedName **names; // nazwy dzieci folderu zadania (NULL - mapa)
+    size_t next, count;
+} Walker;
+
+/**
+ * co tyle folderów oddajemy pracę i wołamy visit, gdy nikt na nią nie czeka
+ * (i co WALK_SHARE, gdy jakiś wątek jej szuka), więc ani pisarze, ani
+ * wątki bez pracy nie czekają na całe poddrzewo
+ */
+#define WALK_BATCH 256
+#define WALK_SHARE 8
+
+static void *walk_grow(void *buffer, size_t *capacity, size_t needed, size_t size) {
+
+    if (needed <= *capacity)
+        return buffer;
+    size_t new_capacity = *capacity ? *capacity : 16;
+    while (new_capacity < needed)
+        new_capacity *= 2;
+    buffer = realloc(buffer, new_capacity * size);
+    if (!buffer)
+        syserr("allocation failed");
+    *capacity = new_capacity;
+    return buffer;
+}
+
+static WalkItem *walk_item_new(Tree *node, WalkItem *parent) {
+
+    WalkItem *item = malloc(sizeof(WalkItem));
+    if (!item)
+        syserr("allocation failed");
+    item->node = node;
+    item->parent = parent;
+    item->next = NULL;
+    atomic_init(&item->remaining, 1);
+    item->clone = NULL;
+    return item;
+}
+
+/**
+ * zadanie ze ścieżką path[0..len) i miejscem na extra dalszych znaków,
+ * które dopisuje wołający
+ */
+static WalkTask *walk_task_new(Tree *node, const char *path, size_t len, size_t extra) {
+
+    WalkTask *task = malloc(sizeof(WalkTask) + len + extra + 1);
+    if (!task)
+        syserr("allocation failed");
+    task->node = node;
+    task->names = NULL;
+    task->count = 0;
+    task->next = NULL;
+    task->visit = false;
+    memcpy(task->path, path, len);
+    task->path[len + extra] = '\0';
+    return task;
+}
+
+/**
+ * Dokłada zadanie do własnej kolejki i budzi śpiący wątek, jeśli jakiś
+ * szuka pracy. Wątek zwiększa idle przed ostatnim przejrzeniem kolejek,
+ * a my czytamy idle po dołożeniu, więc któryś z nas widzi drugiego.
+ */
+static void walk_push(WalkState *state, WorkDeque *deque, void *item) {
+
+    work_deque_push(deque, item);
+    if (atomic_load(&state->idle) > 0) {
+        node_mutex_lock(&state->idle_lock);
+        node_cond_signal(&state->idle_cond);
+        node_mutex_unlock(&state->idle_lock);
+    }
+}
+
+static void walk_done(WalkState *state) {
+
+    node_mutex_lock(&state->idle_lock);
+    atomic_store(&state->done, true);
+    node_cond_broadcast(&state->idle_cond);
+    node_mutex_unlock(&state->idle_lock);
+}
+
+/**
+ * Wejście kopiowania do wierzchołka: czekamy tylko na pracującego pisarza,
+ * nie na czekających. Kopiowanie trzyma liczniki wielu wierzchołków naraz,
+ * więc czekając za pisarzem, który sam czeka na jeden z tych liczników
+ * (albo na licznik drugiego kopiowania, które czeka za naszym), mogłoby
+ * się zakleszczyć; pracujący pisarz na nikogo w swoim poddrzewie nie czeka.
+ */
+static void copy_enter(Tree *node) {
+
+    lock_node(node);
+    if (node->wcount > 0) {
+        node->rwait++;
+        do {
+            wait_readers(node);
+        } while (node->wcount > 0);
+        node->rwait--;
+        if (node->rwait > 0)
+            signal_readers(node);
+    }
+    node->no_threads++;
+    unlock_node(node);
+}
+
+/**
+ * zwalnia liczniki wszystkich folderów kopiowania; woła go ten, kto
+ * zakończył początkowy folder, więc pozostałe są już na liście. Folder
+ * kończy się po swoich dzieciach, więc po odwróceniu listy dzieci tracą
+ * liczniki przed rodzicami i pisarz wpuszczony do folderu nie zastanie
+ * licznika w jego poddrzewie.
+ */
+static void walk_release_held(WalkState *state) {
+
+    WalkItem *item = atomic_load(&state->held), *reversed = NULL;
+    while (item) {
+        WalkItem *next = item->next;
+        item->next = reversed;
+        reversed = item;
+        item = next;
+    }
+    item = reversed;
+    while (item) {
+        WalkItem *next = item->next;
+        update_no_threads(item->node, item->parent ? item->node->parent : NULL);
+        free(item);
+        item = next;
+    }
+}
+
+/**
+ * kończy item i tych przodków, dla których był ostatnim
+ * niezakończonym potomkiem
+ */
+static void walk_finish(WalkState *state, WalkItem *item) {
+
+    while (item && atomic_fetch_sub(&item->remaining, 1) == 1) {
+        WalkItem *parent = item->parent;
+        // poddrzewo kopii jest gotowe, więc doliczamy je rodzicowi kopii
+        if (parent) {
+            MemStats sums;
+            node_sums(item->clone, &sums);
+            add_sums(parent->clone, parent->clone->parent, &sums);
+        }
+        item->next = atomic_load(&state->held);
+        while (!atomic_compare_exchange_weak(&state->held, &item->next, item))
+            ;
+        if (!parent) {
+            walk_release_held(state);
+            walk_done(state);
+        }
+        item = parent;
+    }
+}
+
+/**
+ * kopiuje dzieci wierzchołka item (poza początkowym folderem, który jest
+ * już wzięty jako czytelnik) i dokłada je do deque; kopie dzieci tworzy
+ * od razu, więc do mapy kopii wstawia zawsze jeden wątek
+ */
+static void copy_process(WalkState *state, WorkDeque *deque, WalkItem *item) {
+
+    Tree *node = item->node;
+    if (item->parent)
+        copy_enter(node);
+
+    HashMapIterator it = hmap_iterator(node->content);
+    const PackedName *key;
+    void *value;
+    while (hmap_next(node->content, &it, &key, &value)) {
+        WalkItem *child = walk_item_new(value, item);
+        child->clone = clone_node_new(item->clone, atomic_load_explicit(&item->clone->born, memory_order_relaxed));
+        bool inserted = hmap_insert_packed(item->clone->content, key, child->clone);
+        assert(inserted);
+        (void) inserted;
+        atomic_fetch_add(&item->remaining, 1);
+        walk_push(state, deque, child);
+    }
+    if (!item->parent)
+        reader_fp(node); // licznik z find_node_r zostaje
+    // mapa kopii jest już pełna, więc kopię liczymy raz, w całości
+    own_memory(item->clone);
+
+    walk_finish(state, item);
+}
+
+static void walk_enter(Walker *walker, Tree *node, HashMap *content, size_t len) {
+
+    walker->frames = walk_grow(walker->frames, &walker->frames_capacity, walker->depth + 1, sizeof(WalkFrame));
+    WalkFrame *frame = &walker->frames[walker->depth++];
+    frame->node = node;
+    frame->content = content;
+    frame->len = len;
+    frame->it = hmap_iterator(content);
+}
+
+/**
+ * następne dziecko folderu na szczycie stosu; dzieci folderu zadania
+ * z listą nazw szukamy po nazwie, pomijając te, które już zniknęły
+ */
+static bool walk_next(Walker *walker, WalkFrame *frame, const PackedName **key, Tree **child) {
+
+    if (walker->depth > 1 || !walker->names)
+        return hmap_next(frame->content, &frame->it, key, (void **) child);
+    while (walker->next < walker->count) {
+        *key = walker->names[walker->next++];
+        if ((*child = hmap_get_packed(frame->content, *key)))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * zadanie z nazwami dzieci, które zostały do przejścia w folderze frame
+ * (NULL, gdy nie zostało żadne); mapa folderu jest stała, bo trzymamy
+ * jego licznik, więc przechodzimy ją kopią iteratora dwa razy
+ */
+static WalkTask *walk_rest(Walker *walker, WalkFrame *frame) {
+
+    bool listed = frame == walker->frames && walker->names;
+    size_t count = 0, bytes = 0;
+    HashMapIterator it = frame->it;
+    const PackedName *key;
+    void *value;
+    if (listed) {
+        for (size_t i = walker->next; i < walker->count; i++, count++)
+            bytes += packed_name_size(walker->names[i]->len);
+    } else {
+        while (hmap_next(frame->content, &it, &key, &value)) {
+            bytes += packed_name_size(key->len);
+            count++;
+        }
+    }
+    if (count == 0)
+        return NULL;
+
+    WalkTask *task = walk_task_new(NULL, walker->path, frame->len, 0);
+    task->names = malloc(count * sizeof(PackedName *) + bytes);
+    if (!task->names)
+        syserr("allocation failed");
+    char *copy = (char *) (task->names + count);
+    it = frame->it;
+    for (size_t i = 0; i < count; i++) {
+        if (listed)
+            key = walker->names[walker->next + i];
+        else
+            hmap_next(frame->content, &it, &key, &value);
+        memcpy(copy, key, packed_name_size(key->len));
+        task->names[i] = (const PackedName *) copy;
+        copy += packed_name_size(key->len);
+    }
+    task->count = count;
+    return task;
+}
+
+/**
+ * najpłytszy folder na stosie z pracą dla innego wątku: z dzieckiem do
+ * przejścia pod szczytem albo z co najmniej dwojgiem na szczycie (jedno
+ * zostawiamy sobie); walker->depth, gdy takiego nie ma. Na samej ścieżce
+ * bez rozgałęzień oddawanie pracy kosztowałoby tylko szukanie od korzenia.
+ */
+static size_t walk_spare(Walker *walker) {
+
+    for (size_t i = 0; i < walker->depth; i++) {
+        WalkFrame *frame = &walker->frames[i];
+        size_t need = i + 1 == walker->depth ? 2 : 1, found = 0;
+        if (i == 0 && walker->names) {
+            found = walker->count - walker->next;
+        } else {
+            HashMapIterator it = frame->it;
+            const PackedName *key;
+            void *value;
+            while (found < need && hmap_next(frame->content, &it, &key, &value))
+                found++;
+        }
+        if (found >= need)
+            return i;
+    }
+    return walker->depth;
+}
+
+/**
+ * woła visit dla przepisanych folderów; wołający nie trzyma już żadnych
+ * liczników, więc visit może zmieniać drzewo
+ */
+static void walk_visit(Walker *walker) {
+
+    WalkState *state = walker->state;
+    for (size_t i = 0; i < walker->visits_len; i += strlen(walker->visits + i) + 1)
+        state->visit(walker->visits + i, state->ctx);
+    walker->visits_len = 0;
+    walker->folders = 0;
+}
+
+/**
+ * Oddaje resztę pracy: dzieci zostałe w folderach na stosie stają się
+ * zadaniami po ścieżce, zwalniamy wszystkie liczniki, wołamy visit dla
+ * przepisanych folderów i dopiero wtedy dokładamy zadania, więc folder
+ * jest zawsze odwiedzony przed swoimi podfolderami. Zadania z głębszych
+ * folderów trafiają na dół kolejki, więc sami bierzemy je pierwsi, a inne
+ * wątki podkradają płytsze, z większymi poddrzewami.
+ */
+static void walk_hand_off(Walker *walker) {
+
+    WalkState *state = walker->state;
+    WalkTask *tasks = NULL;
+    for (size_t i = walker->depth; i-- > 0;) {
+        WalkTask *task = walk_rest(walker, &walker->frames[i]);
+        if (task) {
+            task->next = tasks;
+            tasks = task;
+        }
+    }
+    update_no_threads(walker->frames[walker->depth - 1].node, NULL);
+    walker->depth = 0;
+
+    walk_visit(walker);
+    while (tasks) {
+        WalkTask *next = tasks->next;
+        atomic_fetch_add(&state->pending, 1);
+        walk_push(state, walker->deque, tasks);
+        tasks = next;
+    }
+}
+
+/**
+ * Przechodzi w głąb poddrzewo folderu zadania (początkowy folder jest już
+ * wzięty jako czytelnik, pozostałe szukamy od korzenia jak tree_list,
+ * ustępując czekającym pisarzom). Każdy folder na ścieżce od korzenia do
+ * bieżącego trzyma nasz licznik no_threads, więc pisarze są z niego
+ * wykluczeni i jego mapę czytamy bez zamka; do dziecka wchodzimy jak
+ * find_node_r. Folderu, który zniknął, zanim do niego doszliśmy, nie
+ * przechodzimy, podobnie jak dzieci, które zniknęły z listy zadania.
+ */
+static void walk_process(Walker *walker, WalkTask *task) {
+
+    WalkState *state = walker->state;
+    Tree *node = task->node ? task->node : find_node_r(state->tree, task->path);
+
+    if (node) {
+        reader_fp(node); // licznik no_threads zostaje
+        size_t len = strlen(task->path);
+        walker->path = walk_grow(walker->path, &walker->path_capacity, len + 1, 1);
+        memcpy(walker->path, task->path, len + 1);
+        walker->names = task->names;
+        walker->next = 0;
+        walker->count = task->count;
+        walk_enter(walker, node, node->content, len);
+
+        while (walker->depth > 0) {
+            WalkFrame *frame = &walker->frames[walker->depth - 1];
+            const PackedName *key;
+            Tree *child;
+            if (!walk_next(walker, frame, &key, &child)) {
+                walker->depth--;
+                update_no_threads(frame->node, walker->depth > 0 ? frame[-1].node : NULL);
+                continue;
+            }
+            reader_pp(child);
+            reader_fp(child);
+
+            len = frame->len;
+            walker->path = walk_grow(walker->path, &walker->path_capacity, len + MAX_FOLDER_NAME_LENGTH + 2, 1);
+            len += packed_name_decode(key, walker->path + len);
+            walker->path[len++] = '/';
+            walker->path[len] = '\0';
+            walk_enter(walker, child, child->content, len);
+            if (!state->match || name_matcher_match(state->match, key)) {
+                walker->visits = walk_grow(walker->visits, &walker->visits_capacity, walker->visits_len + len + 1, 1);
+                memcpy(walker->visits + walker->visits_len, walker->path, len + 1);
+                walker->visits_len += len + 1;
+            }
+            if (++walker->folders >= WALK_BATCH
+                || (walker->folders >= WALK_SHARE && atomic_load(&state->idle) > 0
+                    && walk_spare(walker) < walker->depth))
+                walk_hand_off(walker);
+        }
+        walk_visit(walker);
+    }
+    free(task->names);
+    free(task);
+    if (atomic_fetch_sub(&state->pending, 1) == 1)
+        walk_done(state);
+}
+
+/**
+ * oddaje jako osobne zadania (razem z ich odwiedzeniem) wszystkie dzieci,
+ * które zostały do przejścia w folderze frame przejścia migawki; ścieżki
+ * składamy poza path, bo głębsze foldery stosu wciąż jej używają
+ */
+static void snap_hand_off(Walker *walker, WalkFrame *frame) {
+
+    WalkState *state = walker->state;
+    const PackedName *key;
+    void *child;
+    while (hmap_next(frame->content, &frame->it, &key, &child)) {
+        char name[MAX_FOLDER_NAME_LENGTH + 1];
+        size_t name_len = packed_name_decode(key, name);
+        WalkTask *task = walk_task_new(child, walker->path, frame->len, name_len + 1);
+        memcpy(task->path + frame->len, name, name_len);
+        task->path[frame->len + name_len] = '/';
+        task->visit = true;
+        atomic_fetch_add(&state->pending, 1);
+        walk_push(state, walker->deque, task);
+    }
+}
+
+/**
+ * Przechodzi w głąb poddrzewo folderu zadania w migawce: mapy z epoki
+ * migawki (content_at) się nie zmieniają, więc nie bierzemy zamków
+ * i visit wołamy od razu po wejściu do folderu. Gdy inny wątek szuka
+ * pracy, oddajemy mu dzieci najpłytszego folderu, który je ma, i idziemy
+ * dalej; zadanie to wierzchołek, więc nikt go nie szuka od korzenia.
+ */
+static void snap_process(Walker *walker, WalkTask *task) {
+
+    WalkState *state = walker->state;
+    size_t len = strlen(task->path);
+    walker->path = walk_grow(walker->path, &walker->path_capacity, len + 1, 1);
+    memcpy(walker->path, task->path, len + 1);
+    walker->names = NULL;
+    if (task->visit)
+        state->visit(task->path, state->ctx);
+    walk_enter(walker, task->node, content_at(task->node, state->epoch), len);
+
+    while (walker->depth > 0) {
+        WalkFrame *frame = &walker->frames[walker->depth - 1];
+        const PackedName *key;
+        Tree *child;
+        if (!walk_next(walker, frame, &key, &child)) {
+            walker->depth--;
+            continue;
+        }
+        len = frame->len;
+        walker->path = walk_grow(walker->path, &walker->path_capacity, len + MAX_FOLDER_NAME_LENGTH + 2, 1);
+        len += packed_name_decode(key, walker->path + len);
+        walker->path[len++] = '/';
+        walker->path[len] = '\0';
+        state->visit(walker->path, state->ctx);
+        walk_enter(walker, child, content_at(child, state->epoch), len);
+        if (atomic_load(&state->idle) > 0) {
+            size_t spare = walk_spare(walker);
+            if (spare < walker->depth)
+                snap_hand_off(walker, &walker->frames[spare]);
+        }
+    }
+    free(task);
+    if (atomic_fetch_sub(&state->pending, 1) == 1)
+        walk_done(state);
+}
+
+static void walk_release(WalkState *state) {
+
+    if (atomic_fetch_sub(&state->refs, 1) > 1)
+        return;
+    for (size_t i = 0; i < state->threads; i++)
+        work_deque_destroy(&state->deques[i]);
+    free(state->deques);
+    free(state);
+}
+
+static void *walk_take(WalkState *state, size_t index) {
+
+    void *item = work_deque_pop(&state->deques[index]);
+    for (size_t i = 1; !item && i < state->threads; i++)
+        item = work_deque_steal(&state->deques[(index + i) % state->threads]);
+    return item;
+}
+
+/**
+ * Wątek bez pracy zasypia na idle_cond; budzi go walk_push albo koniec
+ * przejścia. Przed zaśnięciem przegląda kolejki jeszcze raz, już jako
+ * szukający pracy, więc nie przegapi zadania dołożonego w międzyczasie.
+ */
+static void walk_loop(WalkState *state, size_t index) {
+
+    Walker walker = {.state = state, .deque = &state->deques[index]};
+
+    while (true) {
+        void *item = walk_take(state, index);
+        if (!item) {
+            node_mutex_lock(&state->idle_lock);
+            atomic_fetch_add(&state->idle, 1);
+            while (!atomic_load(&state->done) && !(item = walk_take(state, index)))
+                node_cond_wait(&state->idle_cond, &state->idle_lock);
+            atomic_fetch_sub(&state->idle, 1);
+            node_mutex_unlock(&state->idle_lock);
+        }
+        if (!item)
+            break;
+        if (state->hold)
+            copy_process(state, walker.deque, item);
+        else if (state->epoch)
+            snap_process(&walker, item);
+        else
+            walk_process(&walker, item);
+    }
+    free(walker.frames);
+    free(walker.path);
+    free(walker.visits);
+    walk_release(state);
+}
+
+static void walk_worker(WorkGroup *group, void *arg) {
+
+    (void) group;
+    WalkState *state = arg;
+    walk_loop(state, atomic_fetch_add(&state->next_deque, 1));
+}
+
+/**
+ * przechodzi poddrzewo start drzewa tree w threads wątkach, wołając visit
+ * dla folderów pasujących do match (jeśli nie NULL); start musi być wzięty
+ * jako czytelnik; przy kopiowaniu clone to pusta kopia start, a przy
+ * przejściu migawki epoch to jej epoka (start z migawki, niczego nie bierzemy)
+ */
+static void run_walk(Tree *tree, Tree *start, const char *path, size_t threads, TreeWalkFunction visit,
+                     void *ctx, const NameMatcher *match, Tree *clone, uint64_t epoch) {
+
+    WalkState *state = malloc(sizeof(WalkState));
+    if (!state)
+        syserr("allocation failed");
+    state->threads = threads == 0 ? 1 : threads;
+    state->deques = malloc(state->threads * sizeof(WorkDeque));
+    if (!state->deques)
+        syserr("allocation failed");
+    for (size_t i = 0; i < state->threads; i++)
+        work_deque_init(&state->deques[i]);
+    atomic_init(&state->next_deque, 1); // deque 0 należy do wołającego
+    atomic_init(&state->refs, state->threads);
+    atomic_init(&state->pending, 1);
+    atomic_init(&state->idle, 0);
+    node_mutex_init(&state->idle_lock);
+    node_cond_init(&state->idle_cond);
+    atomic_init(&state->done, false);
+    state->tree = tree;
+    state->visit = visit;
+    state->ctx = ctx;
+    state->match = match;
+    state->hold = clone != NULL;
+    atomic_init(&state->held, NULL);
+    state->epoch = epoch;
+
+    if (clone) {
+        WalkItem *root = walk_item_new(start, NULL);
+        root->clone = clone;
+        work_deque_push(&state->deques[0], root);
+    } else {
+        work_deque_push(&state->deques[0], walk_task_new(start, path, strlen(path), 0));
+    }
+    WorkGroup *group = work_group_new();
+    for (size_t i = 1; i < state->threads; i++)
+        work_submit(group, walk_worker, state);
+    work_group_detach(group);
+    walk_loop(state, 0);
+}
+
+int tree_walk(Tree *tree, const char *path, TreeWalkFunction visit, void *ctx, size_t threads) {
+
+    if (!is_path_valid(path))
+        return EINVAL;
+
+    Tree *dest = find_node_r(tree, path);
+
+    if (!dest)
+        return ENOENT;
+
+    run_walk(tree, dest, path, threads, visit, ctx, NULL, NULL, 0);
+    return 0;
+}
+
+int tree_find(Tree *tree, const char *path, const char *pattern, TreeWalkFunction visit, void *ctx,
+              size_t threads) {
+
+    if (!is_path_valid(path))
+        return EINVAL;
+    NameMatcher match;
+    if (name_matcher_compile(&match, pattern))
+        return EINVAL;
+
+    Tree *dest = find_node_r(tree, path);
+    if (dest)
+        run_walk(tree, dest, path, threads, visit, ctx, &match, NULL, 0);
+    name_matcher_free(&match);
+    return dest ? 0 : ENOENT;
+}
+
+void tree_memory_stats(Tree *tree, MemStats *stats) {
+
+    node_sums(tree, stats);
+    MemStats pending;
+    mem_account_read(tree_shared(tree)->account, &pending);
+    mem_stats_add(stats, &pending);
+
+#ifdef TREE_LOCK_TABLE
+    stats->sync_bytes += lock_table_size() * sizeof(LockStripe);
+#endif
+}
+
+int tree_memory_stats_dirs(Tree *tree, TreeDirMemoryStats *out, size_t max, size_t *count) {
+
+    Tree *root = find_node_r(tree, "/");
+    size_t n;
+    const PackedName **names = make_map_contents_views(root->content, &n);
+    if (n <= max)
+        for (size_t i = 0; i < n; i++) {
+            packed_name_decode(names[i], out[i].name);
+            node_sums(hmap_get_packed(root->content, names[i]), &out[i].stats);
+        }
+    reader_fp(root);
+    update_no_threads(root, NULL);
+
+    *count = n;
+    return n <= max ? 0 : ERANGE;
+}
+
+/**
+ * tworzy w parent (zajętym jako pisarz) podfolder o nazwie component
+ */
+static int create_child(Tree *parent, const char *component) {
+
+    if (hmap_get(parent->content, component)) // folder już istnieje
+        return EEXIST;
+    unshare_content(parent);
+    MemStats before;
+    map_memory(parent->content, &before);
+    Tree *new = node_new(parent);
+    bool inserted = hmap_insert(parent->content, component, new);
+    assert(inserted);
+    (void) inserted;
+    content_changed(parent);
+    MemStats delta;
+    node_sums(new, &delta);
+    map_change(parent, &before, &delta);
+    add_sums(parent, NULL, &delta);
+    return 0;
+}
+
+/**
+ * usuwa z parent (zajętego jako pisarz) pusty podfolder o nazwie component
+ */
+static int remove_child(Tree *parent, const char *component) {
+
+    Tree *dest = hmap_get(parent->content, component);
+    if (!dest)
+        return ENOENT;
+    // pisarz w parent wyklucza wszystkie wątki z poddrzewa dest
+    assert(dest->no_threads == 0);
+    if (hmap_size(dest->content) > 0)
+        return ENOTEMPTY;
+
+    unshare_content(parent);
+    MemStats before, delta;
+    map_memory(parent->content, &before);
+    bool removed = hmap_remove(parent->content, component);
+    assert(removed);
+    (void) removed;
+    content_changed(parent);
+    node_sums(dest, &delta);
+    negate_stats(&delta);
+    map_change(parent, &before, &delta);
+    add_sums(parent, NULL, &delta);
+    add_watched(parent, NULL, -node_watched(dest));
+
+    drop_node(dest);
+    return 0;
+}
+
+int tree_create(Tree *tree, const char *path) {
+
+    if (strlen(path) == 1 && *path == '/')
+        return EEXIST;
+    if (!is_path_valid(path))
+        return EINVAL;
+
+    
+    char component[MAX_FOLDER_NAME_LENGTH + 1];
+    char *path_to_par = make_path_to_parent(path, component);
+    Tree *parent = find_node_w(tree, path_to_par, true, NULL);
+    free(path_to_par);
+
+    if (!parent)
+        return ENOENT;
+    assert(parent->no_threads == 1);
+    change_begin(tree);
+    int err = create_child(parent, component);
+    change_end();
+    if (!err)
+        notify(tree, parent, TREE_EVENT_CREATE, 0, path, strlen(path));
+
+    writer_fp(parent);
+    update_no_threads(parent->parent, NULL);
+    return err;
+}
+
+int tree_create_all(Tree *tree, const char *path, size_t *created) {
+
+    if (!is_path_valid(path))
+        return EINVAL;
+
+    size_t n_created = 0;
+    Tree *node = tree;
+    const char *rest = path; // ścieżka od node
+    char component[MAX_FOLDER_NAME_LENGTH + 1];
+    reader_pp(node);
+    while (true) {
+        // trzymamy czytelnika na node i liczniki na jego przodkach
+        const char *sub = split_path(rest, component);
+        if (!sub) {
+            reader_fp(node);
+            update_no_threads(node, NULL);
+            break;
+        }
+        Tree *child = hmap_get(node->content, component);
+        if (child) {
+            reader_fp(node);
+            reader_pp(child);
+            node = child;
+            rest = sub;
+            continue;
+        }
+
+        // brakuje dziecka: oddajemy własny licznik i wchodzimy jako pisarz
+        reader_fp(node);
+        update_no_threads(node, node->parent);
+        writer_pp(node);
+        if (hmap_get(node->content, component)) { // ktoś zdążył je utworzyć
+            writer_fp(node);
+            reader_pp(node);
+            continue;
+        }
+        // nowe wierzchołki są widoczne dopiero po wyjściu pisarza z node,
+        // więc całą resztę ścieżki tworzymy bez dalszych zamków
+        Tree *parent = node;
+        change_begin(tree);
+        do {
+            create_child(parent, component);
+            notify(tree, parent, TREE_EVENT_CREATE, 0, path, sub - path + 1);
+            parent = hmap_get(parent->content, component);
+            n_created++;
+        } while ((sub = split_path(sub, component)));
+        change_end();
+        writer_fp(node);
+        update_no_threads(node->parent, NULL);
+        break;
+    }
+
+    if (created)
+        *created = n_created;
+    return 0;
+}
+
+/**
+ * schodzi po drzewie jako czytelnik szukając wierzchołka dest,
+ * jeśli go znajdzie to blokuje go jako pisarz, wpp zwraca NULL
+ */
+Tree *find_node_w(Tree *tree, const char *dest, bool lock_first, Tree *bound) {
+
+    assert(is_path_valid(dest));
+    if (strlen(dest) == 1 && *dest == '/') {
+        writer_pp(tree);
+        return tree;
+    }
+    if (lock_first)
+        reader_pp(tree);
+
+    Tree *child = find_child(tree, dest);
+    if (lock_first)
+        reader_fp(tree);
+    if (!child) {
+        if (lock_first)
+            update_no_threads(tree, bound);
+        else if (tree != bound)
+            update_no_threads(tree->parent, bound);
+        return NULL;
+    }
+    return find_node_w(child, split_path(dest, NULL), true, bound);
+}
+
+int tree_remove(Tree *tree, const char *path) {
+
+    if (!is_path_valid(path))
+        return EINVAL;
+    if (path && strlen(path) == 1 && *path == '/')
+        return EBUSY;
+
+    
+    char component[MAX_FOLDER_NAME_LENGTH + 1];
+    char *path_to_par = make_path_to_parent(path, component);
+
+    Tree *dest_par = find_node_w(tree, path_to_par, true, NULL);
+    free(path_to_par);
+
+    if (!dest_par)
+        return ENOENT;
+    assert(dest_par->no_threads == 1);
+    change_begin(tree);
+    int err = remove_child(dest_par, component);
+    change_end();
+    if (!err)
+        notify(tree, dest_par, TREE_EVENT_REMOVE, 0, path, strlen(path));
+
+    writer_fp(dest_par);
+    update_no_threads(dest_par->parent, NULL);
+    return err;
+}
+
+/**
+ * odłącza od parent dziecko component z niepustym poddrzewem i zwraca
+ * zadanie jego zwolnienia w tle albo NULL, gdy poddrzewo może jeszcze
+ * widzieć żywa migawka (wtedy zwolni je collect); pamięć poddrzewa
+ * przechodzi z sum na konto drzewa i schodzi z niego dopiero przy
+ * zwalnianiu, więc zadanie trzyma konto, nawet gdy drzewo zniknie wcześniej
+ */
+static Reclaim *detach_child(Tree *parent, const char *component) {
+
+    Tree *dest = hmap_get(parent->content, component);
+    // pisarz w parent wyklucza wszystkie wątki z poddrzewa dest
+    assert(dest->no_threads == 0);
+
+    TreeShared *shared = changing.shared;
+    unshare_content(parent);
+    MemStats before, delta;
+    map_memory(parent->content, &before);
+    bool removed = hmap_remove(parent->content, component);
+    assert(removed);
+    (void) removed;
+    content_changed(parent);
+    node_sums(dest, &delta);
+    mem_account_add(shared->account, &delta);
+    negate_stats(&delta);
+    map_change(parent, &before, &delta);
+    add_sums(parent, NULL, &delta);
+    add_watched(parent, NULL, -node_watched(dest));
+
+    if (snap_may_see(shared, 0, changing.epoch)) {
+        retire(shared, dest, changing.epoch, true);
+        return NULL;
+    }
+    return reclaim_new(dest, shared);
+}
+
+int tree_remove_recursive(Tree *tree, const char *path) {
+
+    if (!is_path_valid(path))
+        return EINVAL;
+    if (strlen(path) == 1 && *path == '/')
+        return EBUSY;
+
+    char component[MAX_FOLDER_NAME_LENGTH + 1];
+    char *path_to_par = make_path_to_parent(path, component);
+
+    Tree *dest_par = find_node_w(tree, path_to_par, true, NULL);
+    free(path_to_par);
+
+    if (!dest_par)
+        return ENOENT;
+    Tree *dest = hmap_get(dest_par->content, component);
+    Reclaim *job = NULL;
+    int err = 0;
+    change_begin(tree);
+    if (!dest)
+        err = ENOENT;
+    else if (hmap_size(dest->content) == 0)
+        err = remove_child(dest_par, component);
+    else
+        job = detach_child(dest_par, component);
+    change_end();
+    if (!err)
+        notify(tree, dest_par, TREE_EVENT_REMOVE, 0, path, strlen(path));
+
+    writer_fp(dest_par);
+    update_no_threads(dest_par->parent, NULL);
+
+    if (job) {
+        pthread_once(&reclaim_once, make_reclaim_group);
+        work_submit(reclaim_group, free_subtree, job);
+    }
+    return err;
+}
+
+/**
+ * zwraca wskaźnik na dowiązanie do obserwatora node z kolejką queue
+ * (na końcu listy, gdy go nie ma)
+ */
+static Watch **find_watch(Tree *node, WatchQueue *queue) {
+
+    Watch **link = &node->watches;
+    while (*link && (*link)->queue != queue)
+        link = &(*link)->next;
+    return link;
+}
+
+int tree_watch(Tree *tree, const char *path, bool recursive, WatchQueue *queue) {
+
+    if (!is_path_valid(path) || !queue)
+        return EINVAL;
+
+    // pisarz wyklucza wszystkich, którzy mogliby właśnie czytać listę
+    Tree *node = find_node_w(tree, path, true, NULL);
+    if (!node)
+        return ENOENT;
+
+    Watch **link = find_watch(node, queue);
+    int err = 0;
+    if (*link) {
+        err = EEXIST;
+    } else {
+        Watch *watch = malloc(sizeof(Watch));
+        if (!watch)
+            syserr("allocation failed");
+        watch->queue = queue;
+        watch->recursive = recursive;
+        watch->next = NULL;
+        *link = watch;
+        add_watched(node, NULL, 1);
+    }
+
+    writer_fp(node);
+    update_no_threads(node->parent, NULL);
+    return err;
+}
+
+int tree_unwatch(Tree *tree, const char *path, WatchQueue *queue) {
+
+    if (!is_path_valid(path) || !queue)
+        return EINVAL;
+
+    Tree *node = find_node_w(tree, path, true, NULL);
+    if (!node)
+        return ENOENT;
+
+    Watch **link = find_watch(node, queue);
+    Watch *watch = *link;
+    if (watch) {
+        *link = watch->next;
+        free(watch);
+        add_watched(node, NULL, -1);
+    }
+
+    writer_fp(node);
+    update_no_threads(node->parent, NULL);
+    return watch ? 0 : ENOENT;
+}
+
+/**
+ * Przenosi wierzchołek node do nowego bloku, gorącego (hot) albo zwykłego,
+ * i zwraca nowy wierzchołek; mapę w rodzicu poprawia wołający. Nowy
+ * przejmuje mapę dzieci, sumy poddrzewa (z pasków albo jednego zestawu),
+ * obserwatorów, wersję i epokę mapy, a dzieci dostają go jako rodzica.
+ * Zmienia się tylko narzut bloku wierzchołka, więc tylko on trafia do sum
+ * przodków. Wołający trzyma pisarza w rodzicu node, a więc żaden wątek
+ * nie ma wskaźnika do node, i node nie ma historii.
+ */
+static Tree *node_replace(Tree *node, bool hot) {
+
+    Tree *parent = node->parent;
+    Tree *new = hot ? hot_node_new(0) : cold_node_new(parent);
+    node_reset(new, parent);
+    MemStats sums, delta, own;
+    node_sums(node, &sums);
+    node_memory(node, &own);
+    negate_stats(&own);
+
+    HashMap *empty = new->content;
+    new->content = node->content;
+    node->content = empty;
+    new->version = node->version;
+    new->watches = node->watches;
+    node->watches = NULL;
+    atomic_store_explicit(&new->watched, node_watched(node), memory_order_relaxed);
+    atomic_store_explicit(&new->born, atomic_load_explicit(&node->born, memory_order_relaxed),
+                          memory_order_relaxed);
+    SubtreeSums *counter = hot ? &hot_stripes(new)[0].sums : &new->sums;
+    atomic_store_explicit(&counter->descendants, sums.nodes - 1, memory_order_relaxed);
+    atomic_store_explicit(&counter->container_bytes, sums.container_bytes, memory_order_relaxed);
+    atomic_store_explicit(&counter->key_bytes, sums.key_bytes, memory_order_relaxed);
+    atomic_store_explicit(&counter->overhead_bytes, sums.overhead_bytes, memory_order_relaxed);
+
+    HashMapIterator it = hmap_iterator(new->content);
+    const PackedName *key;
+    void *child;
+    while (hmap_next(new->content, &it, &key, &child))
+        ((Tree *) child)->parent = new;
+    node_put(node);
+
+    node_memory(new, &delta);
+    mem_stats_add(&delta, &own);
+    add_sums(new, NULL, &delta);
+    return new;
+}
+
+/**
+ * umieszcza na nowo node i jego poddrzewo według nowej głębokości;
+ * gorące są tylko wierzchołki płytsze niż TREE_HOT_DEPTH, więc pod
+ * zwykłym dzieckiem, które ma takim zostać, wszystko jest już zwykłe
+ */
+static Tree *place_subtree(Tree *node) {
+
+    bool hot = is_hot_position(node->parent);
+    if (node->hot != hot) {
+        if (atomic_load_explicit(&node->history, memory_order_relaxed))
+            return node; // dawne mapy wskazują node, więc zostaje z poddrzewem
+        node = node_replace(node, hot);
+    }
+    bool hot_children = is_hot_position(node);
+    HashMapIterator it = hmap_iterator(node->content);
+    const PackedName *key;
+    void *value;
+    while (hmap_next(node->content, &it, &key, &value)) {
+        Tree *child = value;
+        if (hot_children || child->hot) {
+            Tree *placed = place_subtree(child);
+            if (placed != child)
+                hmap_replace_packed(node->content, key, placed);
+        }
+    }
+    return node;
+}
+
+/**
+ * Po przeniesieniu lub skopiowaniu węzła node pod nazwę component w parent
+ * (zajętym jako pisarz w bieżącej zmianie) poprawia umieszczenie
+ * wierzchołków, których głębokość przeszła przez TREE_HOT_DEPTH, i zwraca
+ * wierzchołek dołączony pod component. Migawka może trzymać wskaźniki do
+ * poddrzewa w dawnych mapach, więc dopóki żyje jakaś, która może nie
+ * widzieć bieżącej zmiany, wierzchołki zostają, gdzie są (to tylko
+ * umieszczenie, nie poprawność). Późniejsze migawki czekają na koniec
+ * zmiany, więc widzą już nowe wierzchołki.
+ */
+static Tree *place_linked(Tree *parent, const char *component, Tree *node) {
+
+    if (snap_may_see(changing.shared, 0, changing.epoch))
+        return node;
+    Tree *placed = place_subtree(node);
+    if (placed != node)
+        hmap_replace(parent->content, component, placed);
+    return placed;
+}
+
+int tree_copy(Tree *tree, const char *source, const char *target) {
+
+    if (!is_path_valid(source) || !is_path_valid(target))
+        return EINVAL;
+    if (strlen(target) == 1 && *target == '/')
+        return EEXIST;
+
+    char component[MAX_FOLDER_NAME_LENGTH + 1];
+    char *path_to_par = make_path_to_parent(target, component);
+
+    // cel sprawdzamy przed kopiowaniem i jeszcze raz przy wstawianiu, bo
+    // w tym czasie ktoś mógł go utworzyć albo usunąć jego rodzica
+    Tree *par = find_node_r(tree, path_to_par);
+    if (!par) {
+        free(path_to_par);
+        return ENOENT;
+    }
+    int err = hmap_get(par->content, component) ? EEXIST : 0;
+    reader_fp(par);
+    update_no_threads(par, NULL);
+    if (err) {
+        free(path_to_par);
+        return err;
+    }
+
+    // czytelnik w źródle i liczniki na wierzchołkach jego poddrzewa,
+    // trzymane do końca kopiowania, wykluczają z poddrzewa pisarzy, ale nie
+    // czytelników; run_walk zwalnia je wszystkie
+    uint64_t epoch = atomic_load(&tree_shared(tree)->epoch);
+    Tree *src = find_node_r(tree, source);
+    Tree *clone = NULL;
+    if (src) {
+        clone = clone_node_new(NULL, epoch);
+        run_walk(tree, src, source, work_pool_size() + 1, NULL, NULL, NULL, clone, 0);
+    }
+
+    par = clone ? find_node_w(tree, path_to_par, true, NULL) : NULL;
+    free(path_to_par);
+    err = !par ? ENOENT : hmap_get(par->content, component) ? EEXIST : 0;
+    if (!err) {
+        change_begin(tree);
+        unshare_content(par);
+        MemStats before, delta;
+        map_memory(par->content, &before);
+        bool inserted = hmap_insert(par->content, component, clone);
+        assert(inserted);
+        (void) inserted;
+        content_changed(par);
+        clone->parent = par;
+        node_sums(clone, &delta);
+        map_change(par, &before, &delta);
+        add_sums(par, NULL, &delta);
+        place_linked(par, component, clone);
+        change_end();
+        notify(tree, par, TREE_EVENT_CREATE, 0, target, strlen(target));
+    }
+    if (par) {
+        writer_fp(par);
+        update_no_threads(par->parent, NULL);
+    }
+
+    if (err && clone) {
+        WorkGroup *group = work_group_new();
+        free_subtree(group, reclaim_new(clone, NULL));
+        work_group_wait(group);
+    }
+    return err;
+}
+
+/**
+ * sprawdza czy poten_child jest podfolderem source
+ */
+static bool is_parent_to(const char *source, const char *poten_child) {
+
+    if (!source || !poten_child)
+        return false;
+    assert(is_path_valid(source) && is_path_valid(poten_child));
+    char *target = make_path_to_parent(poten_child, NULL);
+    while (target) {
+        if (!strcmp(target, source)) {
+            free(target);
+            return true;
+        }
+        char *temp = target;
+        target = make_path_to_parent(target, NULL);
+        free(temp);
+    }
+    return false;
+}
+
+/**
+ * zwraca ścieżkę do najniższego wspólnego przodka path1 i path2
+ */
+char *make_path_to_lca(const char *path1, const char *path2) {
+
+    assert(is_path_valid(path1) && is_path_valid(path2));
+    if (!strcmp(path1, path2))
+        return strdup(path1);
+
+    char *parent1 = strdup(path1), *parent2 = strdup(path2), *temp;
+    while (parent1 && parent2) {
+        int par1_len = (int) strlen(parent1);
+        int par2_len = (int) strlen(parent2);
+        if (par1_len > par2_len) {
+            temp = parent1;
+            parent1 = make_path_to_parent(parent1, NULL);
+            free(temp);
+        } else if (par1_len < par2_len) {
+            temp = parent2;
+            parent2 = make_path_to_parent(parent2, NULL);
+            free(temp);
+        } else if (!strcmp(parent1, parent2)) {
+            free(parent1);
+            return parent2;
+        } else {
+            temp = parent1;
+            parent1 = make_path_to_parent(parent1, NULL);
+            free(temp);
+            temp = parent2;
+            parent2 = make_path_to_parent(parent2, NULL);
+            free(temp);
+        }
+    }
+    assert(false);
+}
+
+/**
+ * obcina ścieżkę dest o przedrostek parent
+ */
+static const char *cut_path(const char *path1, const char *path2) {
+    
+    assert(strlen(path1) <= strlen(path2));
+    return path2 + strlen(path1) - 1;
+}
+
+/**
+ * zajmuje jako pisarz najniższego wspólnego przodka path1 i path2 i wpisuje
+ * jego ścieżkę do *path_to_lca (wołający ją zwalnia); pisarz wyklucza
+ * wszystkie wątki z poddrzewa lca, więc pod nim można schodzić i zmieniać
+ * wierzchołki bez dalszego zamykania. Zwraca NULL, jeśli lca nie istnieje.
+ */
+static Tree *lock_lca(Tree *tree, const char *path1, const char *path2, char **path_to_lca) {
+
+    *path_to_lca = make_path_to_lca(path1, path2);
+    assert(*path_to_lca);
+    Tree *lca = find_node_w(tree, *path_to_lca, true, NULL);
+    if (!lca) {
+        free(*path_to_lca);
+        *path_to_lca = NULL;
+    }
+    return lca;
+}
+
+static void unlock_lca(Tree *lca, char *path_to_lca) {
+
+    writer_fp(lca);
+    update_no_threads(lca->parent, NULL);
+    free(path_to_lca);
+}
+
+/**
+ * Gdy par_a i par_b (różne od siebie) leżą w różnych poddrzewach lca,
+ * zajmuje je jako pisarzy i oddaje pisarza w lca, zanim zmienimy ich
+ * zawartość, żeby inne operacje mogły już przechodzić przez lca (przy
+ * przenoszeniu między katalogami najwyższego poziomu jest nim korzeń).
+ * Każdy z nich jest potem trzymany tak, jakby zszedł do niego osobny
+ * wątek, z licznikami na ścieżce do korzenia. Gdy jeden z nich to lca,
+ * lca zostaje zajęty. Zwalnia unlock_parents.
+ */
+static void lock_parents(Tree *lca, Tree *par_a, Tree *par_b) {
+
+    if (par_a == lca || par_b == lca)
+        return;
+    assert(par_a != par_b);
+    // pisarz w lca wyklucza wszystkich z jego poddrzewa, więc nie czekamy
+    add_no_threads(par_a->parent, lca);
+    writer_pp(par_a);
+    add_no_threads(par_b->parent, lca);
+    writer_pp(par_b);
+    writer_downgrade(lca); // licznik dla ścieżki do par_a
+    add_no_threads(lca, NULL); // i dla ścieżki do par_b
+}
+
+static void unlock_parents(Tree *lca, char *path_to_lca, Tree *par_a, Tree *par_b) {
+
+    if (par_a == lca || par_b == lca) {
+        unlock_lca(lca, path_to_lca);
+        return;
+    }
+    writer_fp(par_a);
+    update_no_threads(par_a->parent, NULL);
+    writer_fp(par_b);
+    update_no_threads(par_b->parent, NULL);
+    free(path_to_lca);
+}
+
+/**
+ * zwraca wierzchołek o ścieżce path z poddrzewa lca (path_to_lca jest jej
+ * przedrostkiem) albo NULL; wołający trzyma pisarza w lca
+ */
+static Tree *find_below(Tree *lca, const char *path_to_lca, const char *path) {
+
+    char component[MAX_FOLDER_NAME_LENGTH + 1];
+    const char *subpath = cut_path(path_to_lca, path);
+    Tree *node = lca;
+    while (node && (subpath = split_path(subpath, component)))
+        node = hmap_get(node->content, component);
+    return node;
+}
+
+/**
+ * zwraca rodzica folderu path z poddrzewa lca, a nazwę folderu wpisuje
+ * do component; NULL, jeśli rodzica nie ma
+ */
+static Tree *find_parent_below(Tree *lca, const char *path_to_lca, const char *path, char *component) {
+
+    char *path_to_par = make_path_to_parent(path, component);
+    Tree *par = find_below(lca, path_to_lca, path_to_par);
+    free(path_to_par);
+    return par;
+}
+
+int tree_move(Tree *tree, const char *source, const char *target) {
+
+    if (!is_path_valid(source) || !is_path_valid(target))
+        return EINVAL;
+    if (strlen(source) == 1 && *source == '/')
+        return EBUSY;
+    if (strlen(target) == 1 && *target == '/')
+        return EEXIST;
+    if (is_parent_to(source, target))
+        return -9; // target jest potomkiem source
+
+    char *path_to_lca;
+    Tree *lca = lock_lca(tree, source, target, &path_to_lca);
+    if (!lca)
+        return ENOENT;
+
+    char src_component[MAX_FOLDER_NAME_LENGTH + 1], trg_component[MAX_FOLDER_NAME_LENGTH + 1];
+    Tree *src = find_below(lca, path_to_lca, source);
+    Tree *src_par = src ? src->parent : NULL;
+    Tree *trg_par = NULL;
+    int err = 0;
+    if (!src)
+        err = ENOENT;
+    else if (!strcmp(source, target))
+        err = 0;
+    else if (!strcmp(target, path_to_lca)) // target jest przodkiem source
+        err = EEXIST;
+    else if (!(trg_par = find_parent_below(lca, path_to_lca, target, trg_component)))
+        err = ENOENT;
+    else if (hmap_get(trg_par->content, trg_component))
+        err = EEXIST;
+
+    if (err || !trg_par) {
+        unlock_lca(lca, path_to_lca);
+        return err;
+    }
+
+    lock_parents(lca, src_par, trg_par);
+    free(make_path_to_parent(source, src_component));
+    change_begin(tree);
+    unshare_content(src_par);
+    unshare_content(trg_par);
+    MemStats src_before, trg_before;
+    map_memory(src_par->content, &src_before);
+    map_memory(trg_par->content, &trg_before);
+    bool moved = hmap_remove(src_par->content, src_component);
+    moved &= hmap_insert(trg_par->content, trg_component, src);
+    assert(moved);
+    (void) moved;
+    src->parent = trg_par;
+    content_changed(src_par);
+    content_changed(trg_par);
+    MemStats subtree;
+    node_sums(src, &subtree);
+    add_sums(trg_par, lca, &subtree);
+    negate_stats(&subtree);
+    add_sums(src_par, lca, &subtree);
+    add_watched(src_par, lca, -node_watched(src));
+    add_watched(trg_par, lca, node_watched(src));
+    place_linked(trg_par, trg_component, src);
+    change_end();
+    uint64_t cookie = atomic_fetch_add_explicit(&next_move_cookie, 1, memory_order_relaxed) + 1;
+    notify(tree, src_par, TREE_EVENT_MOVE_FROM, cookie, source, strlen(source));
+    notify(tree, trg_par, TREE_EVENT_MOVE_TO, cookie, target, strlen(target));
+    charge_map(src_par, &src_before);
+    if (trg_par != src_par)
+        charge_map(trg_par, &trg_before);
+    unlock_parents(lca, path_to_lca, src_par, trg_par);
+    return 0;
+}
+
+int tree_exchange(Tree *tree, const char *path_a, const char *path_b) {
+
+    if (!is_path_valid(path_a) || !is_path_valid(path_b))
+        return EINVAL;
+    if ((strlen(path_a) == 1 && *path_a == '/') || (strlen(path_b) == 1 && *path_b == '/'))
+        return EBUSY;
+    if (is_parent_to(path_a, path_b) || is_parent_to(path_b, path_a))
+        return -9; // jeden folder jest potomkiem drugiego
+
+    char *path_to_lca;
+    Tree *lca = lock_lca(tree, path_a, path_b, &path_to_lca);
+    if (!lca)
+        return ENOENT;
+
+    if (!strcmp(path_a, path_b)) { // lca to sam folder, więc istnieje
+        unlock_lca(lca, path_to_lca);
+        return 0;
+    }
+
+    char comp_a[MAX_FOLDER_NAME_LENGTH + 1], comp_b[MAX_FOLDER_NAME_LENGTH + 1];
+    Tree *par_a = find_parent_below(lca, path_to_lca, path_a, comp_a);
+    Tree *par_b = find_parent_below(lca, path_to_lca, path_b, comp_b);
+    Tree *a = par_a ? hmap_get(par_a->content, comp_a) : NULL;
+    Tree *b = par_b ? hmap_get(par_b->content, comp_b) : NULL;
+    if (!a || !b) {
+        unlock_lca(lca, path_to_lca);
+        return ENOENT;
+    }
+
+    lock_parents(lca, par_a, par_b);
+    change_begin(tree);
+    unshare_content(par_a);
+    unshare_content(par_b);
+    // mapy zmieniają tylko wartości pod istniejącymi nazwami, ale
+    // HashMap nie ma podmiany, więc usuwamy i wstawiamy obie nazwy
+    MemStats a_before, b_before;
+    map_memory(par_a->content, &a_before);
+    map_memory(par_b->content, &b_before);
+    bool swapped = hmap_remove(par_a->content, comp_a);
+    swapped &= hmap_remove(par_b->content, comp_b);
+    swapped &= hmap_insert(par_a->content, comp_a, b);
+    swapped &= hmap_insert(par_b->content, comp_b, a);
+    assert(swapped);
+    (void) swapped;
+    a->parent = par_b;
+    b->parent = par_a;
+    content_changed(par_a);
+    content_changed(par_b);
+    // par_a zyskuje poddrzewo b i traci poddrzewo a, par_b odwrotnie
+    MemStats diff, a_sums;
+    node_sums(b, &diff);
+    node_sums(a, &a_sums);
+    negate_stats(&a_sums);
+    mem_stats_add(&diff, &a_sums);
+    add_sums(par_a, lca, &diff);
+    negate_stats(&diff);
+    add_sums(par_b, lca, &diff);
+    add_watched(par_a, lca, node_watched(b) - node_watched(a));
+    add_watched(par_b, lca, node_watched(a) - node_watched(b));
+    place_linked(par_a, comp_a, b);
+    place_linked(par_b, comp_b, a);
+    change_end();
+    uint64_t cookie = atomic_fetch_add_explicit(&next_move_cookie, 2, memory_order_relaxed) + 1;
+    notify(tree, par_a, TREE_EVENT_MOVE_FROM, cookie, path_a, strlen(path_a));
+    notify(tree, par_b, TREE_EVENT_MOVE_TO, cookie, path_b, strlen(path_b));
+    notify(tree, par_b, TREE_EVENT_MOVE_FROM, cookie + 1, path_b, strlen(path_b));
+    notify(tree, par_a, TREE_EVENT_MOVE_TO, cookie + 1, path_a, strlen(path_a));
+    charge_map(par_a, &a_before);
+    if (par_b != par_a)
+        charge_map(par_b, &b_before);
+    unlock_parents(lca, path_to_lca, par_a, par_b);
+    return 0;
+}
+
+/**
+ * Foldery, na których tree_batch trzyma liczniki no_threads między
+ * grupami operacji: nodes[i] to wierzchołek na głębokości i ścieżki path.
+ * Trzymany licznik wyklucza pisarzy, więc zawartość tych wierzchołków
+ * się nie zmienia i można z nich schodzić bez protokołu czytelników.
+ */
+typedef struct HeldPath {
+    Tree **nodes;
+    size_t count;
+    const char *path;
+} HeldPath;
+
+static void release_held(HeldPath *held) {
+
+    if (held->count > 0)
+        update_no_threads(held->nodes[held->count - 1], NULL);
+    held->count = 0;
+}
+
+/**
+ * zajmuje jako pisarz folder o ścieżce path[0..len), zostawiając liczniki
+ * na tej części held, która jest wspólna z jego (właściwymi) przodkami,
+ * i schodząc dalej tylko od niej; zwraca NULL, jeśli folderu nie ma
+ */
+static Tree *acquire_parent(Tree *tree, HeldPath *held, const char *path, size_t len) {
+
+    size_t depth = 0;
+    for (size_t i = 1; i < len; i++)
+        depth += path[i] == '/';
+
+    size_t common = 0; // wspólne składowe, tylko wśród trzymanych wierzchołków
+    if (held->count > 0)
+        for (size_t i = 1; i < len && common + 1 < held->count && path[i] == held->path[i]; i++)
+            common += path[i] == '/';
+    // najgłębszy zostawiany wierzchołek; sam folder nie może mieć licznika
+    long top = held->count == 0 || depth == 0 ? -1 : (long) (common < depth - 1 ? common : depth - 1);
+
+    if ((long) held->count - 1 > top)
+        update_no_threads(held->nodes[held->count - 1], top >= 0 ? held->nodes[top] : NULL);
+    held->count = top + 1;
+    held->path = path;
+
+    char buf[MAX_PATH_LENGTH + 1];
+    memcpy(buf, path, len);
+    buf[len] = '\0';
+    Tree *parent;
+    if (top < 0) {
+        parent = find_node_w(tree, buf, true, NULL);
+    } else {
+        size_t pos = 0;
+        for (long k = 0; k < top; k++)
+            pos = strchr(buf + pos + 1, '/') - buf;
+        parent = find_node_w(held->nodes[top], buf + pos, false, held->nodes[top]);
+    }
+    if (!parent)
+        return NULL;
+
+    // liczniki na przodkach parent poniżej held->nodes[top] wziął find_node_w
+    Tree *node = parent;
+    for (size_t d = depth; d > held->count; d--) {
+        node = node->parent;
+        held->nodes[d - 1] = node;
+    }
+    held->count = depth;
+    return parent;
+}
+
+/**
+ * wykonuje posortowane operacje, każdą grupę o wspólnym rodzicu
+ * pod jednym zajęciem rodzica jako pisarz
+ */
+static void run_groups(Tree *tree, HeldPath *held, const TreeOp *ops,
+                       const BatchEntry *entries, size_t n, int *results) {
+
+    for (size_t g = 0, h; g < n; g = h) {
+        for (h = g + 1; h < n && entries[h].parent_len == entries[g].parent_len
+                        && !memcmp(entries[h].path, entries[g].path, entries[g].parent_len); h++)
+            ;
+        Tree *parent = acquire_parent(tree, held, entries[g].path, entries[g].parent_len);
+        if (parent)
+            change_begin(tree);
+        for (size_t k = g; k < h; k++) {
+            size_t i = entries[k].index;
+            if (!parent) {
+                results[i] = ENOENT;
+                continue;
+            }
+            char component[MAX_FOLDER_NAME_LENGTH + 1];
+            size_t name_len = strlen(entries[k].path) - entries[k].parent_len - 1;
+            memcpy(component, entries[k].path + entries[k].parent_len, name_len);
+            component[name_len] = '\0';
+            results[i] = ops[i].type == TREE_OP_CREATE ? create_child(parent, component)
+                                                       : remove_child(parent, component);
+            if (results[i] == 0)
+                notify(tree, parent, ops[i].type == TREE_OP_CREATE ? TREE_EVENT_CREATE : TREE_EVENT_REMOVE, 0,
+                       ops[i].path, strlen(ops[i].path));
+        }
+        if (parent) {
+            change_end();
+            writer_fp(parent);
+        }
+    }
+}
 
-    if (hmap_size(dest->content) > 0) {
-        if (pthread_mutex_unlock(&dest->lock) != 0)
-            fatal("mutex unlock failed");//return err;
-        writer_fp(dest_par);
-        update_no_threads(dest_par->parent, NULL);
-        return ENOTEMPTY;
+/**
+ * błędy, które tree_create i tree_remove zgłaszają przed wejściem do drzewa
+ */
+static int check_op(const TreeOp *op) {
+
+    switch (op->type) {
+        case TREE_OP_CREATE:
+            if (strlen(op->path) == 1 && *op->path == '/')
+                return EEXIST;
+            return is_path_valid(op->path) ? 0 : EINVAL;
+        case TREE_OP_REMOVE:
+            if (!is_path_valid(op->path))
+                return EINVAL;
+            return strlen(op->path) == 1 ? EBUSY : 0;
+        default:
+            return EINVAL;
     }
+}
 
-    assert(hmap_remove(dest_par->content, component));
+int tree_batch(Tree *tree, const TreeOp *ops, size_t n, int *results) {
 
-    if (pthread_mutex_unlock(&dest->lock) != 0)
-        fatal("mutex unlock failed");
+    BatchEntry *entries = malloc((n ? n : 1) * sizeof(BatchEntry));
+    size_t *ends = malloc((n ? n : 1) * sizeof(size_t));
+    HeldPath held = { malloc((MAX_PATH_LENGTH / 2 + 1) * sizeof(Tree *)), 0, NULL };
+    if (!entries || !ends || !held.nodes)
+        syserr("allocation failed");
 
-    tree_free(dest);
+    size_t i = 0;
+    while (i < n) {
+        // ciąg tworzeń i usunięć do najbliższego przeniesienia
+        size_t count = 0;
+        for (; i < n && ops[i].type != TREE_OP_MOVE; i++) {
+            results[i] = check_op(&ops[i]);
+            if (results[i] == 0)
+                entries[count++] = (BatchEntry) { ops[i].path, batch_parent_len(ops[i].path), i };
+        }
+        size_t segments = batch_split(entries, count, ends);
+        for (size_t s = 0, start = 0; s < segments; start = ends[s++]) {
+            batch_sort(entries + start, ends[s] - start);
+            run_groups(tree, &held, ops, entries + start, ends[s] - start, results);
+        }
+        release_held(&held);
 
-    writer_fp(dest_par);
-    update_no_threads(dest_par->parent, NULL);
+        if (i < n) {
+            results[i] = tree_move(tree, ops[i].path, ops[i].target);
+            i++;
+        }
+    }
+    free(entries);
+    free(ends);
+    free(held.nodes);
+
+    int failed = 0;
+    for (i = 0; i < n; i++)
+        failed += results[i] != 0;
+    return failed;
+}
+
+/**
+ * Transakcje: tree_txn_ops zapisuje operacje i wersje rodziców, które
+ * zmieniają (lub to, że ich nie ma), a tree_txn_commit zajmuje jako pisarz
+ * tylko tych rodziców (bez tych leżących w poddrzewie innego), w kolejności
+ * ścieżek. Wszystkie próby są bez czekania: gdy któraś się nie uda,
+ * oddajemy wszystko i zaczynamy od nowa, więc dwie transakcje nie mogą
+ * czekać na siebie nawzajem, a po TXN_ATTEMPTS próbach bierzemy z czekaniem
+ * jednego pisarza w najniższym wspólnym przodku (jak tree_move). Pod
+ * pisarzami poddrzewa rodziców są wyłączne dla transakcji, a liczniki na
+ * przodkach wykluczają pisarzy nad nimi, więc po ścieżkach schodzimy bez
+ * zamków.
+ */
+#define TXN_ATTEMPTS 8
+
+typedef struct TxnRead {
+    char *path;
+    bool exists;
+    uint64_t version;
+} TxnRead;
+
+struct TreeTxn {
+    Tree *tree;
+    TreeOp *ops;       // z kopiami ścieżek
+    size_t n_ops, ops_capacity;
+    TxnRead *reads;
+    size_t n_reads, reads_capacity;
+    Tree **locked;     // zajęci pisarze
+    size_t n_locked;
+    bool committed;
+};
+
+/**
+ * wykonana operacja z tym, co potrzebne do jej cofnięcia; node to
+ * utworzony, odłączony lub przeniesiony wierzchołek
+ */
+typedef struct TxnUndo {
+    TreeOpType type;
+    Tree *parent, *target_parent;
+    Tree *node;
+    uint64_t version, target_version; // wersje rodziców sprzed operacji
+    char component[MAX_FOLDER_NAME_LENGTH + 1];
+    char target_component[MAX_FOLDER_NAME_LENGTH + 1];
+} TxnUndo;
+
+TreeTxn *tree_txn_begin(Tree *tree) {
+
+    TreeTxn *txn = calloc(1, sizeof(TreeTxn));
+    if (!txn)
+        syserr("allocation failed");
+    txn->tree = tree;
+    return txn;
+}
+
+void tree_txn_free(TreeTxn *txn) {
+
+    for (size_t i = 0; i < txn->n_ops; i++) {
+        free((char *) txn->ops[i].path);
+        free((char *) txn->ops[i].target);
+    }
+    for (size_t i = 0; i < txn->n_reads; i++)
+        free(txn->reads[i].path);
+    free(txn->ops);
+    free(txn->reads);
+    free(txn->locked);
+    free(txn);
+}
+
+static char *copy_path(const char *path) {
+
+    if (!path)
+        return NULL;
+    char *copy = strdup(path);
+    if (!copy)
+        syserr("allocation failed");
+    return copy;
+}
+
+/**
+ * zapisuje do zbioru odczytów wersję folderu path, jeśli jeszcze jej nie ma
+ */
+static void txn_read(TreeTxn *txn, const char *path) {
+
+    for (size_t i = 0; i < txn->n_reads; i++)
+        if (!strcmp(txn->reads[i].path, path))
+            return;
+    if (txn->n_reads == txn->reads_capacity) {
+        txn->reads_capacity = txn->reads_capacity ? 2 * txn->reads_capacity : 8;
+        txn->reads = realloc(txn->reads, txn->reads_capacity * sizeof(TxnRead));
+        if (!txn->reads)
+            syserr("allocation failed");
+    }
+    TxnRead *read = &txn->reads[txn->n_reads++];
+    read->path = copy_path(path);
+    Tree *node = find_node_r(txn->tree, path);
+    read->exists = node != NULL;
+    read->version = node ? node->version : 0;
+    if (node) {
+        reader_fp(node);
+        update_no_threads(node, NULL);
+    }
+}
+
+/**
+ * wpisuje do parents[0..2) ścieżki rodziców, których dzieci zmienia op
+ * (do zwolnienia przez wołającego); zwraca ich liczbę
+ */
+static size_t op_parents(const TreeOp *op, char **parents) {
+
+    size_t n = 0;
+    const char *paths[] = { op->path, op->type == TREE_OP_MOVE ? op->target : NULL };
+    for (size_t i = 0; i < 2; i++)
+        if (paths[i] && is_path_valid(paths[i]) && strlen(paths[i]) > 1)
+            parents[n++] = make_path_to_parent(paths[i], NULL);
+    return n;
+}
+
+int tree_txn_ops(TreeTxn *txn, const TreeOp *ops, size_t n) {
+
+    if (txn->committed)
+        return EINVAL;
+    if (txn->n_ops + n > txn->ops_capacity) {
+        while (txn->n_ops + n > txn->ops_capacity)
+            txn->ops_capacity = txn->ops_capacity ? 2 * txn->ops_capacity : 8;
+        txn->ops = realloc(txn->ops, txn->ops_capacity * sizeof(TreeOp));
+        if (!txn->ops)
+            syserr("allocation failed");
+    }
+    for (size_t i = 0; i < n; i++) {
+        TreeOp *op = &txn->ops[txn->n_ops++];
+        op->type = ops[i].type;
+        op->path = copy_path(ops[i].path);
+        op->target = ops[i].type == TREE_OP_MOVE ? copy_path(ops[i].target) : NULL;
+        char *parents[2];
+        size_t n_parents = op_parents(op, parents);
+        for (size_t p = 0; p < n_parents; p++) {
+            txn_read(txn, parents[p]);
+            free(parents[p]);
+        }
+    }
     return 0;
 }
 
+static int compare_paths(const void *a, const void *b) {
+
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
 /**
- * sprawdza czy poten_child jest podfolderem source
+ * ścieżki rodziców zmienianych przez transakcję, posortowane i bez tych,
+ * które leżą w poddrzewie innej (przedrostek z '/' na końcu); zwraca ich
+ * liczbę, a tablicę i ścieżki zwalnia wołający
  */
-static bool is_parent_to(const char *source, const char *poten_child) {
+static size_t txn_lock_paths(TreeTxn *txn, char ***out) {
 
-    if (!source || !poten_child)
-        return false;
-    assert(is_path_valid(source) && is_path_valid(poten_child));
-    char *target = make_path_to_parent(poten_child, NULL);
-    while (target) {
-        if (!strcmp(target, source)) {
-            free(target);
-            return true;
+    char **paths = malloc((2 * txn->n_ops + 1) * sizeof(char *));
+    if (!paths)
+        syserr("allocation failed");
+    size_t n = 0;
+    for (size_t i = 0; i < txn->n_ops; i++)
+        n += op_parents(&txn->ops[i], paths + n);
+    qsort(paths, n, sizeof(char *), compare_paths);
+
+    // potomkowie ścieżki leżą w posortowanej tablicy zaraz za nią
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (kept > 0 && !strncmp(paths[kept - 1], paths[i], strlen(paths[kept - 1]))) {
+            free(paths[i]);
+            continue;
         }
-        char *temp = target;
-        target = make_path_to_parent(target, NULL);
-        free(temp);
+        paths[kept++] = paths[i];
     }
+    *out = paths;
+    return kept;
+}
+
+static bool txn_holds(TreeTxn *txn, Tree *node) {
+
+    for (size_t i = 0; i < txn->n_locked; i++)
+        if (txn->locked[i] == node)
+            return true;
     return false;
 }
 
+static void txn_unlock(TreeTxn *txn) {
+
+    while (txn->n_locked > 0) {
+        Tree *node = txn->locked[--txn->n_locked];
+        writer_fp(node);
+        update_no_threads(node->parent, NULL);
+    }
+}
+
 /**
- * zwraca ścieżkę do najniższego wspólnego przodka path1 i path2
+ * bez czekania zajmuje jako pisarz folder path, a jeśli go nie ma, jego
+ * najgłębszego istniejącego przodka; nic nie robi, gdy po drodze jest
+ * folder już zajęty przez transakcję. Zwraca false, gdy musiałby czekać.
  */
-char *make_path_to_lca(const char *path1, const char *path2) {
+static bool txn_try_lock(TreeTxn *txn, const char *path) {
 
-    assert(is_path_valid(path1) && is_path_valid(path2));
-    if (!strcmp(path1, path2))
-        return strdup(path1);
+    Tree *node = txn->tree;
+    if (txn_holds(txn, node))
+        return true;
+    if (!reader_try(node))
+        return false;
 
-    char *parent1 = strdup(path1), *parent2 = strdup(path2), *temp;
-    while (parent1 && parent2) {
-        int par1_len = (int) strlen(parent1);
-        int par2_len = (int) strlen(parent2);
-        if (par1_len > par2_len) {
-            temp = parent1;
-            parent1 = make_path_to_parent(parent1, NULL);
-            free(temp);
-        } else if (par1_len < par2_len) {
-            temp = parent2;
-            parent2 = make_path_to_parent(parent2, NULL);
-            free(temp);
-        } else if (!strcmp(parent1, parent2)) {
-            free(parent1);
-            return parent2;
-        } else {
-            temp = parent1;
-            parent1 = make_path_to_parent(parent1, NULL);
-            free(temp);
-            temp = parent2;
-            parent2 = make_path_to_parent(parent2, NULL);
-            free(temp);
+    char component[MAX_FOLDER_NAME_LENGTH + 1];
+    const char *subpath = path;
+    while ((subpath = split_path(subpath, component))) {
+        Tree *child = hmap_get(node->content, component);
+        if (!child)
+            break;
+        bool held = txn_holds(txn, child);
+        if (held || !reader_try(child)) {
+            reader_fp(node);
+            update_no_threads(node, NULL);
+            return held;
         }
+        reader_fp(node);
+        node = child;
     }
-    assert(false);
+
+    // licznik na node oddajemy, bo pisarz czeka na zero, ale licznik
+    // na rodzicu zostaje, więc node nie zniknie
+    reader_fp(node);
+    update_no_threads(node, node->parent);
+    if (!writer_try(node)) {
+        update_no_threads(node->parent, NULL);
+        return false;
+    }
+    txn->locked[txn->n_locked++] = node;
+    return true;
 }
 
 /**
- * obcina ścieżkę dest o przedrostek parent
+ * z czekaniem zajmuje jako pisarz najniższego wspólnego przodka paths
+ * (albo jego najgłębszego istniejącego przodka)
  */
-static const char *cut_path(const char *path1, const char *path2) {
-    
-    assert(strlen(path1) <= strlen(path2));
-    return path2 + strlen(path1) - 1;
+static void txn_lock_lca(TreeTxn *txn, char **paths, size_t n) {
+
+    char *lca = copy_path(n > 0 ? paths[0] : "/");
+    for (size_t i = 1; i < n; i++) {
+        char *next = make_path_to_lca(lca, paths[i]);
+        free(lca);
+        lca = next;
+    }
+    Tree *node;
+    while (!(node = find_node_w(txn->tree, lca, true, NULL))) {
+        char *parent = make_path_to_parent(lca, NULL);
+        free(lca);
+        lca = parent;
+    }
+    free(lca);
+    txn->locked[txn->n_locked++] = node;
 }
 
-int tree_move(Tree *tree, const char *source, const char *target) {
+static void txn_lock(TreeTxn *txn) {
+
+    char **paths;
+    size_t n = txn_lock_paths(txn, &paths);
+    txn->locked = malloc((n + 1) * sizeof(Tree *));
+    if (!txn->locked)
+        syserr("allocation failed");
+
+    bool locked = false;
+    for (int attempt = 0; attempt < TXN_ATTEMPTS && !locked; attempt++) {
+        locked = true;
+        for (size_t i = 0; i < n && locked; i++)
+            locked = txn_try_lock(txn, paths[i]);
+        if (!locked) {
+            txn_unlock(txn);
+            sched_yield();
+        }
+    }
+    if (!locked)
+        txn_lock_lca(txn, paths, n);
+
+    for (size_t i = 0; i < n; i++)
+        free(paths[i]);
+    free(paths);
+}
+
+/**
+ * czy rodzice zmieniani przez transakcję są w stanie z tree_txn_ops
+ */
+static bool txn_validate(TreeTxn *txn) {
+
+    for (size_t i = 0; i < txn->n_reads; i++) {
+        Tree *node = find_below(txn->tree, "/", txn->reads[i].path);
+        if ((node != NULL) != txn->reads[i].exists || (node && node->version != txn->reads[i].version))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * odłącza od parent dziecko component, nie zwalniając go
+ */
+static Tree *unlink_child(Tree *parent, const char *component) {
+
+    Tree *node = hmap_get(parent->content, component);
+    unshare_content(parent);
+    MemStats before, delta;
+    map_memory(parent->content, &before);
+    bool removed = hmap_remove(parent->content, component);
+    assert(removed);
+    (void) removed;
+    content_changed(parent);
+    node_sums(node, &delta);
+    negate_stats(&delta);
+    map_change(parent, &before, &delta);
+    add_sums(parent, NULL, &delta);
+    add_watched(parent, NULL, -node_watched(node));
+    return node;
+}
+
+static void link_child(Tree *parent, const char *component, Tree *node) {
+
+    unshare_content(parent);
+    MemStats before, delta;
+    map_memory(parent->content, &before);
+    bool inserted = hmap_insert(parent->content, component, node);
+    assert(inserted);
+    (void) inserted;
+    content_changed(parent);
+    node_sums(node, &delta);
+    map_change(parent, &before, &delta);
+    add_sums(parent, NULL, &delta);
+    add_watched(parent, NULL, node_watched(node));
+}
+
+/**
+ * wykonuje op (z kodami tree_create, tree_remove i tree_move) i zapisuje
+ * do undo, jak ją cofnąć; usuwany folder jest tylko odłączany
+ */
+static int txn_apply(Tree *root, const TreeOp *op, TxnUndo *undo) {
 
-         if (!is_path_valid(source) || !is_path_valid(target))
+    undo->type = op->type;
+    undo->node = NULL;
+    if (!is_path_valid(op->path) || (op->type == TREE_OP_MOVE && !is_path_valid(op->target)))
         return EINVAL;
-    if (strlen(source) == 1 && *source == '/')
-        return EBUSY;
-    if (strlen(target) == 1 && *target == '/')
+    bool is_root = strlen(op->path) == 1;
+    if (op->type == TREE_OP_CREATE && is_root)
         return EEXIST;
-    if (is_parent_to(source, target))
-        return -9; // target jest potomkiem source
+    if (op->type != TREE_OP_CREATE && is_root)
+        return EBUSY;
 
-    char *path_to_lca = make_path_to_lca(source, target);
-    assert(path_to_lca);
-    Tree *lca = find_node_w(tree, path_to_lca, true, NULL);
-    if (!lca)
-        return free(path_to_lca), ENOENT;
-    assert(lca->no_threads == 1);
-    if (!strcmp(source, path_to_lca)) { // source == lca
-        writer_fp(lca);
-        update_no_threads(lca->parent, NULL);
-        if (!strcmp(source, target)) { // source == target
-            free(path_to_lca);
+    Tree *parent = find_parent_below(root, "/", op->path, undo->component);
+    switch (op->type) {
+        case TREE_OP_CREATE: {
+            if (!parent)
+                return ENOENT;
+            undo->parent = parent;
+            undo->version = parent->version;
+            int err = create_child(parent, undo->component);
+            undo->node = err ? NULL : hmap_get(parent->content, undo->component);
+            return err;
+        }
+        case TREE_OP_REMOVE: {
+            Tree *node = parent ? hmap_get(parent->content, undo->component) : NULL;
+            if (!node)
+                return ENOENT;
+            if (hmap_size(node->content) > 0)
+                return ENOTEMPTY;
+            undo->parent = parent;
+            undo->version = parent->version;
+            undo->node = unlink_child(parent, undo->component);
             return 0;
         }
+        default:
+            break;
     }
-    if (!strcmp(target, path_to_lca)) { // source jest przodkiem target
-        free(path_to_lca);
-        writer_fp(lca);
-        update_no_threads(lca->parent, NULL);
+
+    const char *target = op->target;
+    if (strlen(target) == 1)
         return EEXIST;
-    }
-    char comp[MAX_FOLDER_NAME_LENGTH + 1];
-    char *path_to_src_par = make_path_to_parent(source, comp);
-    Tree *src_par;
-    if (!strcmp(path_to_lca, path_to_src_par))
-        src_par = lca;
-    else
-        src_par = find_node_w(lca, cut_path(path_to_lca, path_to_src_par), false, lca);
-    if (!src_par) {
-        writer_fp(lca);
-        update_no_threads(lca->parent, NULL);
-        free(path_to_src_par);
-        free(path_to_lca);
+    if (is_parent_to(op->path, target))
+        return -9; // target jest potomkiem source
+    Tree *node = parent ? hmap_get(parent->content, undo->component) : NULL;
+    if (!node)
         return ENOENT;
+    if (!strcmp(op->path, target))
+        return 0;
+    if (is_parent_to(target, op->path))
+        return EEXIST;
+    Tree *target_parent = find_parent_below(root, "/", target, undo->target_component);
+    if (!target_parent)
+        return ENOENT;
+    if (hmap_get(target_parent->content, undo->target_component))
+        return EEXIST;
+
+    undo->parent = parent;
+    undo->target_parent = target_parent;
+    undo->version = parent->version;
+    undo->target_version = target_parent->version;
+    undo->node = unlink_child(parent, undo->component);
+    link_child(target_parent, undo->target_component, node);
+    node->parent = target_parent;
+    return 0;
+}
+
+static void txn_undo(TxnUndo *undo) {
+
+    if (!undo->node)
+        return;
+    switch (undo->type) {
+        case TREE_OP_CREATE:
+            remove_child(undo->parent, undo->component);
+            break;
+        case TREE_OP_REMOVE:
+            link_child(undo->parent, undo->component, undo->node);
+            break;
+        case TREE_OP_MOVE:
+            unlink_child(undo->target_parent, undo->target_component);
+            link_child(undo->parent, undo->component, undo->node);
+            undo->node->parent = undo->parent;
+            undo->target_parent->version = undo->target_version;
+            break;
     }
-    Tree *src = find_child(src_par, cut_path(path_to_src_par, source));
-    if (!src) {
-        free(path_to_src_par);
-        free(path_to_lca);
-        if (src_par != lca) {
-            writer_fp(src_par);
-            update_no_threads(src_par->parent, lca);
+    undo->parent->version = undo->version;
+}
+
+/**
+ * po udanej transakcji wysyła zdarzenia operacji undo (w jej kolejności)
+ */
+static void txn_notify(Tree *tree, const TreeOp *op, const TxnUndo *undo) {
+
+    if (!undo->node)
+        return;
+    switch (undo->type) {
+        case TREE_OP_CREATE:
+            notify(tree, undo->parent, TREE_EVENT_CREATE, 0, op->path, strlen(op->path));
+            break;
+        case TREE_OP_REMOVE:
+            notify(tree, undo->parent, TREE_EVENT_REMOVE, 0, op->path, strlen(op->path));
+            break;
+        case TREE_OP_MOVE: {
+            uint64_t cookie = atomic_fetch_add_explicit(&next_move_cookie, 1, memory_order_relaxed) + 1;
+            notify(tree, undo->parent, TREE_EVENT_MOVE_FROM, cookie, op->path, strlen(op->path));
+            notify(tree, undo->target_parent, TREE_EVENT_MOVE_TO, cookie, op->target, strlen(op->target));
+            break;
         }
-        writer_fp(lca);
-        update_no_threads(lca->parent, NULL);
-        return ENOENT;
     }
-    writer_pp(src);
-    Tree *trg_par;
-    char trg_component[MAX_FOLDER_NAME_LENGTH + 1];
-    char *path_to_trg_par = make_path_to_parent(target, trg_component);
-    if (!strcmp(path_to_trg_par, path_to_lca)) { // target parent == lca
-        trg_par = lca;
-    } else {
-        trg_par = find_node_w(lca, cut_path(path_to_lca, path_to_trg_par), false, lca);
-        if (!trg_par) {
-            free(path_to_src_par);
-            free(path_to_trg_par);
-            free(path_to_lca);
-            writer_fp(src);
-            update_no_threads(src_par->parent, lca);
-            if (src_par != lca)
-                writer_fp(src_par);
-            update_no_threads(lca->parent, NULL);
-            writer_fp(lca);
-            return ENOENT;
-        }
-    }
-    if (src_par != lca && lca != trg_par) {
-        if (is_parent_to(path_to_src_par, path_to_trg_par)) {
-            update_no_threads(src_par->parent, lca);
-        } else if (is_parent_to(path_to_trg_par, path_to_src_par)) {
-            update_no_threads(trg_par->parent, lca);
-        } else {
-            update_no_threads(src_par->parent, lca);
-            update_no_threads(trg_par->parent, lca);
-        }
-        writer_fp(lca);
-        update_no_threads(lca->parent, NULL);
-    }
-    bool target_exists = true;
-    if (!hmap_get(trg_par->content, trg_component)) {
-        // trg nie istnieje
-        target_exists = false;
-        char src_component[MAX_FOLDER_NAME_LENGTH + 1];
-        free(make_path_to_parent(source, src_component));
-        assert(hmap_remove(src_par->content, src_component));
-        assert(hmap_insert(trg_par->content, trg_component, src));
-        src->parent = trg_par;
-    }
-    writer_fp(src);
-    if (src_par == trg_par) {
-        writer_fp(lca);
-        update_no_threads(lca->parent, NULL);
-    } else if (src_par == lca) {
-        writer_fp(trg_par);
-        update_no_threads(trg_par->parent, src_par);
-        writer_fp(src_par);
-        update_no_threads(src_par->parent, NULL);
-    } else if (trg_par == lca) {
-        writer_fp(src_par);
-        update_no_threads(src_par->parent, trg_par);
-        writer_fp(trg_par);
-        update_no_threads(trg_par->parent, NULL);
-    } else if (is_parent_to(path_to_src_par, path_to_trg_par)) {
-        writer_fp(trg_par);
-        update_no_threads(trg_par->parent, src_par);
-        writer_fp(src_par);
-    } else if (is_parent_to(path_to_trg_par, path_to_src_par)) {
-        writer_fp(src_par);
-        update_no_threads(src_par->parent, trg_par);
-        writer_fp(trg_par);
+}
+
+int tree_txn_commit(TreeTxn *txn, int *results) {
+
+    if (txn->committed) {
+        for (size_t i = 0; i < txn->n_ops; i++)
+            results[i] = EINVAL;
+        return EINVAL;
+    }
+    txn->committed = true;
+    txn_lock(txn);
+    change_begin(txn->tree);
+
+    int err = 0;
+    if (!txn_validate(txn)) {
+        err = EAGAIN;
+        for (size_t i = 0; i < txn->n_ops; i++)
+            results[i] = EAGAIN;
+    }
+
+    TxnUndo *log = malloc((txn->n_ops ? txn->n_ops : 1) * sizeof(TxnUndo));
+    if (!log)
+        syserr("allocation failed");
+    size_t applied = 0;
+    while (!err && applied < txn->n_ops) {
+        err = txn_apply(txn->tree, &txn->ops[applied], &log[applied]);
+        results[applied] = err;
+        if (!err)
+            applied++;
+    }
+
+    if (err && err != EAGAIN) { // cofamy od końca; stan jest jak przed transakcją
+        for (size_t i = 0; i < txn->n_ops; i++)
+            if (i != applied)
+                results[i] = ECANCELED;
+        while (applied > 0)
+            txn_undo(&log[--applied]);
+    }
+    for (size_t i = 0; i < applied; i++)
+        txn_notify(txn->tree, &txn->ops[i], &log[i]);
+    // odłączone foldery zwolnione, ich sumy zeszły już przy odłączeniu
+    for (size_t i = 0; i < applied; i++)
+        if (log[i].type == TREE_OP_REMOVE && log[i].node)
+            drop_node(log[i].node);
+    free(log);
+    change_end();
+
+    txn_unlock(txn);
+    free(txn->locked);
+    txn->locked = NULL;
+    return err;
+}
+
+/**
+ * Migawka to tylko epoka: jej stan to mapy wierzchołków obowiązujące
+ * w tej epoce (content_at), a drzewo zachowuje je, dopóki migawka żyje.
+ */
+struct TreeSnapshot {
+    Tree *root;
+    uint64_t epoch;
+    TreeSnapshot *next; // starsza żywa migawka tego drzewa
+};
+
+/**
+ * czy żyje migawka o epoce z (from, to]; wołający trzyma snap_lock
+ */
+static bool snap_needed(TreeShared *shared, uint64_t from, uint64_t to) {
+
+    for (TreeSnapshot *snapshot = shared->snapshots; snapshot; snapshot = snapshot->next)
+        if (snapshot->epoch > from && snapshot->epoch <= to)
+            return true;
+    return false;
+}
+
+static void version_free_map(TreeShared *shared, ContentVersion *version) {
+
+    HashMap *map = atomic_exchange_explicit(&version->map, NULL, memory_order_relaxed);
+    if (!map)
+        return;
+    MemStats mem;
+    map_memory(map, &mem);
+    mem_account_sub(shared->account, &mem);
+    hmap_free(map);
+}
+
+static void versions_free(TreeShared *shared, ContentVersion *version) {
+
+    MemStats entry;
+    memset(&entry, 0, sizeof(MemStats));
+    entry.container_bytes = sizeof(ContentVersion);
+    while (version) {
+        ContentVersion *older = atomic_load_explicit(&version->older, memory_order_relaxed);
+        version_free_map(shared, version);
+        mem_account_sub(shared->account, &entry);
+        free(version);
+        version = older;
+    }
+}
+
+/**
+ * zwalnia dawne mapy node, których nie czyta żadna żywa migawka, i wersje
+ * starsze od najstarszej potrzebnej (przez nie nikt już nie przechodzi);
+ * zwraca, czy historia node jest pusta; wołający trzyma snap_lock
+ */
+static bool prune_history(TreeShared *shared, Tree *node) {
+
+    ContentVersion *head = atomic_load_explicit(&node->history, memory_order_acquire);
+    while (head) {
+        ContentVersion *keep = NULL;
+        for (ContentVersion *version = head; version;
+             version = atomic_load_explicit(&version->older, memory_order_relaxed)) {
+            if (snap_needed(shared, version->from, version->to))
+                keep = version;
+            else
+                version_free_map(shared, version);
+        }
+        if (keep) {
+            versions_free(shared, atomic_exchange_explicit(&keep->older, NULL, memory_order_relaxed));
+            return false;
+        }
+        // pisarz mógł w tym czasie dołożyć nowszą wersję; wtedy sprawdzamy i ją
+        if (atomic_compare_exchange_strong_explicit(&node->history, &head, NULL,
+                                                    memory_order_acq_rel, memory_order_acquire)) {
+            versions_free(shared, head);
+            return true;
+        }
+    }
+    return true;
+}
+
+/**
+ * zwalnia odłożony wierzchołek albo zleca zwolnienie odłożonego poddrzewa
+ */
+static void free_retired(TreeShared *shared, Retired *retired) {
+
+    if (retired->subtree) {
+        pthread_once(&reclaim_once, make_reclaim_group);
+        work_submit(reclaim_group, free_subtree, reclaim_new(retired->node, shared));
     } else {
-        writer_fp(src_par);
-        writer_fp(trg_par);
+        MemStats mem;
+        node_memory(retired->node, &mem);
+        mem_account_sub(shared->account, &mem);
+        node_put(retired->node);
     }
-    free(path_to_src_par);
-    free(path_to_trg_par);
-    free(path_to_lca);
-    if (!target_exists)
-        return 0;
-    else
-        return EEXIST;
+    free(retired);
+}
+
+/**
+ * zwalnia dawne mapy i odłożone wierzchołki, których nie potrzebuje już
+ * żadna żywa migawka; wołający trzyma snap_lock
+ */
+static void collect(TreeShared *shared) {
+
+    Versioned *cell = atomic_exchange(&shared->versioned, NULL);
+    while (cell) {
+        Versioned *next = cell->next;
+        if (prune_history(shared, cell->node))
+            free(cell);
+        else
+            push_versioned(shared, cell);
+        cell = next;
+    }
+
+    Retired *retired = atomic_exchange(&shared->retired, NULL);
+    while (retired) {
+        Retired *next = retired->next;
+        // wierzchołek z historią czeka, aż collect ją opróżni
+        bool needed = retired->subtree ? snap_needed(shared, 0, retired->epoch)
+                      : atomic_load(&retired->node->history)
+                        || snap_needed(shared, atomic_load(&retired->node->born), retired->epoch);
+        if (needed)
+            push_retired(shared, retired);
+        else
+            free_retired(shared, retired);
+        retired = next;
+    }
+}
+
+/**
+ * oddaje odwołanie do stanu wspólnego; ostatnie (drzewo zwolnione,
+ * wszystkie jego poddrzewa też) zwalnia wierzchołki, które zadania
+ * zwalniające odłożyły po ostatnim collect
+ */
+static void shared_release(TreeShared *shared) {
+
+    if (atomic_fetch_sub_explicit(&shared->refs, 1, memory_order_acq_rel) != 1)
+        return;
+    assert(!atomic_load(&shared->versioned));
+    Retired *retired = atomic_load(&shared->retired);
+    while (retired) {
+        Retired *next = retired->next;
+        assert(!retired->subtree && !atomic_load(&retired->node->history));
+        free_retired(shared, retired);
+        retired = next;
+    }
+    mem_account_free(shared->account);
+    if (pthread_mutex_destroy(&shared->snap_lock) != 0)
+        syserr("lock destroy failed");
+    node_put(shared_root(shared));
+}
+
+TreeSnapshot *tree_snapshot(Tree *tree) {
+
+    TreeShared *shared = tree_shared(tree);
+    TreeSnapshot *snapshot = malloc(sizeof(TreeSnapshot));
+    if (!snapshot)
+        syserr("allocation failed");
+    lock_snapshots(shared);
+    uint64_t epoch = atomic_load(&shared->epoch) + 1;
+    snapshot->root = tree;
+    snapshot->epoch = epoch;
+    snapshot->next = shared->snapshots;
+    shared->snapshots = snapshot;
+    // pisarze sprawdzają żywe migawki po odczytaniu epoki, więc każdy,
+    // kto zobaczy nową epokę, zobaczy też tę migawkę
+    atomic_store(&shared->newest_live, epoch);
+    if (atomic_load(&shared->oldest_live) == 0)
+        atomic_store(&shared->oldest_live, epoch);
+    atomic_store(&shared->epoch, epoch);
+    // zmiany z poprzedniej epoki mają być w migawce w całości
+    for (size_t s = 0; s < COUNT_STRIPES; s++)
+        while (atomic_load_explicit(&shared->changes[s].active[(epoch - 1) & 1], memory_order_acquire))
+            sched_yield();
+    unlock_snapshots(shared);
+    return snapshot;
+}
+
+void tree_snapshot_free(TreeSnapshot *snapshot) {
+
+    TreeShared *shared = tree_shared(snapshot->root);
+    lock_snapshots(shared);
+    TreeSnapshot **link = &shared->snapshots;
+    while (*link != snapshot)
+        link = &(*link)->next;
+    *link = snapshot->next;
+    TreeSnapshot *oldest = shared->snapshots;
+    while (oldest && oldest->next)
+        oldest = oldest->next;
+    atomic_store(&shared->newest_live, shared->snapshots ? shared->snapshots->epoch : 0);
+    atomic_store(&shared->oldest_live, oldest ? oldest->epoch : 0);
+    collect(shared);
+    unlock_snapshots(shared);
+    free(snapshot);
+}
+
+/**
+ * mapa node obowiązująca w epoce epoch żywej migawki. Obecna mapa
+ * obowiązuje od epoki born, a jej zmiany w epokach od epoch wzwyż
+ * pisarz robi już na kopii, więc gdy epoch > born, jest to ta mapa.
+ * Historię czytamy tylko wtedy; collect zwalnia z niej tylko wersje,
+ * przez które nie przechodzi żadna żywa migawka.
+ */
+static HashMap *content_at(Tree *node, uint64_t epoch) {
+
+    HashMap *map = __atomic_load_n(&node->content, __ATOMIC_ACQUIRE);
+    if (epoch > atomic_load_explicit(&node->born, memory_order_acquire))
+        return map;
+    ContentVersion *version = atomic_load_explicit(&node->history, memory_order_acquire);
+    for (; version && epoch <= version->to; version = atomic_load_explicit(&version->older, memory_order_relaxed))
+        if (epoch > version->from)
+            return atomic_load_explicit(&version->map, memory_order_relaxed);
+    return map;
+}
+
+static Tree *snap_find(TreeSnapshot *snapshot, const char *path) {
+
+    char component[MAX_FOLDER_NAME_LENGTH + 1];
+    const char *subpath = path;
+    Tree *node = snapshot->root;
+    while (node && (subpath = split_path(subpath, component)))
+        node = hmap_get(content_at(node, snapshot->epoch), component);
+    return node;
+}
+
+char *tree_snapshot_list(TreeSnapshot *snapshot, const char *path) {
+
+    if (!is_path_valid(path))
+        return NULL;
+    Tree *node = snap_find(snapshot, path);
+    if (!node)
+        return NULL;
+    return make_map_contents_string(content_at(node, snapshot->epoch));
+}
+
+int tree_snapshot_walk(TreeSnapshot *snapshot, const char *path, TreeWalkFunction visit, void *ctx, size_t threads) {
+
+    if (!is_path_valid(path))
+        return EINVAL;
+    Tree *node = snap_find(snapshot, path);
+    if (!node)
+        return ENOENT;
+    run_walk(NULL, node, path, threads, visit, ctx, NULL, NULL, snapshot->epoch);
+    return 0;
 }
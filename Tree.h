@@ -1,11 +1,95 @@
 #pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mem_account.h"
+#include "node_pool.h"
+#include "watch_queue.h"
 
 typedef struct Tree Tree; // Let "Tree" mean the same as "struct Tree".
 
+/**
+ * Nazwa podfolderu wraz z długością (bez znaku zerowego).
+ */
+typedef struct TreeName {
+    const char *name;
+    size_t length;
+} TreeName;
+
+/**
+ * Bufor dostarczany przez wołającego, do wielokrotnego użycia.
+ * names i max_names oraz chars i size ustawia wołający,
+ * count i needed ustawia wywołanie.
+ */
+typedef struct TreeNameBuffer {
+    TreeName *names;  // tablica na nazwy
+    size_t max_names;
+    char *chars;      // miejsce na znaki nazw
+    size_t size;
+    size_t count;     // liczba nazw w folderze
+    size_t needed;    // liczba bajtów potrzebna w chars
+} TreeNameBuffer;
+
+/**
+ * Zużycie pamięci przez katalog najwyższego poziomu wraz z poddrzewem.
+ */
+typedef struct TreeDirMemoryStats {
+    char name[256]; // nazwa katalogu zakończona znakiem zerowym
+    MemStats stats;
+} TreeDirMemoryStats;
+
 Tree* tree_new();
 
 void tree_free(Tree*);
 
+/**
+ * Zwalnia drzewo, rozdzielając poddrzewa między wątki wspólnej puli
+ * (work_pool.h), gdy drzewo jest duże. Przy wait == false od razu wraca,
+ * a drzewo jest zwalniane w tle; wskaźnik jest nieważny natychmiast.
+ * tree_free(tree) to tree_free_parallel(tree, true). Jak przy tree_free,
+ * na drzewie nie może trwać żadna operacja.
+ */
+void tree_free_parallel(Tree* tree, bool wait);
+
+/**
+ * Czeka, aż zostaną zwolnione wszystkie drzewa i poddrzewa oddane
+ * do zwolnienia w tle (tree_free_parallel z wait == false
+ * i tree_remove_recursive).
+ */
+void tree_reclaim_wait(void);
+
+/**
+ * W trybie TREE_LOCK_TABLE ustala liczbę pasków tablicy zamków
+ * (domyślnie 4096). Zwraca 0, EBUSY, gdy tablica jest już używana
+ * (trzeba wołać przed utworzeniem pierwszego drzewa), lub ENOTSUP
+ * przy budowaniu bez TREE_LOCK_TABLE.
+ */
+int tree_set_lock_table_size(size_t size);
+
+/**
+ * Zapisuje do *stats zużycie pamięci przez drzewo. Liczniki są
+ * aktualizowane na bieżąco przez tree_create, tree_remove i tree_move
+ * (jako sumy poddrzew), więc wywołanie kosztuje tyle, co odczyt sum
+ * korzenia. W trybie TREE_LOCK_TABLE sync_bytes obejmuje całą tablicę
+ * zamków, wspólną dla wszystkich drzew.
+ */
+void tree_memory_stats(Tree* tree, MemStats* stats);
+
+/**
+ * Zapisuje do out zużycie pamięci przez katalogi najwyższego poziomu,
+ * posortowane po nazwie (korzeń z nazwami tych katalogów liczy się tylko
+ * w tree_memory_stats). Do *count wpisuje liczbę katalogów. Zwraca 0
+ * lub ERANGE, gdy max jest za małe (wtedy nic nie zapisuje).
+ */
+int tree_memory_stats_dirs(Tree* tree, TreeDirMemoryStats* out, size_t max, size_t* count);
+
+/**
+ * Statystyki puli, z której pochodzą wierzchołki wszystkich drzew.
+ * Przy budowaniu z TREE_USE_MALLOC lub TREE_ARENA (wierzchołki z malloc
+ * lub z areny) same zera.
+ */
+void tree_pool_stats(NodePoolStats* stats);
+
 /**
  * Wymienia zawartość danego folderu, zwracając
  * nowy napis postaci "foo,bar,baz" (wszystkie
@@ -17,11 +101,292 @@ void tree_free(Tree*);
  */
 char* tree_list(Tree* tree, const char* path);
 
+/**
+ * Jak tree_list, ale zapisuje napis do bufora buf rozmiaru size
+ * i niczego nie alokuje. Do *needed (jeśli nie NULL) wpisuje rozmiar
+ * napisu wraz ze znakiem zerowym. Zwraca 0, EINVAL, ENOENT lub
+ * ERANGE, gdy bufor jest za mały (wtedy nic nie zapisuje).
+ */
+int tree_list_into(Tree* tree, const char* path, char* buf, size_t size, size_t* needed);
+
+/**
+ * Wymienia posortowane nazwy podfolderów do out: każda nazwa
+ * zakończona znakiem zerowym jest kopiowana do out->chars,
+ * a out->names wskazują na te kopie. Ustawia out->count i out->needed.
+ * Zwraca 0, EINVAL, ENOENT lub ERANGE, gdy któraś z tablic
+ * jest za mała (wtedy nic nie zapisuje).
+ */
+int tree_list_names(Tree* tree, const char* path, TreeNameBuffer* out);
+
+/**
+ * Posortowane nazwy podfolderów w jednej alokacji: i-ta nazwa zaczyna się
+ * w chars + offsets[i] i kończy znakiem zerowym, a jej długość to
+ * offsets[i + 1] - offsets[i] - 1.
+ */
+typedef struct TreeListing {
+    size_t count;
+    const char *chars;
+    size_t offsets[];  // count + 1 przesunięć, za nimi znaki nazw
+} TreeListing;
+
+/**
+ * Jak tree_list, ale zamiast sklejać nazwy przecinkami zwraca je jako
+ * TreeListing, do zwolnienia przez tree_listing_free. Gdy folder ma
+ * zapamiętany posortowany indeks (tree_list_page), nazwy nie są sortowane
+ * ponownie. Zwraca NULL dla niepoprawnej lub nieistniejącej ścieżki.
+ */
+TreeListing* tree_list_entries(Tree* tree, const char* path);
+
+void tree_listing_free(TreeListing* listing);
+
+/**
+ * Wymienia do out kolejną stronę posortowanych nazw podfolderów: nazwy
+ * większe od cursor (od początku, gdy cursor jest NULL lub ""), najwyżej
+ * max_entries i tyle, ile mieści out. Kursorem następnej strony jest kopia
+ * ostatniej zwróconej nazwy; pozostaje ważny mimo zmian w folderze między
+ * stronami (strona pokazuje stan folderu z chwili wywołania). Zamek
+ * czytelnika jest trzymany tylko na czas jednej strony. Posortowany indeks
+ * nazw buduje pierwsza strona folderu, a dalej utrzymują go zmiany folderu,
+ * więc strona to wyszukanie kursora i przepisanie najwyżej max_entries nazw.
+ * Ustawia out->count (0 oznacza koniec listy) i out->needed (bajty zajęte
+ * w out->chars, a przy ERANGE potrzebne na następną nazwę). Zwraca 0,
+ * EINVAL, ENOENT lub ERANGE, gdy w out nie mieści się żadna nazwa.
+ */
+int tree_list_page(Tree* tree, const char* path, const char* cursor, size_t max_entries, TreeNameBuffer* out);
+
+/**
+ * Stan folderu bez wymieniania jego zawartości.
+ */
+typedef struct TreeStat {
+    size_t children;   // liczba bezpośrednich podfolderów
+    uint64_t version;  // zmienia się przy każdym utworzeniu, usunięciu
+                       // lub przeniesieniu bezpośredniego podfolderu
+} TreeStat;
+
+/**
+ * Zapisuje do *stat (jeśli nie NULL) liczbę podfolderów i wersję folderu,
+ * schodząc po drzewie jak tree_list, ale niczego nie alokując. Zwraca 0,
+ * EINVAL lub ENOENT, gdy folder nie istnieje.
+ */
+int tree_stat(Tree* tree, const char* path, TreeStat* stat);
+
+/**
+ * Zapisuje do *count (jeśli nie NULL) liczbę wszystkich folderów
+ * w poddrzewie path (bez samego path). Liczba jest utrzymywana na bieżąco
+ * w każdym folderze, więc odczyt nie zależy od rozmiaru poddrzewa. Zmiany
+ * trwające równolegle w głębi poddrzewa mogą być uwzględnione lub nie.
+ * Zwraca 0, EINVAL lub ENOENT.
+ */
+int tree_count(Tree* tree, const char* path, size_t* count);
+
+/**
+ * Wołana przez tree_walk dla każdego odwiedzanego folderu z jego pełną
+ * ścieżką (ważną tylko w trakcie wywołania).
+ */
+typedef void (*TreeWalkFunction)(const char* path, void* ctx);
+
+/**
+ * Odwiedza wszystkie foldery w poddrzewie path (bez samego path), wołając
+ * visit w threads wątkach (wołający i wątki wspólnej puli), które
+ * podkradają sobie czekające foldery. Folder jest odwiedzany przed swoimi
+ * podfolderami, poza tym kolejność i wątek są dowolne. Wątek szuka od
+ * korzenia jak w tree_list tylko folderu, od którego zaczyna swoją część
+ * pracy, a dalej schodzi w głąb, wykluczając pisarzy z folderów na bieżącej
+ * ścieżce; co kilkaset folderów (i częściej, gdy inny wątek nie ma pracy)
+ * zwalnia je wszystkie i oddaje resztę po ścieżkach. visit jest wołana
+ * dopiero wtedy, bez żadnych zamków, więc może wołać operacje na tym
+ * drzewie. Przejście nie jest więc migawką: folder usunięty w trakcie
+ * może nie zostać odwiedzony, a utworzony - zostać odwiedzony lub nie.
+ * Zwraca 0, EINVAL lub ENOENT.
+ */
+int tree_walk(Tree* tree, const char* path, TreeWalkFunction visit, void* ctx, size_t threads);
+
+/**
+ * Jak tree_walk, ale woła visit tylko dla folderów, których nazwa pasuje
+ * do wzorca pattern: '*' to dowolny ciąg znaków, '?' dowolny znak,
+ * "[a-c]" lub "[!a-c]" znak ze zbioru lub spoza niego, litery oznaczają
+ * siebie (np. "log*", "*[xy]?"). Wzorzec jest raz kompilowany do automatu
+ * (patrz name_match.h), a przejście idzie w threads wątkach, jak w tree_walk.
+ * Zwraca 0, EINVAL (zła ścieżka lub wzorzec) lub ENOENT.
+ */
+int tree_find(Tree* tree, const char* path, const char* pattern, TreeWalkFunction visit, void* ctx,
+              size_t threads);
+
 int tree_create(Tree* tree, const char* path);
 
+/**
+ * Tworzy wszystkie brakujące foldery na ścieżce (jak mkdir -p), schodząc
+ * od korzenia raz: istniejące foldery przechodzi jako czytelnik, a w
+ * pierwszym, w którym czegoś brakuje, wchodzi jako pisarz i tworzy pod nim
+ * całą resztę ścieżki. Do *created (jeśli nie NULL) wpisuje liczbę
+ * utworzonych folderów. Zwraca 0 (także gdy wszystkie już istniały)
+ * lub EINVAL.
+ */
+int tree_create_all(Tree* tree, const char* path, size_t* created);
+
 int tree_remove(Tree* tree, const char* path);
 
+/**
+ * Usuwa folder razem z całym poddrzewem. Pod pisarzem w rodzicu tylko
+ * odłącza poddrzewo (koszt zależy od głębokości ścieżki, nie od rozmiaru
+ * poddrzewa), a zwalnia je w tle pula wątków; do tego czasu jego pamięć
+ * jest widoczna w tree_memory_stats. Zwraca 0, EINVAL, ENOENT lub EBUSY
+ * dla "/".
+ */
+int tree_remove_recursive(Tree* tree, const char* path);
+
 int tree_move(Tree* tree, const char* source, const char* target);
 
+/**
+ * Zamienia miejscami dwa istniejące foldery razem z poddrzewami (jak
+ * rename z RENAME_EXCHANGE). Obie zmiany zachodzą, gdy oba rodzice są
+ * zajęci jako pisarze (najniższy wspólny przodek jest zajmowany tylko na
+ * czas ich znalezienia), więc żaden wątek nie widzi stanu pośredniego ani
+ * chwili, w której jednego z folderów nie ma.
+ * Zwraca 0 (także dla path_a == path_b), EINVAL, EBUSY, gdy któraś
+ * ścieżka to "/", ENOENT, gdy któregoś folderu nie ma, lub -9 (jak
+ * tree_move), gdy jeden folder leży w poddrzewie drugiego.
+ */
+int tree_exchange(Tree* tree, const char* path_a, const char* path_b);
+
+/**
+ * Kopiuje folder source z całym poddrzewem jako nowy folder target (jak
+ * cp -r). Kopia powstaje poza drzewem, równolegle w wątkach wspólnej puli;
+ * przez ten czas source jest zajęty jako czytelnik, a jego poddrzewo jest
+ * zamknięte tylko dla pisarzy (czytelnicy wchodzą do niego jak zwykle).
+ * Potem kopia jest wstawiana do rodzica target w jednym krótkim wejściu
+ * pisarza. Rodzic i nazwa target są sprawdzane przed kopiowaniem, więc
+ * błąd nie kosztuje kopii poddrzewa. target może leżeć w poddrzewie
+ * source (kopiowany jest stan sprzed wstawienia). Zwraca 0, EINVAL, ENOENT
+ * (nie ma source lub rodzica target) lub EEXIST (target istnieje).
+ */
+int tree_copy(Tree* tree, const char* source, const char* target);
+
+/**
+ * Zapisuje kolejkę queue (watch_queue.h) jako obserwatora folderu path:
+ * tree_create, tree_create_all, tree_remove, tree_remove_recursive,
+ * tree_move, tree_exchange, tree_copy, tree_batch i tree_txn_commit dokładają do niej
+ * zdarzenia o zmianach bezpośrednich podfolderów path, a przy recursive
+ * także o zmianach w całym jego poddrzewie. Zdarzenie trafia do kolejki,
+ * zanim zmieniający wyjdzie z folderu, więc zmiany jednego folderu
+ * przychodzą w kolejności ich wykonania. Obserwator przenosi się razem
+ * z folderem i znika razem z nim. Każdy folder liczy obserwatorów w swoim
+ * poddrzewie, więc dopóki w drzewie nie ma obserwatorów, jego zmiany
+ * kosztują tylko odczyt licznika w korzeniu, niezależnie od obserwatorów
+ * innych drzew. Zwraca 0, EINVAL, ENOENT
+ * lub EEXIST, gdy queue już obserwuje path.
+ */
+int tree_watch(Tree* tree, const char* path, bool recursive, WatchQueue* queue);
+
+/**
+ * Usuwa obserwatora zapisanego przez tree_watch. Zwraca 0, EINVAL
+ * lub ENOENT, gdy nie ma folderu albo obserwatora.
+ */
+int tree_unwatch(Tree* tree, const char* path, WatchQueue* queue);
+
+typedef enum TreeOpType {
+    TREE_OP_CREATE,
+    TREE_OP_REMOVE,
+    TREE_OP_MOVE
+} TreeOpType;
+
+typedef struct TreeOp {
+    TreeOpType type;
+    const char *path;    // dla TREE_OP_MOVE ścieżka źródłowa
+    const char *target;  // tylko dla TREE_OP_MOVE
+} TreeOp;
+
+/**
+ * Wykonuje n operacji, wpisując do results[i] wynik ops[i] z tymi samymi
+ * kodami, co tree_create, tree_remove i tree_move. Wyniki i końcowy stan
+ * drzewa są takie jak przy wykonaniu operacji po kolei w kolejności tablicy
+ * (jeśli nikt równolegle nie zmienia tych samych folderów - paczka nie jest
+ * atomowa, inne wątki mogą wykonywać swoje operacje pomiędzy jej
+ * operacjami). Tworzenia i usunięcia są grupowane po folderze rodzica:
+ * w jednej grupie rodzic jest zajmowany jako pisarz raz, a wspólne części
+ * ścieżek przechodzone raz i trzymane (co opóźnia pisarzy w tych folderach)
+ * aż do najbliższego przeniesienia. Kolejność jest zmieniana tylko między
+ * operacjami, które od siebie nie zależą. Przeniesienia są wykonywane
+ * osobno, w swoim miejscu ciągu. Zwraca liczbę operacji zakończonych błędem.
+ */
+int tree_batch(Tree* tree, const TreeOp* ops, size_t n, int* results);
+
+/**
+ * Transakcja: ciąg operacji wykonywany atomowo - inne wątki widzą drzewo
+ * albo sprzed wszystkich, albo po wszystkich.
+ */
+typedef struct TreeTxn TreeTxn;
+
+/**
+ * Zaczyna pustą transakcję na drzewie tree.
+ */
+TreeTxn* tree_txn_begin(Tree* tree);
+
+/**
+ * Dopisuje do transakcji n operacji (kopiując ścieżki) i zapamiętuje
+ * obecne wersje folderów, których podfoldery zmieniają (albo to, że ich
+ * nie ma). Zwraca 0 lub EINVAL, gdy transakcja była już wykonywana.
+ */
+int tree_txn_ops(TreeTxn* txn, const TreeOp* ops, size_t n);
+
+/**
+ * Zajmuje jako pisarz tylko foldery zmieniane przez transakcję, w stałej
+ * kolejności ścieżek, sprawdza, że nikt ich nie zmienił od tree_txn_ops,
+ * i wykonuje operacje po kolei, wpisując wyniki do results. Zwraca:
+ * 0, gdy wszystkie się udały; EAGAIN, gdy któryś folder się zmienił (nic
+ * nie zostało wykonane, wszystkie wyniki to EAGAIN); kod błędu pierwszej
+ * nieudanej operacji (ten sam co w tree_create, tree_remove i tree_move)
+ * - wtedy wykonane operacje są cofane, a pozostałe wyniki to ECANCELED;
+ * EINVAL (i wszystkie wyniki EINVAL), gdy transakcja była już wykonywana.
+ * Zajmowanie folderów jest ponawiane wewnątrz, ale konfliktu wersji nie
+ * ponawiamy: zapamiętane wersje opisują stan, na podstawie którego
+ * wołający wybrał operacje, więc po EAGAIN musi zwolnić transakcję,
+ * odczytać drzewo na nowo i zbudować nową (tree_txn_begin, tree_txn_ops).
+ */
+int tree_txn_commit(TreeTxn* txn, int* results);
+
+/**
+ * Zwalnia transakcję.
+ */
+void tree_txn_free(TreeTxn* txn);
+
+/**
+ * Migawka: spójny stan całego drzewa z chwili utworzenia, tylko do odczytu.
+ * Migawki dzielą foldery z drzewem i ze sobą nawzajem; zmiana folderu,
+ * który widzi żywa migawka, kopiuje tylko jego listę dzieci. Czytanie
+ * migawki nie bierze żadnych zamków ani nie czeka na zmiany drzewa, więc
+ * można ją czytać z wielu wątków naraz. Dawne listy dzieci i usunięte
+ * foldery, które widzą migawki, liczą się w tree_memory_stats. Migawki
+ * trzeba zwolnić przed zwolnieniem drzewa.
+ */
+typedef struct TreeSnapshot TreeSnapshot;
+
+/**
+ * Tworzy migawkę drzewa w czasie O(1), niczego nie kopiując. Nie wstrzymuje
+ * zmian drzewa, czeka tylko na zakończenie zmian już wykonywanych.
+ */
+TreeSnapshot* tree_snapshot(Tree* tree);
+
+/**
+ * Zwalnia migawkę oraz dawne listy dzieci i usunięte foldery, których
+ * nie widzi już żadna żywa migawka.
+ */
+void tree_snapshot_free(TreeSnapshot* snapshot);
+
+/**
+ * Jak tree_list, ale w stanie z migawki.
+ */
+char* tree_snapshot_list(TreeSnapshot* snapshot, const char* path);
+
+/**
+ * Jak tree_walk, ale w stanie z migawki. Wątki nie biorą żadnych zamków
+ * i nie szukają folderów od korzenia, więc visit jest wołana od razu po
+ * dojściu do folderu; inne wątki dostają część jego poddrzewa tylko wtedy,
+ * gdy same nie mają pracy. visit może zmieniać drzewo. Zwraca 0, EINVAL
+ * lub ENOENT.
+ */
+int tree_snapshot_walk(TreeSnapshot* snapshot, const char* path, TreeWalkFunction visit, void* ctx,
+                       size_t threads);
+
 //TODO romove
 char *make_path_to_lca(const char *path1, const char *path2);
\ No newline at end of file
@@ -0,0 +1,169 @@
+#include <malloc.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "arena.h"
+#include "node_sync.h"
+#include "err.h"
+
+// klasy co 16 bajtów do 256, potem potęgi dwójki do ARENA_MAX_SIZE
+#define SMALL_CLASSES 16
+#define N_CLASSES (SMALL_CLASSES + 8)
+
+typedef struct FreeObject FreeObject;
+struct FreeObject {
+    FreeObject *next;
+};
+
+typedef struct Chunk {
+    NodeMutex lock;      // chroni wszystko poniżej
+    char *bump;          // początek jeszcze nie wyciętej pamięci
+    char *end;
+    FreeObject *free[N_CLASSES];
+} Chunk;
+
+// obiekty zaczynają się za nagłówkiem, od granicy linii
+#define CHUNK_HEADER ((sizeof(Chunk) + 63) / 64 * 64)
+
+static pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;
+static ArenaStats totals;
+static bool hugetlb_failed;
+static _Thread_local Chunk *current;
+
+static size_t class_of(size_t size) {
+
+    if (size <= 256)
+        return size == 0 ? 0 : (size - 1) / 16;
+    size_t c = SMALL_CLASSES, class_size = 512;
+    while (class_size < size) {
+        class_size *= 2;
+        c++;
+    }
+    return c;
+}
+
+static size_t class_size(size_t c) {
+
+    return c < SMALL_CLASSES ? (c + 1) * 16 : (size_t) 512 << (c - SMALL_CLASSES);
+}
+
+static Chunk *chunk_of(const void *p) {
+
+    return (Chunk *) ((uintptr_t) p & ~(uintptr_t) (ARENA_CHUNK_SIZE - 1));
+}
+
+/**
+ * mapuje nowy kawałek wyrównany do ARENA_CHUNK_SIZE
+ */
+static Chunk *map_chunk(void) {
+
+    if (pthread_mutex_lock(&map_lock) != 0)
+        syserr("mutex lock failed");
+    char *p = MAP_FAILED;
+    bool huge = false;
+#ifdef MAP_HUGETLB
+    if (!hugetlb_failed) {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#ifdef MAP_HUGE_2MB
+        flags |= MAP_HUGE_2MB;
+#endif
+        p = mmap(NULL, ARENA_CHUNK_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+        huge = p != MAP_FAILED;
+        hugetlb_failed = !huge; // nie ma zarezerwowanych stron, nie próbujemy więcej
+    }
+#endif
+    if (!huge) {
+        // mapujemy dwa razy więcej i obcinamy do wyrównanego kawałka
+        p = mmap(NULL, 2 * ARENA_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            syserr("mmap failed");
+        char *aligned = (char *) chunk_of(p + ARENA_CHUNK_SIZE - 1);
+        if (aligned > p)
+            munmap(p, aligned - p);
+        munmap(aligned + ARENA_CHUNK_SIZE, p + ARENA_CHUNK_SIZE - aligned);
+        p = aligned;
+#ifdef MADV_HUGEPAGE
+        madvise(p, ARENA_CHUNK_SIZE, MADV_HUGEPAGE);
+#endif
+    }
+    totals.chunks++;
+    totals.huge_chunks += huge;
+    totals.bytes += ARENA_CHUNK_SIZE;
+    if (pthread_mutex_unlock(&map_lock) != 0)
+        syserr("mutex unlock failed");
+
+    Chunk *chunk = (Chunk *) p; // świeże mapowanie jest wyzerowane
+    node_mutex_init(&chunk->lock);
+    chunk->bump = p + CHUNK_HEADER;
+    chunk->end = p + ARENA_CHUNK_SIZE;
+    return chunk;
+}
+
+static void *chunk_alloc(Chunk *chunk, size_t c) {
+
+    node_mutex_lock(&chunk->lock);
+    void *p = chunk->free[c];
+    if (p)
+        chunk->free[c] = chunk->free[c]->next;
+    else if (chunk->end - chunk->bump >= (ptrdiff_t) class_size(c)) {
+        p = chunk->bump;
+        chunk->bump += class_size(c);
+    }
+    node_mutex_unlock(&chunk->lock);
+    return p;
+}
+
+void *arena_alloc_near(size_t size, const void *hint) {
+
+    if (size > ARENA_MAX_SIZE) {
+        void *p = malloc(size);
+        if (!p)
+            syserr("allocation failed");
+        return p;
+    }
+    size_t c = class_of(size);
+    void *p = NULL;
+    if (hint && (p = chunk_alloc(chunk_of(hint), c)))
+        return p;
+    if (current && (p = chunk_alloc(current, c)))
+        return p;
+    current = map_chunk();
+    return chunk_alloc(current, c);
+}
+
+void arena_free(void *p, size_t size) {
+
+    if (!p)
+        return;
+    if (size > ARENA_MAX_SIZE) {
+        free(p);
+        return;
+    }
+    Chunk *chunk = chunk_of(p);
+    FreeObject *object = p;
+    size_t c = class_of(size);
+    node_mutex_lock(&chunk->lock);
+    object->next = chunk->free[c];
+    chunk->free[c] = object;
+    node_mutex_unlock(&chunk->lock);
+}
+
+size_t arena_overhead(void *p, size_t size) {
+
+    if (!p)
+        return 0;
+    if (size > ARENA_MAX_SIZE)
+        return malloc_usable_size(p) - size + sizeof(size_t);
+    return class_size(class_of(size)) - size;
+}
+
+void arena_stats(ArenaStats *stats) {
+
+    if (pthread_mutex_lock(&map_lock) != 0)
+        syserr("mutex lock failed");
+    *stats = totals;
+    if (pthread_mutex_unlock(&map_lock) != 0)
+        syserr("mutex unlock failed");
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <stddef.h>
+
+/**
+ * Arena dla wierzchołków, map dzieci i ich wpisów (tryb TREE_ARENA).
+ * Pamięć pochodzi z 2MB, wyrównanych do 2MB kawałków z mmap: najpierw
+ * próbujemy jawnych dużych stron (MAP_HUGETLB), a gdy ich nie ma,
+ * zwykłego mapowania z MADV_HUGEPAGE. Każdy kawałek ma własne listy
+ * wolnych obiektów w klasach rozmiarów i wskaźnik do dalszego
+ * wycinania, więc obiekt można przydzielić obok wskazanego (np. dziecko
+ * obok rodzica), dopóki w jego kawałku jest miejsce. Pamięć kawałków
+ * nie wraca do systemu. Bloki większe niż ARENA_MAX_SIZE idą do malloc.
+ */
+
+#define ARENA_CHUNK_SIZE ((size_t) 2 << 20)
+
+// największy rozmiar przydzielany z kawałków
+#define ARENA_MAX_SIZE ((size_t) 64 << 10)
+
+typedef struct ArenaStats {
+    size_t chunks;       // liczba kawałków
+    size_t huge_chunks;  // kawałki na jawnych dużych stronach
+    size_t bytes;        // pamięć zmapowana na kawałki
+} ArenaStats;
+
+/**
+ * Przydziela size bajtów, jeśli się da, w tym samym kawałku co hint
+ * (hint może być NULL albo musi pochodzić z arena_alloc_near z rozmiarem
+ * nie większym niż ARENA_MAX_SIZE), wpp w kawałku bieżącego wątku.
+ */
+void *arena_alloc_near(size_t size, const void *hint);
+
+/**
+ * Zwalnia blok p przydzielony z rozmiarem size.
+ */
+void arena_free(void *p, size_t size);
+
+/**
+ * Bajty tracone przez blok p rozmiaru size (zaokrąglenie do klasy
+ * lub narzut malloc).
+ */
+size_t arena_overhead(void *p, size_t size);
+
+void arena_stats(ArenaStats *stats);
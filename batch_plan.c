@@ -0,0 +1,126 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "batch_plan.h"
+#include "err.h"
+
+/**
+ * zbiór przedrostków ścieżek rodziców z bieżącego segmentu, adresowany
+ * otwarcie; zamiast czyścić tablicę między segmentami zwiększamy
+ * segment, a wpisy ze starszych segmentów traktujemy jak puste
+ */
+typedef struct Slot {
+    uint64_t hash;
+    const char *prefix;
+    size_t len;
+    size_t segment; // 0 - nigdy nie użyty
+} Slot;
+
+typedef struct PrefixSet {
+    Slot *slots;
+    size_t mask;
+    size_t segment;
+} PrefixSet;
+
+static uint64_t hash_step(uint64_t hash, char c) {
+
+    return (hash ^ (unsigned char) c) * 0x100000001b3ull;
+}
+
+#define HASH_START 0xcbf29ce484222325ull
+
+/**
+ * zwraca slot z przedrostkiem albo pierwszy wolny slot na jego drodze
+ */
+static Slot *find_slot(PrefixSet *set, uint64_t hash, const char *prefix, size_t len) {
+
+    for (size_t i = hash & set->mask;; i = (i + 1) & set->mask) {
+        Slot *slot = &set->slots[i];
+        if (slot->segment != set->segment)
+            return slot;
+        if (slot->hash == hash && slot->len == len && !memcmp(slot->prefix, prefix, len))
+            return slot;
+    }
+}
+
+static bool contains(PrefixSet *set, const char *path, size_t len) {
+
+    uint64_t hash = HASH_START;
+    for (size_t i = 0; i < len; i++)
+        hash = hash_step(hash, path[i]);
+    return find_slot(set, hash, path, len)->segment == set->segment;
+}
+
+/**
+ * dodaje wszystkie przedrostki ścieżki rodzica kończące się na '/'
+ */
+static void add_prefixes(PrefixSet *set, const BatchEntry *entry) {
+
+    uint64_t hash = HASH_START;
+    for (size_t i = 0; i < entry->parent_len; i++) {
+        hash = hash_step(hash, entry->path[i]);
+        if (entry->path[i] == '/') {
+            Slot *slot = find_slot(set, hash, entry->path, i + 1);
+            slot->hash = hash;
+            slot->prefix = entry->path;
+            slot->len = i + 1;
+            slot->segment = set->segment;
+        }
+    }
+}
+
+size_t batch_parent_len(const char *path) {
+
+    size_t len = strlen(path);
+    size_t i = len - 1; // końcowy '/'
+    while (i > 0 && path[i - 1] != '/')
+        i--;
+    return i;
+}
+
+size_t batch_split(const BatchEntry *entries, size_t n, size_t *ends) {
+
+    size_t prefixes = 0;
+    for (size_t i = 0; i < n; i++)
+        for (size_t j = 0; j < entries[i].parent_len; j++)
+            prefixes += entries[i].path[j] == '/';
+    size_t capacity = 16;
+    while (capacity < 2 * prefixes)
+        capacity *= 2;
+    PrefixSet set = { calloc(capacity, sizeof(Slot)), capacity - 1, 1 };
+    if (!set.slots)
+        syserr("allocation failed");
+
+    size_t segments = 0;
+    for (size_t i = 0; i < n; i++) {
+        // folder tworzony lub usuwany przez entries[i] leży na ścieżce
+        // rodzica którejś wcześniejszej operacji z segmentu
+        if (contains(&set, entries[i].path, strlen(entries[i].path))) {
+            ends[segments++] = i;
+            set.segment++;
+        }
+        add_prefixes(&set, &entries[i]);
+    }
+    if (n > 0)
+        ends[segments++] = n;
+    free(set.slots);
+    return segments;
+}
+
+static int compare_entries(const void *a, const void *b) {
+
+    const BatchEntry *x = a, *y = b;
+    size_t len = x->parent_len < y->parent_len ? x->parent_len : y->parent_len;
+    int cmp = memcmp(x->path, y->path, len);
+    if (cmp == 0)
+        cmp = (x->parent_len > y->parent_len) - (x->parent_len < y->parent_len);
+    if (cmp == 0)
+        cmp = (x->index > y->index) - (x->index < y->index);
+    return cmp;
+}
+
+void batch_sort(BatchEntry *entries, size_t n) {
+
+    qsort(entries, n, sizeof(BatchEntry), compare_entries);
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <stddef.h>
+
+/**
+ * Planowanie tree_batch: operacje (tworzenie i usuwanie) grupuje się
+ * po ścieżce rodzica, żeby każdy folder brać jako pisarz raz na grupę.
+ * Posortowanie po ścieżce rodzica zachowuje wynik wykonania po kolei,
+ * chyba że późniejsza operacja tworzy lub usuwa folder leżący na ścieżce
+ * rodzica (albo będący rodzicem) wcześniejszej operacji: sortowanie
+ * wykonałoby ją przed tamtą. Przed każdą taką operacją zaczyna się
+ * więc nowy segment, a sortuje się tylko w obrębie segmentów.
+ */
+typedef struct BatchEntry {
+    const char *path;   // poprawna ścieżka różna od "/"
+    size_t parent_len;  // długość przedrostka path będącego ścieżką rodzica
+    size_t index;       // numer operacji w tablicy
+} BatchEntry;
+
+/**
+ * Długość ścieżki rodzica będącej przedrostkiem path.
+ */
+size_t batch_parent_len(const char *path);
+
+/**
+ * Dzieli entries (w kolejności operacji) na segmenty; do ends wpisuje
+ * końce kolejnych segmentów (ostatni to n) i zwraca ich liczbę.
+ * ends musi mieć miejsce na n liczb.
+ */
+size_t batch_split(const BatchEntry *entries, size_t n, size_t *ends);
+
+/**
+ * Sortuje stabilnie entries po ścieżce rodzica; przodkowie są przed
+ * potomkami.
+ */
+void batch_sort(BatchEntry *entries, size_t n);
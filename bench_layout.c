@@ -0,0 +1,87 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "Tree.h"
+
+/**
+ * Współdzielenie linii pamięci podręcznej przez górne wierzchołki.
+ * Wszystkie wątki przechodzą przez korzeń i katalogi najwyższego poziomu,
+ * zmieniając ich liczniki, i czytają ich mapy dzieci. Drzewo ma 16 katalogów
+ * po 16 podkatalogów. Każdy z 1, 2, 4, ... threads wątków wykonuje ops
+ * operacji: w 90% tree_list_into na losowym podkatalogu, w 10% tree_create
+ * lub tree_remove pod nim. Ten sam plik jest budowany jako bench_layout
+ * (z domyślnym TREE_HOT_DEPTH) i bench_layout_flat (TREE_HOT_DEPTH=0, bez
+ * wyrównywania), a linie z konfliktami (HITM) pokazuje np.
+ * perf c2c record ./bench_layout; perf c2c report.
+ * Użycie: bench_layout [wątki] [operacje na wątek]
+ */
+
+#define DIRS 16
+
+#ifndef TREE_HOT_DEPTH
+#define TREE_HOT_DEPTH 2
+#endif
+
+static Tree *tree;
+static long ops;
+
+static double now(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *worker(void *arg) {
+
+    unsigned seed = (unsigned) (size_t) arg;
+    char path[16], listing[64];
+    for (long i = 0; i < ops; i++) {
+        int dir = rand_r(&seed) % (DIRS * DIRS);
+        int op = rand_r(&seed) % 20;
+        if (op < 18) {
+            sprintf(path, "/%c/%c/", 'a' + dir / DIRS, 'a' + dir % DIRS);
+            tree_list_into(tree, path, listing, sizeof(listing), NULL);
+        } else {
+            sprintf(path, "/%c/%c/%c/", 'a' + dir / DIRS, 'a' + dir % DIRS, 'a' + rand_r(&seed) % 4);
+            if (op == 18)
+                tree_create(tree, path);
+            else
+                tree_remove(tree, path);
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+
+    int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+    ops = argc > 2 ? atol(argv[2]) : 200000;
+
+    tree = tree_new();
+    char path[16];
+    for (int d = 0; d < DIRS; d++) {
+        sprintf(path, "/%c/", 'a' + d);
+        tree_create(tree, path);
+        for (int e = 0; e < DIRS; e++) {
+            sprintf(path, "/%c/%c/", 'a' + d, 'a' + e);
+            tree_create(tree, path);
+        }
+    }
+
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        pthread_t th[threads];
+        double start = now();
+        for (int i = 0; i < threads; i++)
+            pthread_create(&th[i], NULL, worker, (void *) (size_t) (i + 1));
+        for (int i = 0; i < threads; i++)
+            pthread_join(th[i], NULL);
+        double elapsed = now() - start;
+        printf("{\"hot_depth\": %d, \"threads\": %d, \"ops_per_sec\": %.0f}\n",
+               TREE_HOT_DEPTH, threads, ops * threads / elapsed);
+    }
+    tree_free(tree);
+    return 0;
+}
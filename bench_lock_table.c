@@ -0,0 +1,129 @@
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Tree.h"
+
+/**
+ * Pamięć na wierzchołek i przepustowość w zależności od liczby pasków
+ * tablicy zamków. Dla każdego rozmiaru tablicy osobny proces (tablicę
+ * można ustawić tylko przed pierwszym drzewem) buduje drzewo z 100
+ * folderami po nodes / 100 podfolderów, po czym threads wątków wykonuje
+ * losowo tree_list, tree_create i tree_remove pod losowymi folderami.
+ * Zbudowane bez TREE_LOCK_TABLE mierzy wariant z zamkami w wierzchołkach.
+ * Użycie: bench_lock_table [wierzchołki] [wątki] [operacje na wątek] [rozmiary...]
+ */
+
+#define TOP_DIRS 100
+
+static Tree *tree;
+static long ops_per_thread;
+
+static double now(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void name_path(char *buf, int dir, long child) {
+
+    char name[16];
+    int len = 0;
+    do {
+        name[len++] = 'a' + child % 26;
+        child /= 26;
+    } while (child);
+    name[len] = '\0';
+    if (dir < 0)
+        sprintf(buf, "/%s/", name);
+    else
+        sprintf(buf, "/d%c%c/%s/", 'a' + dir / 26, 'a' + dir % 26, name);
+}
+
+static void *worker(void *arg) {
+
+    unsigned seed = (unsigned) (size_t) arg;
+    char path[64];
+    for (long i = 0; i < ops_per_thread; i++) {
+        int dir = rand_r(&seed) % TOP_DIRS;
+        int op = rand_r(&seed) % 4;
+        if (op == 0) {
+            sprintf(path, "/d%c%c/", 'a' + dir / 26, 'a' + dir % 26);
+            char listing[16];
+            tree_list_into(tree, path, listing, sizeof(listing), NULL);
+        } else {
+            name_path(path, dir, 1000000 + rand_r(&seed) % 1000);
+            if (op == 1)
+                tree_create(tree, path);
+            else
+                tree_remove(tree, path);
+        }
+    }
+    return NULL;
+}
+
+static void run(size_t table_size, long nodes, int threads) {
+
+    int err = tree_set_lock_table_size(table_size);
+    if (err == EBUSY)
+        fprintf(stderr, "lock table already in use\n");
+
+    size_t before = mallinfo2().uordblks;
+    tree = tree_new();
+    char path[64];
+    for (int d = 0; d < TOP_DIRS; d++) {
+        sprintf(path, "/d%c%c/", 'a' + d / 26, 'a' + d % 26);
+        tree_create(tree, path);
+        for (long c = 0; c < nodes / TOP_DIRS; c++) {
+            name_path(path, d, c);
+            tree_create(tree, path);
+        }
+    }
+    size_t after = mallinfo2().uordblks;
+
+    pthread_t th[threads];
+    double start = now();
+    for (int i = 0; i < threads; i++)
+        pthread_create(&th[i], NULL, worker, (void *) (size_t) (i + 1));
+    for (int i = 0; i < threads; i++)
+        pthread_join(th[i], NULL);
+    double elapsed = now() - start;
+
+    printf("{\"lock_table\": %s, \"table_size\": %zu, \"nodes\": %ld, \"bytes_per_node\": %.1f, "
+           "\"threads\": %d, \"ops_per_sec\": %.0f}\n",
+           err == ENOTSUP ? "false" : "true", err == ENOTSUP ? 0 : table_size, nodes,
+           (double) (after - before) / (nodes + TOP_DIRS + 1), threads,
+           ops_per_thread * threads / elapsed);
+    tree_free(tree);
+}
+
+int main(int argc, char **argv) {
+
+    long nodes = argc > 1 ? atol(argv[1]) : 200000;
+    int threads = argc > 2 ? atoi(argv[2]) : 4;
+    ops_per_thread = argc > 3 ? atol(argv[3]) : 200000;
+    size_t default_sizes[] = { 64, 256, 1024, 4096, 16384 };
+    int n_sizes = argc > 4 ? argc - 4 : 5;
+
+    for (int i = 0; i < n_sizes; i++) {
+        size_t size = argc > 4 ? strtoul(argv[4 + i], NULL, 10) : default_sizes[i];
+        fflush(stdout);
+        pid_t pid = fork();
+        if (pid == 0) {
+            run(size, nodes, threads);
+            fflush(stdout);
+            _exit(0);
+        }
+        waitpid(pid, NULL, 0);
+        if (tree_set_lock_table_size(size) == ENOTSUP)
+            break; // rozmiar tablicy nie ma znaczenia
+    }
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "path_utils.h"
+
+/**
+ * Porównuje sortowanie nazw podfolderów przez qsort ze strcmp
+ * (tak jak wcześniej make_map_contents_array) z sortowaniem
+ * pozycyjnym spakowanych nazw sort_packed_names.
+ * Użycie: bench_sort [liczba nazw] [maks. długość nazwy] [powtórzenia]
+ */
+
+static double now(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_string_pointers(const void *p1, const void *p2) {
+
+    return strcmp(*(const char **) p1, *(const char **) p2);
+}
+
+int main(int argc, char **argv) {
+
+    size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 200000;
+    size_t max_len = argc > 2 ? strtoul(argv[2], NULL, 10) : 12;
+    int reps = argc > 3 ? atoi(argv[3]) : 5;
+    if (max_len < 1 || max_len > MAX_FOLDER_NAME_LENGTH)
+        max_len = 12;
+
+    srand(2137);
+    char **names = malloc(n * sizeof(char *));
+    for (size_t i = 0; i < n; i++) {
+        size_t len = 1 + rand() % max_len;
+        names[i] = malloc(len + 1);
+        for (size_t j = 0; j < len; j++)
+            names[i][j] = 'a' + rand() % 26;
+        names[i][len] = '\0';
+    }
+
+    PackedName **packed = malloc(n * sizeof(PackedName *));
+    for (size_t i = 0; i < n; i++) {
+        size_t len = strlen(names[i]);
+        packed[i] = malloc(packed_name_size(len));
+        packed_name_encode(packed[i], names[i], len);
+    }
+
+    char **pointers = malloc(n * sizeof(char *));
+    const PackedName **views = malloc(n * sizeof(PackedName *));
+    const PackedName **aux = malloc(n * sizeof(PackedName *));
+    double best_qsort = 1e9, best_radix = 1e9;
+    for (int r = 0; r < reps; r++) {
+        memcpy(pointers, names, n * sizeof(char *));
+        double start = now();
+        qsort(pointers, n, sizeof(char *), compare_string_pointers);
+        double t = now() - start;
+        if (t < best_qsort)
+            best_qsort = t;
+
+        memcpy(views, packed, n * sizeof(PackedName *));
+        start = now();
+        sort_packed_names(views, aux, n);
+        t = now() - start;
+        if (t < best_radix)
+            best_radix = t;
+    }
+
+    char decoded[PACKED_NAME_MAX_LENGTH + 1];
+    for (size_t i = 0; i < n; i++) {
+        packed_name_decode(views[i], decoded);
+        if (strcmp(pointers[i], decoded) != 0) {
+            fprintf(stderr, "sort mismatch at %zu\n", i);
+            return 1;
+        }
+    }
+
+    printf("{\"n\": %zu, \"max_len\": %zu, \"qsort_ms\": %.3f, \"radix_ms\": %.3f, \"speedup\": %.2f}\n",
+           n, max_len, best_qsort * 1e3, best_radix * 1e3, best_qsort / best_radix);
+
+    for (size_t i = 0; i < n; i++) {
+        free(names[i]);
+        free(packed[i]);
+    }
+    free(names);
+    free(packed);
+    free(pointers);
+    free(views);
+    free(aux);
+    return 0;
+}
@@ -0,0 +1,164 @@
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Tree.h"
+#ifdef TREE_ARENA
+#include "arena.h"
+#endif
+
+/**
+ * Chybienia dTLB przy wyszukiwaniu w dużym drzewie. Buduje drzewo
+ * głębokości 4 o około nodes wierzchołkach, tworząc każdy poziom
+ * w losowej kolejności (dzieci jednego rodzica nie powstają po kolei),
+ * po czym wykonuje lookups razy tree_list_into na losowym liściu
+ * i liczy dostępy i chybienia dTLB licznikami perf. Ten sam plik jest
+ * budowany jako bench_tlb (malloc i pula) i bench_tlb_arena (TREE_ARENA).
+ * Bez dostępu do liczników (perf_event_paranoid) wypisuje null.
+ * Użycie: bench_tlb [wierzchołki] [wyszukiwania]
+ */
+
+#define LEVELS 4
+
+static int fanout;
+
+static double now(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int perf_open(uint64_t config) {
+
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t dtlb_config(uint64_t result) {
+
+    return PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+}
+
+/**
+ * ścieżka do wierzchołka o numerze index na poziomie depth
+ * (cyfry index w systemie o podstawie fanout to kolejne składowe)
+ */
+static void make_path(char *buf, long index, int depth) {
+
+    int digits[LEVELS];
+    for (int d = depth - 1; d >= 0; d--) {
+        digits[d] = index % fanout;
+        index /= fanout;
+    }
+    char *p = buf;
+    *p++ = '/';
+    for (int d = 0; d < depth; d++) {
+        *p++ = 'a' + digits[d] / 26;
+        *p++ = 'a' + digits[d] % 26;
+        *p++ = '/';
+    }
+    *p = '\0';
+}
+
+static void shuffle(long *items, long n, unsigned *seed) {
+
+    for (long i = n - 1; i > 0; i--) {
+        long j = rand_r(seed) % (i + 1);
+        long t = items[i];
+        items[i] = items[j];
+        items[j] = t;
+    }
+}
+
+static void print_count(const char *name, int fd, uint64_t value) {
+
+    if (fd < 0)
+        printf("\"%s\": null, ", name);
+    else
+        printf("\"%s\": %lu, ", name, (unsigned long) value);
+}
+
+int main(int argc, char **argv) {
+
+    long nodes = argc > 1 ? atol(argv[1]) : 2000000;
+    long lookups = argc > 2 ? atol(argv[2]) : 2000000;
+    fanout = 2;
+    while ((long) fanout * fanout * fanout * fanout < nodes && fanout < 26 * 26)
+        fanout++;
+
+    unsigned seed = 1;
+    Tree *tree = tree_new();
+    long level_size = 1, total = 0;
+    char path[4 * LEVELS + 2];
+    for (int depth = 1; depth <= LEVELS; depth++) {
+        level_size *= fanout;
+        long *order = malloc(level_size * sizeof(long));
+        for (long i = 0; i < level_size; i++)
+            order[i] = i;
+        shuffle(order, level_size, &seed);
+        for (long i = 0; i < level_size; i++) {
+            make_path(path, order[i], depth);
+            tree_create(tree, path);
+        }
+        total += level_size;
+        free(order);
+    }
+
+    int loads_fd = perf_open(dtlb_config(PERF_COUNT_HW_CACHE_RESULT_ACCESS));
+    int misses_fd = perf_open(dtlb_config(PERF_COUNT_HW_CACHE_RESULT_MISS));
+    int fds[] = { loads_fd, misses_fd };
+    for (int i = 0; i < 2; i++)
+        if (fds[i] >= 0) {
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+
+    double start = now();
+    char listing[8];
+    for (long i = 0; i < lookups; i++) {
+        make_path(path, rand_r(&seed) % level_size, LEVELS);
+        tree_list_into(tree, path, listing, sizeof(listing), NULL);
+    }
+    double elapsed = now() - start;
+
+    uint64_t counts[2] = { 0, 0 };
+    for (int i = 0; i < 2; i++)
+        if (fds[i] >= 0) {
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fds[i], &counts[i], sizeof(uint64_t)) != sizeof(uint64_t))
+                counts[i] = 0;
+            close(fds[i]);
+        }
+
+#ifdef TREE_ARENA
+    ArenaStats arena;
+    arena_stats(&arena);
+    printf("{\"arena\": true, \"chunks\": %zu, \"huge_chunks\": %zu, ", arena.chunks, arena.huge_chunks);
+#else
+    printf("{\"arena\": false, ");
+#endif
+    printf("\"nodes\": %ld, \"lookups\": %ld, \"seconds\": %.3f, ", total + 1, lookups, elapsed);
+    print_count("dtlb_loads", loads_fd, counts[0]);
+    print_count("dtlb_misses", misses_fd, counts[1]);
+    if (loads_fd >= 0 && misses_fd >= 0 && counts[0] > 0)
+        printf("\"miss_rate\": %.5f}\n", (double) counts[1] / counts[0]);
+    else
+        printf("\"miss_rate\": null}\n");
+
+    tree_free(tree);
+    return 0;
+}
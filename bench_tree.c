@@ -0,0 +1,332 @@
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "Tree.h"
+
+/**
+ * Przepustowość i opóźnienia tree_create, tree_remove, tree_move
+ * i tree_list z wielu wątków. Drzewo jest pełne: depth poziomów po fanout
+ * podfolderów. Każda operacja wybiera folder na przedostatnim poziomie
+ * (rozkładem jednostajnym albo Zipfa, wtedy numer 0 jest najczęstszy)
+ * i w nim liść o losowej nazwie z 2 * fanout możliwych, więc tworzenia
+ * i usunięcia udają się mniej więcej w połowie; przeniesienie zabiera liść
+ * z jednego wylosowanego folderu do drugiego. Opóźnienie każdej operacji
+ * trafia do histogramu wątku (kubełki logarytmiczne z 32 podziałami na
+ * potęgę dwójki, więc percentyle mają dokładność ok. 3%). Wynik to jeden
+ * obiekt JSON na standardowym wyjściu.
+ * Użycie: bench_tree [-t wątki] [-s sekundy] [-D głębokość] [-f rozgałęzienie]
+ *                    [-m create,remove,move,list] [-z wykładnik Zipfa, 0 - jednostajnie]
+ */
+
+enum { OP_CREATE, OP_REMOVE, OP_MOVE, OP_LIST, N_OPS };
+
+static const char *op_names[N_OPS] = { "create", "remove", "move", "list" };
+
+#define SUB_BUCKETS 32
+#define EXACT 64 // opóźnienia poniżej są liczone co do nanosekundy
+#define N_BUCKETS (EXACT + (64 - 6) * SUB_BUCKETS)
+
+typedef struct Histogram {
+    uint64_t counts[N_BUCKETS];
+    uint64_t ops, errors;
+} Histogram;
+
+typedef struct Worker {
+    pthread_t thread;
+    uint64_t seed;
+    Histogram hist[N_OPS];
+} Worker;
+
+static Tree *tree;
+static int depth = 3, fanout = 16;
+static unsigned mix[N_OPS] = { 20, 20, 10, 50 };
+static double skew = 0;
+static size_t n_parents;  // foldery na przedostatnim poziomie
+static double *zipf_cdf;  // dla skew > 0
+static atomic_bool stop;
+
+static uint64_t now_ns(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t next_random(uint64_t *state) {
+
+    // xorshift64*
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+static size_t bucket_of(uint64_t ns) {
+
+    if (ns < EXACT)
+        return ns;
+    int e = 63 - __builtin_clzll(ns); // e >= 6
+    return EXACT + (e - 6) * SUB_BUCKETS + ((ns >> (e - 5)) & (SUB_BUCKETS - 1));
+}
+
+/**
+ * środek przedziału opóźnień kubełka
+ */
+static double bucket_value(size_t b) {
+
+    if (b < EXACT)
+        return b;
+    int e = (b - EXACT) / SUB_BUCKETS + 6;
+    uint64_t low = (uint64_t) (SUB_BUCKETS + (b - EXACT) % SUB_BUCKETS) << (e - 5);
+    return low + ((uint64_t) 1 << (e - 5)) / 2.0;
+}
+
+static double percentile(const Histogram *hist, double p) {
+
+    uint64_t rank = (uint64_t) ceil(p * hist->ops);
+    uint64_t seen = 0;
+    for (size_t b = 0; b < N_BUCKETS; b++) {
+        seen += hist->counts[b];
+        if (seen >= rank && seen > 0)
+            return bucket_value(b);
+    }
+    return 0;
+}
+
+/**
+ * ścieżka folderu o numerze index na poziomie level (1 - katalogi
+ * najwyższego poziomu), zakończona '/'; zwraca jej długość
+ */
+static size_t folder_path(char *buf, int level, size_t index) {
+
+    size_t digits[level > 0 ? level : 1];
+    for (int l = level - 1; l >= 0; l--) {
+        digits[l] = index % fanout;
+        index /= fanout;
+    }
+    size_t len = 0;
+    buf[len++] = '/';
+    for (int l = 0; l < level; l++) {
+        size_t d = digits[l];
+        do {
+            buf[len++] = 'a' + d % 26;
+            d /= 26;
+        } while (d);
+        buf[len++] = '/';
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+static size_t pick_parent(uint64_t *seed) {
+
+    if (skew <= 0)
+        return next_random(seed) % n_parents;
+    double u = (next_random(seed) >> 11) * 0x1.0p-53;
+    size_t low = 0, high = n_parents - 1;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (zipf_cdf[mid] < u)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+/**
+ * ścieżka losowego liścia (istniejącego lub nie) pod wylosowanym folderem
+ */
+static void leaf_path(char *buf, uint64_t *seed) {
+
+    size_t len = folder_path(buf, depth - 1, pick_parent(seed));
+    size_t name = next_random(seed) % (2 * fanout);
+    do {
+        buf[len++] = 'a' + name % 26;
+        name /= 26;
+    } while (name);
+    buf[len++] = '/';
+    buf[len] = '\0';
+}
+
+static int pick_op(uint64_t *seed) {
+
+    unsigned total = 0;
+    for (int op = 0; op < N_OPS; op++)
+        total += mix[op];
+    unsigned r = next_random(seed) % total;
+    int op = 0;
+    while (r >= mix[op])
+        r -= mix[op++];
+    return op;
+}
+
+static void *work(void *arg) {
+
+    Worker *worker = arg;
+    char path[256], target[256];
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        int op = pick_op(&worker->seed);
+        int err = 0;
+        uint64_t start;
+        switch (op) {
+            case OP_CREATE:
+                leaf_path(path, &worker->seed);
+                start = now_ns();
+                err = tree_create(tree, path);
+                break;
+            case OP_REMOVE:
+                leaf_path(path, &worker->seed);
+                start = now_ns();
+                err = tree_remove(tree, path);
+                break;
+            case OP_MOVE:
+                leaf_path(path, &worker->seed);
+                leaf_path(target, &worker->seed);
+                start = now_ns();
+                err = tree_move(tree, path, target);
+                break;
+            default: {
+                folder_path(path, depth - 1, pick_parent(&worker->seed));
+                start = now_ns();
+                char *listing = tree_list(tree, path);
+                err = listing ? 0 : ENOENT;
+                free(listing);
+                break;
+            }
+        }
+        uint64_t elapsed = now_ns() - start;
+        Histogram *hist = &worker->hist[op];
+        hist->counts[bucket_of(elapsed)]++;
+        hist->ops++;
+        hist->errors += err != 0;
+    }
+    return NULL;
+}
+
+static void build_tree(void) {
+
+    char path[256];
+    size_t count = 1;
+    for (int level = 1; level <= depth; level++) {
+        count *= fanout;
+        for (size_t i = 0; i < count; i++) {
+            folder_path(path, level, i);
+            tree_create(tree, path);
+        }
+    }
+}
+
+static bool parse_mix(const char *arg) {
+
+    for (int op = 0; op < N_OPS; op++) {
+        char *end;
+        mix[op] = strtoul(arg, &end, 10);
+        if (end == arg || (op < N_OPS - 1 && *end != ','))
+            return false;
+        arg = end + 1;
+    }
+    return mix[OP_CREATE] + mix[OP_REMOVE] + mix[OP_MOVE] + mix[OP_LIST] > 0;
+}
+
+int main(int argc, char **argv) {
+
+    int threads = 4;
+    double seconds = 2;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:s:D:f:m:z:")) != -1) {
+        switch (opt) {
+            case 't': threads = atoi(optarg); break;
+            case 's': seconds = atof(optarg); break;
+            case 'D': depth = atoi(optarg); break;
+            case 'f': fanout = atoi(optarg); break;
+            case 'z': skew = atof(optarg); break;
+            case 'm':
+                if (parse_mix(optarg))
+                    break;
+                // fall through
+            default:
+                fprintf(stderr, "usage: %s [-t threads] [-s seconds] [-D depth] [-f fanout] "
+                                "[-m create,remove,move,list] [-z zipf_skew]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (threads < 1 || depth < 1 || depth > 8 || fanout < 1 || pow(fanout, depth) > 1e7) {
+        fprintf(stderr, "need threads >= 1, 1 <= depth <= 8, fanout >= 1 and at most 1e7 leaves\n");
+        return 1;
+    }
+
+    n_parents = 1;
+    for (int level = 1; level < depth; level++)
+        n_parents *= fanout;
+    if (skew > 0) {
+        zipf_cdf = malloc(n_parents * sizeof(double));
+        double sum = 0;
+        for (size_t i = 0; i < n_parents; i++)
+            zipf_cdf[i] = sum += 1 / pow(i + 1, skew);
+        for (size_t i = 0; i < n_parents; i++)
+            zipf_cdf[i] /= sum;
+    }
+
+    tree = tree_new();
+    build_tree();
+
+    Worker *workers = calloc(threads, sizeof(Worker));
+    if (!workers)
+        return 1;
+    uint64_t begin = now_ns();
+    for (int i = 0; i < threads; i++) {
+        workers[i].seed = 0x9E3779B97F4A7C15ull * (i + 1);
+        pthread_create(&workers[i].thread, NULL, work, &workers[i]);
+    }
+    usleep((useconds_t) (seconds * 1e6));
+    atomic_store(&stop, true);
+    for (int i = 0; i < threads; i++)
+        pthread_join(workers[i].thread, NULL);
+    double elapsed = (now_ns() - begin) * 1e-9;
+
+    Histogram total[N_OPS];
+    memset(total, 0, sizeof(total));
+    uint64_t all_ops = 0;
+    for (int i = 0; i < threads; i++) {
+        for (int op = 0; op < N_OPS; op++) {
+            for (size_t b = 0; b < N_BUCKETS; b++)
+                total[op].counts[b] += workers[i].hist[op].counts[b];
+            total[op].ops += workers[i].hist[op].ops;
+            total[op].errors += workers[i].hist[op].errors;
+        }
+    }
+    for (int op = 0; op < N_OPS; op++)
+        all_ops += total[op].ops;
+
+    printf("{\"threads\": %d, \"seconds\": %.3f, \"depth\": %d, \"fanout\": %d, "
+           "\"distribution\": \"%s\", \"zipf_skew\": %g, "
+           "\"mix\": {\"create\": %u, \"remove\": %u, \"move\": %u, \"list\": %u}, "
+           "\"ops_per_sec\": %.0f, \"ops\": {",
+           threads, elapsed, depth, fanout, skew > 0 ? "zipf" : "uniform", skew,
+           mix[OP_CREATE], mix[OP_REMOVE], mix[OP_MOVE], mix[OP_LIST], all_ops / elapsed);
+    for (int op = 0; op < N_OPS; op++) {
+        printf("%s\"%s\": {\"count\": %llu, \"errors\": %llu, \"ops_per_sec\": %.0f, "
+               "\"p50_ns\": %.0f, \"p99_ns\": %.0f, \"p999_ns\": %.0f}",
+               op ? ", " : "", op_names[op], (unsigned long long) total[op].ops,
+               (unsigned long long) total[op].errors, total[op].ops / elapsed,
+               percentile(&total[op], 0.5), percentile(&total[op], 0.99), percentile(&total[op], 0.999));
+    }
+    printf("}}\n");
+
+    tree_free(tree);
+    free(workers);
+    free(zipf_cdf);
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "lock_table.h"
+#include "err.h"
+
+static LockStripe *stripes;
+static size_t n_stripes = LOCK_TABLE_DEFAULT_SIZE;
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t configure_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool table_used;
+
+static void make_table(void) {
+
+    if (pthread_mutex_lock(&configure_lock) != 0)
+        syserr("mutex lock failed");
+    table_used = true;
+    if (pthread_mutex_unlock(&configure_lock) != 0)
+        syserr("mutex unlock failed");
+
+    stripes = aligned_alloc(_Alignof(LockStripe), n_stripes * sizeof(LockStripe));
+    if (!stripes)
+        syserr("allocation failed");
+    for (size_t i = 0; i < n_stripes; i++) {
+        node_mutex_init(&stripes[i].lock);
+        node_cond_init(&stripes[i].readers);
+        node_cond_init(&stripes[i].writers);
+    }
+}
+
+bool lock_table_configure(size_t size) {
+
+    if (pthread_mutex_lock(&configure_lock) != 0)
+        syserr("mutex lock failed");
+    bool ok = !table_used;
+    if (ok) {
+        n_stripes = 1;
+        while (n_stripes < size)
+            n_stripes *= 2;
+    }
+    if (pthread_mutex_unlock(&configure_lock) != 0)
+        syserr("mutex unlock failed");
+    return ok;
+}
+
+size_t lock_table_size(void) {
+
+    pthread_once(&table_once, make_table);
+    return n_stripes;
+}
+
+LockStripe *lock_table_stripe(const void *owner) {
+
+    pthread_once(&table_once, make_table);
+    // wierzchołki leżą co kilkadziesiąt bajtów, więc mieszamy wszystkie bity adresu
+    uint64_t h = (uintptr_t) owner * 0x9E3779B97F4A7C15ull;
+    return &stripes[(h >> 32) & (n_stripes - 1)];
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <stddef.h>
+#include "node_sync.h"
+
+/**
+ * Tablica zamków wspólna dla wszystkich wierzchołków (tryb TREE_LOCK_TABLE).
+ * Wierzchołek nie ma własnego zamka ani zmiennych warunkowych, tylko
+ * liczniki; synchronizuje się na pasku tablicy wybranym przez hasz
+ * adresu wierzchołka. Wierzchołki dzielące pasek mogą sobie nawzajem
+ * niepotrzebnie przeszkadzać, za to pamięć nie rośnie z liczbą wierzchołków.
+ * Każdy pasek zajmuje osobną linię pamięci podręcznej.
+ */
+typedef struct LockStripe {
+    _Alignas(64) NodeMutex lock;
+    NodeCond readers;
+    NodeCond writers;
+} LockStripe;
+
+// domyślna liczba pasków
+#define LOCK_TABLE_DEFAULT_SIZE 4096
+
+/**
+ * Ustala liczbę pasków (zaokrągloną w górę do potęgi dwójki).
+ * Działa tylko przed pierwszym użyciem tablicy, wpp zwraca false.
+ */
+bool lock_table_configure(size_t size);
+
+/**
+ * Zwraca liczbę pasków, tworząc tablicę, jeśli jeszcze jej nie ma.
+ */
+size_t lock_table_size(void);
+
+/**
+ * Zwraca pasek dla obiektu pod adresem owner.
+ */
+LockStripe *lock_table_stripe(const void *owner);
@@ -1,4 +1,6 @@
 #include "HashMap.h"
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,16 +13,191 @@
 #include <sys/errno.h>
 
 void print_map(HashMap* map) {
-    const char* key = NULL;
+    const PackedName* key = NULL;
     void* value = NULL;
+    char name[PACKED_NAME_MAX_LENGTH + 1];
     printf("Size=%zd\n", hmap_size(map));
     HashMapIterator it = hmap_iterator(map);
     while (hmap_next(map, &it, &key, &value)) {
-        printf("Key=%s Value=%p\n", key, value);
+        packed_name_decode(key, name);
+        printf("Key=%s Value=%p\n", name, value);
     }
     printf("\n");
 }
 
+typedef struct WalkCount {
+    atomic_size_t folders;
+    atomic_size_t depth_sum; // suma liczby '/' w ścieżkach
+} WalkCount;
+
+static void count_folder(const char* path, void* ctx) {
+    WalkCount* count = ctx;
+    size_t slashes = 0;
+    for (; *path; path++)
+        slashes += *path == '/';
+    atomic_fetch_add(&count->folders, 1);
+    atomic_fetch_add(&count->depth_sum, slashes - 1);
+}
+
+typedef struct WalkRemove {
+    Tree* tree;
+    atomic_size_t removed;
+} WalkRemove;
+
+static void remove_leaf(const char* path, void* ctx) {
+    WalkRemove* leaves = ctx;
+    if (tree_remove(leaves->tree, path) == 0)
+        atomic_fetch_add(&leaves->removed, 1);
+}
+
+// Ścieżki zebrane przez visit z wielu wątków.
+typedef struct PathSet {
+    pthread_mutex_t lock;
+    char** paths;
+    size_t count, capacity;
+} PathSet;
+
+static void collect_path(const char* path, void* ctx) {
+    PathSet* set = ctx;
+    pthread_mutex_lock(&set->lock);
+    if (set->count == set->capacity) {
+        set->capacity = set->capacity ? 2 * set->capacity : 64;
+        set->paths = realloc(set->paths, set->capacity * sizeof(char*));
+        assert(set->paths);
+    }
+    set->paths[set->count++] = strdup(path);
+    pthread_mutex_unlock(&set->lock);
+}
+
+static int compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static void clear_paths(PathSet* set) {
+    for (size_t i = 0; i < set->count; i++)
+        free(set->paths[i]);
+    set->count = 0;
+}
+
+// Wątek wykonujący CHURN_OPS losowych zmian. Przenosi tylko na tę samą
+// głębokość, więc drzewo nie rośnie w głąb.
+#define CHURN_OPS 20000
+
+typedef struct Churn {
+    Tree* tree;
+    unsigned seed;
+    atomic_int* running;
+} Churn;
+
+static void random_path(char* path, int depth, unsigned* seed) {
+    for (int d = 0; d < depth; d++) {
+        *path++ = '/';
+        *path++ = 'a' + rand_r(seed) % 3;
+    }
+    *path++ = '/';
+    *path = '\0';
+}
+
+static void* churn_tree(void* arg) {
+    Churn* churn = arg;
+    char a[16], b[16];
+    for (int i = 0; i < CHURN_OPS; i++) {
+        int depth = 1 + rand_r(&churn->seed) % 3;
+        random_path(a, depth, &churn->seed);
+        random_path(b, depth, &churn->seed);
+        switch (rand_r(&churn->seed) % 3) {
+        case 0: tree_create(churn->tree, a); break;
+        case 1: tree_remove(churn->tree, a); break;
+        default: tree_move(churn->tree, a, b); break;
+        }
+    }
+    atomic_fetch_sub(churn->running, 1);
+    return NULL;
+}
+
+// Wątek transakcji przenoszących własne foldery między wspólnymi
+// rodzicami; loc zapamiętuje, gdzie są po udanych transakcjach. Co czwarta
+// transakcja kończy się błędem i jest cofana.
+#define TXN_ROUNDS 3000
+#define TXN_THREADS 6
+#define TXN_TOKENS 8
+
+static const char* txn_parents[] = { "/a/", "/b/", "/c/", "/a/d/" };
+
+typedef struct TxnWorker {
+    Tree* tree;
+    pthread_barrier_t* start;
+    int id;
+    unsigned seed;
+    int loc[TXN_TOKENS];
+    size_t created;
+} TxnWorker;
+
+static void token_path(char* path, int parent, int id, int token) {
+    sprintf(path, "%s%c%c/", txn_parents[parent], 'a' + id, 'a' + token);
+}
+
+static void* run_txns(void* arg) {
+    TxnWorker* worker = arg;
+    char paths[3][16];
+    pthread_barrier_wait(worker->start);
+    for (int round = 0; round < TXN_ROUNDS;) {
+        TreeOp ops[3];
+        size_t n = 0;
+        int token = -1, to = -1, create_in = -1;
+        bool failing = false;
+        if (worker->created < TXN_TOKENS && (worker->created == 0 || rand_r(&worker->seed) % 2)) {
+            create_in = rand_r(&worker->seed) % 4;
+            token_path(paths[0], create_in, worker->id, worker->created);
+            ops[n++] = (TreeOp){ TREE_OP_CREATE, paths[0], NULL };
+        }
+        if (worker->created > 0) {
+            token = rand_r(&worker->seed) % worker->created;
+            to = (worker->loc[token] + 1 + rand_r(&worker->seed) % 3) % 4;
+            token_path(paths[1], worker->loc[token], worker->id, token);
+            token_path(paths[2], to, worker->id, token);
+            ops[n++] = (TreeOp){ TREE_OP_MOVE, paths[1], paths[2] };
+            if ((failing = rand_r(&worker->seed) % 4 == 0))
+                ops[n++] = (TreeOp){ TREE_OP_REMOVE, paths[1], NULL }; // już przeniesiony
+        }
+
+        TreeTxn* txn = tree_txn_begin(worker->tree);
+        assert(tree_txn_ops(txn, ops, n) == 0);
+        int results[3];
+        int err = tree_txn_commit(txn, results);
+        tree_txn_free(txn);
+        if (err == EAGAIN) {
+            for (size_t i = 0; i < n; i++)
+                assert(results[i] == EAGAIN);
+            continue;
+        }
+        round++;
+        if (failing) {
+            assert(err == ENOENT && results[n - 1] == ENOENT);
+            for (size_t i = 0; i + 1 < n; i++)
+                assert(results[i] == ECANCELED);
+            continue;
+        }
+        assert(err == 0);
+        for (size_t i = 0; i < n; i++)
+            assert(results[i] == 0);
+        if (create_in >= 0)
+            worker->loc[worker->created++] = create_in;
+        if (token >= 0)
+            worker->loc[token] = to;
+    }
+    return NULL;
+}
+
+static bool next_event(WatchQueue* queue, TreeEventType type, const char* path) {
+    TreeEvent event;
+    if (!watch_queue_pop(queue, &event))
+        return false;
+    bool ok = event.type == type && strcmp(event.path, path) == 0;
+    free(event.path);
+    return ok;
+}
+
 int main(void)
 {
 //    char *p1 = "/a/b/c/d/e/g/h/", *p2 = "/x/";
@@ -69,7 +246,509 @@ int main(void)
     assert(tree_remove(t, "/b/a/x/") == ENOTEMPTY);
     assert(tree_remove(t, "/b/a/x/d/") == 0);
     assert(strcmp(tree_list(t, "/b/a/x/"), "c,e") == 0);
+
+    char buf[16];
+    size_t needed;
+    assert(tree_list_into(t, "/b/a/x/", buf, sizeof(buf), &needed) == 0);
+    assert(needed == 4 && strcmp(buf, "c,e") == 0);
+    assert(tree_list_into(t, "/b/a/x/c/", buf, sizeof(buf), &needed) == 0);
+    assert(needed == 1 && strcmp(buf, "") == 0);
+    assert(tree_list_into(t, "/b/a/x/", buf, 3, &needed) == ERANGE && needed == 4);
+    assert(tree_list_into(t, "/q/", buf, sizeof(buf), &needed) == ENOENT);
+
+    TreeName names[2];
+    TreeNameBuffer out = { names, 2, buf, sizeof(buf), 0, 0 };
+    assert(tree_list_names(t, "/b/a/x/", &out) == 0);
+    assert(out.count == 2 && out.needed == 4);
+    assert(names[0].length == 1 && strcmp(names[0].name, "c") == 0);
+    assert(names[1].length == 1 && strcmp(names[1].name, "e") == 0);
+    out.max_names = 1;
+    assert(tree_list_names(t, "/b/a/x/", &out) == ERANGE && out.count == 2);
+
+    // Dużo nazw: rozrost tablicy haszującej i sortowanie pozycyjne.
+    char path[32], expected[4 * 26 * 26 + 1] = "";
+    for (char c1 = 'a'; c1 <= 'z'; c1++)
+        for (char c2 = 'a'; c2 <= 'z'; c2++) {
+            sprintf(path, "/a/%c%c/", c1, c2);
+            assert(tree_create(t, path) == 0);
+            sprintf(path, "%s%c%c", *expected ? "," : "", c1, c2);
+            strcat(expected, path);
+        }
+    char *listing = tree_list(t, "/a/");
+    assert(strcmp(listing, expected) == 0);
+    free(listing);
+    assert(tree_remove(t, "/a/qq/") == 0);
+    assert(tree_create(t, "/a/qq/") == 0);
+
+    // Stronicowanie: kursor przeżywa zmiany folderu między stronami.
+    MemStats unindexed, indexed;
+    tree_memory_stats(t, &unindexed);
+    TreeName page_names[100];
+    char page_chars[300], cursor[PACKED_NAME_MAX_LENGTH + 1] = "", paged[4 * 26 * 26 + 1] = "";
+    TreeNameBuffer page = { page_names, 100, page_chars, sizeof(page_chars), 0, 0 };
+    size_t pages = 0;
+    while (tree_list_page(t, "/a/", cursor, 64, &page) == 0 && page.count > 0) {
+        if (pages++ == 0) {
+            tree_memory_stats(t, &indexed);
+            assert(indexed.container_bytes > unindexed.container_bytes);
+            assert(tree_create(t, "/a/aaa/") == 0); // przed kursorem, niewidoczny
+            assert(tree_remove(t, "/a/aaa/") == 0);
+        }
+        for (size_t i = 0; i < page.count; i++)
+            sprintf(paged + strlen(paged), "%s%s", *paged ? "," : "", page_names[i].name);
+        strcpy(cursor, page_names[page.count - 1].name);
+    }
+    assert(strcmp(paged, expected) == 0 && pages == (26 * 26 + 63) / 64);
+    listing = tree_list(t, "/a/"); // z zapamiętanego indeksu, bez sortowania
+    assert(strcmp(listing, expected) == 0);
+    free(listing);
+    assert(tree_create(t, "/a/aaa/") == 0 && tree_remove(t, "/a/ab/") == 0); // indeks zostaje posortowany
+    tree_memory_stats(t, &indexed);
+    assert(indexed.container_bytes > unindexed.container_bytes);
+    assert(tree_list_page(t, "/a/", NULL, 3, &page) == 0 && page.count == 3);
+    assert(strcmp(page_names[0].name, "aa") == 0 && strcmp(page_names[1].name, "aaa") == 0);
+    assert(strcmp(page_names[2].name, "ac") == 0);
+    assert(tree_remove(t, "/a/aaa/") == 0 && tree_create(t, "/a/ab/") == 0);
+    TreeListing *entries = tree_list_entries(t, "/a/");
+    assert(entries->count == 26 * 26 && entries->offsets[26 * 26] == 3 * 26 * 26);
+    assert(strcmp(entries->chars + entries->offsets[27], "bb") == 0);
+    assert(entries->offsets[28] - entries->offsets[27] - 1 == 2);
+    tree_listing_free(entries);
+    assert(tree_list_entries(t, "/b/q/") == NULL);
+    entries = tree_list_entries(t, "/b/a/x/e/");
+    assert(entries->count == 0 && entries->offsets[0] == 0);
+    tree_listing_free(entries);
+    page.size = 2;
+    assert(tree_list_page(t, "/a/", NULL, 1, &page) == ERANGE && page.needed == 3);
+    assert(tree_list_page(t, "/a/", "a1", 1, &page) == EINVAL);
+    tree_free(t);
+
+    // Liczniki pamięci: korzeń i katalogi najwyższego poziomu.
+    t = tree_new();
+    MemStats empty, mem;
+    tree_memory_stats(t, &empty);
+    assert(empty.nodes == 1 && empty.node_bytes > 0 && empty.container_bytes > 0);
+    assert(tree_create(t, "/a/") == 0);
+    assert(tree_create(t, "/a/b/") == 0);
+    assert(tree_create(t, "/a/b/c/") == 0);
+    assert(tree_create(t, "/d/") == 0);
+    tree_memory_stats(t, &mem);
+    assert(mem.nodes == 5 && mem.key_bytes > empty.key_bytes);
+    TreeDirMemoryStats dirs[2];
+    size_t n_dirs;
+    assert(tree_memory_stats_dirs(t, dirs, 1, &n_dirs) == ERANGE && n_dirs == 2);
+    assert(tree_memory_stats_dirs(t, dirs, 2, &n_dirs) == 0 && n_dirs == 2);
+    assert(strcmp(dirs[0].name, "a") == 0 && dirs[0].stats.nodes == 3);
+    assert(strcmp(dirs[1].name, "d") == 0 && dirs[1].stats.nodes == 1);
+    assert(tree_move(t, "/a/b/", "/d/b/") == 0);
+    size_t n_folders;
+    assert(tree_count(t, "/d/", &n_folders) == 0 && n_folders == 2);
+    assert(tree_count(t, "/a/", &n_folders) == 0 && n_folders == 0);
+    assert(tree_memory_stats_dirs(t, dirs, 2, &n_dirs) == 0);
+    assert(dirs[0].stats.nodes == 1 && dirs[1].stats.nodes == 3);
+    assert(tree_exchange(t, "/a/", "/d/b/") == 0); // z katalogiem niższego poziomu
+    assert(tree_memory_stats_dirs(t, dirs, 2, &n_dirs) == 0);
+    assert(dirs[0].stats.nodes == 2 && dirs[1].stats.nodes == 2);
+    listing = tree_list(t, "/a/");
+    assert(strcmp(listing, "c") == 0);
+    free(listing);
+    assert(tree_exchange(t, "/a/", "/d/b/") == 0);
+    assert(tree_exchange(t, "/d/", "/d/b/c/") == -9);
+    assert(tree_exchange(t, "/a/", "/x/") == ENOENT);
+    assert(tree_exchange(t, "/", "/a/") == EBUSY);
+    assert(tree_exchange(t, "/a/", "/a/") == 0);
+    assert(tree_move(t, "/d/b/", "/b/") == 0);
+    assert(tree_memory_stats_dirs(t, dirs, 2, &n_dirs) == ERANGE && n_dirs == 3);
+    assert(tree_remove(t, "/b/c/") == 0 && tree_remove(t, "/b/") == 0);
+    assert(tree_remove(t, "/a/") == 0 && tree_remove(t, "/d/") == 0);
+    tree_memory_stats(t, &mem);
+    // mapa korzenia zostaje z tablicą kubełków
+    assert(mem.nodes == 1 && mem.node_bytes == empty.node_bytes && mem.key_bytes == 0);
+    assert(mem.sync_bytes == empty.sync_bytes && mem.container_bytes > empty.container_bytes);
+    tree_free(t);
+
+    // Foldery, które zamiana i kopia przenoszą przez TREE_HOT_DEPTH, są
+    // umieszczane na nowo, więc zajmują tyle, co utworzone na miejscu.
+    // Narzut bloków z aligned_alloc zależy od stanu sterty, ale gorący
+    // wierzchołek zajmuje kilka linii pamięci więcej niż zwykły.
+    t = tree_new();
+    Tree *in_place = tree_new();
+    TreeDirMemoryStats placed[3], expected_dirs[3];
+    assert(tree_create_all(t, "/a/b/", NULL) == 0 && tree_create(t, "/c/") == 0);
+    assert(tree_exchange(t, "/a/b/", "/c/") == 0 && tree_copy(t, "/a/", "/e/") == 0);
+    assert(tree_create_all(in_place, "/a/b/", NULL) == 0 && tree_create(in_place, "/c/") == 0);
+    assert(tree_create_all(in_place, "/e/b/", NULL) == 0);
+    assert(tree_memory_stats_dirs(t, placed, 3, &n_dirs) == 0 && n_dirs == 3);
+    assert(tree_memory_stats_dirs(in_place, expected_dirs, 3, &n_dirs) == 0 && n_dirs == 3);
+    for (size_t i = 0; i < 3; i++) {
+        MemStats *got = &placed[i].stats, *want = &expected_dirs[i].stats;
+        assert(got->nodes == want->nodes && got->container_bytes == want->container_bytes);
+        assert(got->overhead_bytes < want->overhead_bytes + 256 && want->overhead_bytes < got->overhead_bytes + 256);
+    }
+    tree_free(in_place);
+    tree_free(t);
+
+    // Drzewo na tyle duże, że zwalnianie rozdziela pracę między wątki puli.
+    t = tree_new();
+    for (char c1 = 'a'; c1 <= 'z'; c1++) {
+        sprintf(path, "/%c/", c1);
+        assert(tree_create(t, path) == 0);
+        for (char c2 = 'a'; c2 <= 'z'; c2++) {
+            sprintf(path, "/%c/%c/", c1, c2);
+            assert(tree_create(t, path) == 0);
+            for (char c3 = 'a'; c3 <= 'h'; c3++) {
+                sprintf(path, "/%c/%c/%c/", c1, c2, c3);
+                assert(tree_create(t, path) == 0);
+            }
+        }
+    }
+    WalkCount count = { 0, 0 };
+    assert(tree_walk(t, "/", count_folder, &count, 4) == 0);
+    assert(count.folders == 26 + 26 * 26 + 26 * 26 * 8);
+    assert(tree_count(t, "/", &n_folders) == 0 && n_folders == count.folders);
+    assert(tree_count(t, "/q/", &n_folders) == 0 && n_folders == 26 + 26 * 8);
+    assert(tree_count(t, "/q/r/h/", &n_folders) == 0 && n_folders == 0);
+    assert(tree_count(t, "/q/r/s/t/", &n_folders) == ENOENT);
+    assert(count.depth_sum == 26 + 2 * 26 * 26 + 3 * 26 * 26 * 8);
+    count.folders = 0;
+    assert(tree_walk(t, "/q/", count_folder, &count, 1) == 0);
+    assert(count.folders == 26 + 26 * 8);
+    assert(tree_walk(t, "/q/r/s/t/", count_folder, &count, 2) == ENOENT);
+    count.folders = 0;
+    assert(tree_find(t, "/", "[a-c]", count_folder, &count, 2) == 0); // na każdym poziomie
+    assert(count.folders == 3 + 26 * 3 + 26 * 26 * 3);
+    count.folders = 0;
+    assert(tree_find(t, "/q/", "*h", count_folder, &count, 3) == 0);
+    assert(count.folders == 1 + 26);
+    count.folders = 0;
+    assert(tree_find(t, "/", "q", count_folder, &count, 4) == 0 && count.folders == 1 + 26);
+    assert(tree_find(t, "/", "Q*", count_folder, &count, 1) == EINVAL);
+    assert(tree_find(t, "/", "a[", count_folder, &count, 2) == EINVAL);
+    assert(tree_find(t, "/", "", count_folder, &count, 3) == EINVAL);
+    assert(tree_find(t, "/zz/", "*", count_folder, &count, 4) == ENOENT);
+    assert(tree_create(t, "/q/x/") == EEXIST); // liczniki przejścia zwolnione
+    // visit może zmieniać drzewo: usuwa odwiedzane liście
+    assert(tree_create_all(t, "/walk/a/b/", NULL) == 0 && tree_create(t, "/walk/c/") == 0);
+    WalkRemove leaves = { t, 0 };
+    assert(tree_walk(t, "/walk/", remove_leaf, &leaves, 2) == 0);
+    assert(leaves.removed == 2 && tree_count(t, "/walk/", &n_folders) == 0 && n_folders == 1);
+    assert(tree_remove(t, "/walk/a/") == 0 && tree_remove(t, "/walk/") == 0);
+
+    MemStats original, copied;
+    tree_memory_stats(t, &original);
+    assert(tree_copy(t, "/q/", "/qq/") == 0);
+    assert(tree_copy(t, "/q/", "/q/a/zz/") == 0); // do własnego poddrzewa
+    assert(tree_copy(t, "/q/", "/r/") == EEXIST);
+    assert(tree_copy(t, "/zz/", "/ww/") == ENOENT);
+    assert(tree_copy(t, "/zz/", "/r/") == EEXIST); // cel sprawdzany przed źródłem
+    assert(tree_copy(t, "/q/", "/ww/a/") == ENOENT);
+    count.folders = 0;
+    assert(tree_walk(t, "/qq/", count_folder, &count, 2) == 0);
+    assert(count.folders == 26 + 26 * 8);
+    count.folders = 0;
+    assert(tree_walk(t, "/q/a/zz/", count_folder, &count, 2) == 0);
+    assert(count.folders == 26 + 26 * 8);
+    tree_memory_stats(t, &copied);
+    assert(copied.nodes == 1 + 26 + 26 * 26 + 26 * 26 * 8 + 2 * (1 + 26 + 26 * 8));
+    assert(tree_remove(t, "/q/b/c/") == 0);
+    assert(tree_exchange(t, "/qq/b/", "/q/a/zz/") == 0); // w jednym wejściu
+    assert(tree_count(t, "/qq/", &n_folders) == 0 && n_folders == 26 + 26 * 8 + 26 + 26 * 8 - 8);
+    assert(tree_count(t, "/q/a/", &n_folders) == 0 && n_folders == 8 + 1 + 8);
+    count.folders = 0;
+    assert(tree_walk(t, "/qq/b/", count_folder, &count, 2) == 0);
+    assert(count.folders == 26 + 26 * 8);
+    count.folders = 0;
+    assert(tree_walk(t, "/q/a/zz/", count_folder, &count, 2) == 0);
+    assert(count.folders == 8);
+    assert(tree_exchange(t, "/qq/b/", "/q/a/zz/") == 0);
+    assert(tree_create(t, "/q/b/c/") == 0);
+    assert(tree_remove_recursive(t, "/qq/") == 0 && tree_remove_recursive(t, "/q/a/zz/") == 0);
+    tree_reclaim_wait();
+    tree_memory_stats(t, &copied);
+    assert(memcmp(&copied, &original, sizeof(MemStats)) == 0);
+    assert(tree_count(t, "/", &n_folders) == 0 && n_folders == 26 + 26 * 26 + 26 * 26 * 8);
+    tree_free_parallel(t, true);
+
+    t = tree_new();
+    size_t created;
+    assert(tree_create_all(t, "/m/n/o/", &created) == 0 && created == 3);
+    assert(tree_create_all(t, "/m/n/o/", &created) == 0 && created == 0);
+    assert(tree_create_all(t, "/m/n/p/q/", &created) == 0 && created == 2);
+    assert(tree_create_all(t, "/", &created) == 0 && created == 0);
+    assert(tree_create_all(t, "/m/1/", &created) == EINVAL);
+    listing = tree_list(t, "/m/n/");
+    assert(strcmp(listing, "o,p") == 0);
+    free(listing);
+    assert(tree_remove(t, "/m/n/p/") == ENOTEMPTY);
+    TreeStat stat, before;
+    assert(tree_stat(t, "/m/n/", &before) == 0 && before.children == 2);
+    assert(tree_stat(t, "/m/n/o/", &stat) == 0 && stat.children == 0);
+    assert(tree_stat(t, "/m/x/", NULL) == ENOENT);
+    assert(tree_stat(t, "/m/1/", NULL) == EINVAL);
+    assert(tree_create(t, "/m/n/r/") == 0);
+    assert(tree_remove(t, "/m/n/r/") == 0);
+    assert(tree_stat(t, "/m/n/", &stat) == 0 && stat.children == 2 && stat.version != before.version);
+    MemStats all;
+    tree_memory_stats(t, &all);
+    assert(all.nodes == 6);
+    assert(tree_remove_recursive(t, "/m/x/") == ENOENT);
+    assert(tree_remove_recursive(t, "/") == EBUSY);
+    assert(tree_remove_recursive(t, "/m/n/o/") == 0);
+    assert(tree_remove_recursive(t, "/m/") == 0);
+    listing = tree_list(t, "/");
+    assert(strcmp(listing, "") == 0);
+    free(listing);
+    tree_reclaim_wait();
+    tree_memory_stats(t, &all);
+    assert(all.nodes == 1);
+    tree_free(t);
+
+    // tree_batch: zależne operacje muszą dać to samo, co wykonane po kolei.
+    t = tree_new();
+    TreeOp ops[] = {
+        { TREE_OP_CREATE, "/x/y/", NULL },   // ENOENT, /x/ jeszcze nie ma
+        { TREE_OP_CREATE, "/x/", NULL },
+        { TREE_OP_CREATE, "/x/y/", NULL },
+        { TREE_OP_CREATE, "/x/y/z/", NULL },
+        { TREE_OP_REMOVE, "/x/y/", NULL },   // ENOTEMPTY
+        { TREE_OP_REMOVE, "/x/y/z/", NULL },
+        { TREE_OP_REMOVE, "/x/y/", NULL },
+        { TREE_OP_CREATE, "/x/", NULL },     // EEXIST
+        { TREE_OP_CREATE, "/a/", NULL },
+        { TREE_OP_MOVE, "/a/", "/x/a/" },
+        { TREE_OP_CREATE, "/x/a/b/", NULL },
+        { TREE_OP_REMOVE, "/", NULL },       // EBUSY
+        { TREE_OP_CREATE, "/q1/", NULL },    // EINVAL
+    };
+    int expected_results[] = { ENOENT, 0, 0, 0, ENOTEMPTY, 0, 0, EEXIST, 0, 0, 0, EBUSY, EINVAL };
+    int results[sizeof(ops) / sizeof(ops[0])];
+    assert(tree_batch(t, ops, sizeof(ops) / sizeof(ops[0]), results) == 5);
+    assert(memcmp(results, expected_results, sizeof(results)) == 0);
+    listing = tree_list(t, "/x/a/");
+    assert(strcmp(listing, "b") == 0);
+    free(listing);
     tree_free(t);
+
+    // Obserwatorzy: bezpośrednie podfoldery i całe drzewo.
+    t = tree_new();
+    WatchQueue *dir_events = watch_queue_new(16), *all_events = watch_queue_new(4);
+    assert(tree_create(t, "/w/") == 0);
+    assert(tree_watch(t, "/w/", false, dir_events) == 0);
+    assert(tree_watch(t, "/w/", true, dir_events) == EEXIST);
+    assert(tree_watch(t, "/", true, all_events) == 0);
+    assert(tree_watch(t, "/v/", true, all_events) == ENOENT);
+    assert(tree_create(t, "/w/a/") == 0);
+    assert(tree_create(t, "/w/a/b/") == 0); // tylko w all_events
+    assert(tree_move(t, "/w/a/", "/c/") == 0);
+    assert(next_event(dir_events, TREE_EVENT_CREATE, "/w/a/"));
+    assert(next_event(dir_events, TREE_EVENT_MOVE_FROM, "/w/a/"));
+    assert(!next_event(dir_events, TREE_EVENT_CREATE, "/w/a/b/"));
+    assert(next_event(all_events, TREE_EVENT_CREATE, "/w/a/"));
+    assert(next_event(all_events, TREE_EVENT_CREATE, "/w/a/b/"));
+    assert(next_event(all_events, TREE_EVENT_MOVE_FROM, "/w/a/"));
+    assert(next_event(all_events, TREE_EVENT_MOVE_TO, "/c/"));
+    assert(tree_create_all(t, "/w/d/e/f/g/h/", NULL) == 0); // pięć zdarzeń w kolejce na cztery
+    assert(watch_queue_dropped(all_events) == 1 && watch_queue_dropped(dir_events) == 0);
+    assert(next_event(dir_events, TREE_EVENT_CREATE, "/w/d/"));
+    assert(next_event(all_events, TREE_EVENT_CREATE, "/w/d/") && next_event(all_events, TREE_EVENT_CREATE, "/w/d/e/"));
+    assert(tree_unwatch(t, "/", all_events) == 0 && tree_unwatch(t, "/", all_events) == ENOENT);
+    assert(tree_remove_recursive(t, "/w/d/") == 0);
+    assert(next_event(dir_events, TREE_EVENT_REMOVE, "/w/d/"));
+    tree_free(t); // obserwator /w/ znika razem z folderem
+    watch_queue_free(dir_events);
+    watch_queue_free(all_events);
+
+    // Transakcje: wszystko albo nic, konflikt wersji daje EAGAIN.
+    t = tree_new();
+    assert(tree_create(t, "/a/") == 0 && tree_create(t, "/b/") == 0 && tree_create(t, "/a/x/") == 0);
+    TreeTxn *txn = tree_txn_begin(t);
+    TreeOp txn_ops[] = {
+        { TREE_OP_CREATE, "/b/y/", NULL },
+        { TREE_OP_MOVE, "/a/x/", "/b/y/x/" },
+        { TREE_OP_REMOVE, "/a/", NULL },
+    };
+    int txn_results[3];
+    assert(tree_txn_ops(txn, txn_ops, 3) == 0);
+    assert(tree_txn_commit(txn, txn_results) == 0);
+    assert(txn_results[0] == 0 && txn_results[1] == 0 && txn_results[2] == 0);
+    tree_txn_free(txn);
+    listing = tree_list(t, "/");
+    assert(strcmp(listing, "b") == 0);
+    free(listing);
+    assert(tree_count(t, "/", &n_folders) == 0 && n_folders == 3);
+
+    TreeOp failing_ops[] = {
+        { TREE_OP_CREATE, "/c/", NULL },
+        { TREE_OP_MOVE, "/b/y/x/", "/c/x/" },
+        { TREE_OP_REMOVE, "/b/", NULL },     // ENOTEMPTY, została w nim /b/y/
+    };
+    txn = tree_txn_begin(t);
+    tree_txn_ops(txn, failing_ops, 3);
+    int failing_results[3];
+    assert(tree_txn_commit(txn, failing_results) == ENOTEMPTY);
+    assert(failing_results[0] == ECANCELED && failing_results[1] == ECANCELED && failing_results[2] == ENOTEMPTY);
+    tree_txn_free(txn);
+    listing = tree_list(t, "/b/y/");
+    assert(strcmp(listing, "x") == 0);
+    free(listing);
+    assert(tree_list(t, "/c/") == NULL);
+    assert(tree_count(t, "/", &n_folders) == 0 && n_folders == 3);
+
+    txn = tree_txn_begin(t);
+    tree_txn_ops(txn, txn_ops, 1);
+    assert(tree_remove(t, "/b/y/x/") == 0); // zmienia /b/y/, ale nie /b/
+    assert(tree_create(t, "/b/z/") == 0);   // zmienia /b/
+    assert(tree_txn_commit(txn, txn_results) == EAGAIN && txn_results[0] == EAGAIN);
+    assert(tree_txn_commit(txn, txn_results) == EINVAL && txn_results[0] == EINVAL);
+    assert(tree_txn_ops(txn, txn_ops, 1) == EINVAL);
+    tree_txn_free(txn);
+    listing = tree_list(t, "/b/");
+    assert(strcmp(listing, "y,z") == 0 || strcmp(listing, "z,y") == 0);
+    free(listing);
+    tree_free(t);
+
+    // Współbieżne transakcje na wspólnych rodzicach (także zagnieżdżonych):
+    // wątki startują razem, więc są konflikty wersji i nieudane zajmowanie
+    // bez czekania (aż do zamka w najniższym wspólnym przodku), a końcowe
+    // drzewo to dokładnie skutek udanych transakcji.
+    t = tree_new();
+    for (int i = 0; i < 4; i++)
+        assert(tree_create(t, txn_parents[i]) == 0);
+    pthread_barrier_t txn_start;
+    pthread_barrier_init(&txn_start, NULL, TXN_THREADS);
+    TxnWorker txn_workers[TXN_THREADS];
+    pthread_t txn_threads[TXN_THREADS];
+    for (int i = 0; i < TXN_THREADS; i++) {
+        txn_workers[i] = (TxnWorker){ .tree = t, .start = &txn_start, .id = i, .seed = i + 11 };
+        assert(pthread_create(&txn_threads[i], NULL, run_txns, &txn_workers[i]) == 0);
+    }
+    size_t tokens = 0;
+    for (int i = 0; i < TXN_THREADS; i++) {
+        pthread_join(txn_threads[i], NULL);
+        for (size_t token = 0; token < txn_workers[i].created; token++) {
+            char path[16];
+            token_path(path, txn_workers[i].loc[token], i, token);
+            listing = tree_list(t, path);
+            assert(listing && strcmp(listing, "") == 0);
+            free(listing);
+        }
+        tokens += txn_workers[i].created;
+    }
+    assert(tree_count(t, "/", &n_folders) == 0 && n_folders == 4 + tokens);
+    pthread_barrier_destroy(&txn_start);
+    tree_free(t);
+
+    // Migawki: stan z chwili utworzenia, niezależny od późniejszych zmian.
+    t = tree_new();
+    assert(tree_create(t, "/a/") == 0 && tree_create(t, "/a/b/") == 0 && tree_create(t, "/c/") == 0);
+    TreeSnapshot *first = tree_snapshot(t);
+    assert(tree_create(t, "/a/d/") == 0);
+    assert(tree_move(t, "/c/", "/a/b/c/") == 0);
+    TreeSnapshot *second = tree_snapshot(t);
+    MemStats shared, kept;
+    tree_memory_stats(t, &shared);
+    assert(tree_remove(t, "/a/d/") == 0);
+    tree_memory_stats(t, &kept); // second widzi jeszcze /a/d/
+    assert(kept.nodes == shared.nodes);
+    assert(tree_copy(t, "/a/b/", "/e/") == 0 && tree_remove(t, "/e/c/") == 0);
+    tree_memory_stats(t, &kept); // kopii nie widzi żadna migawka, więc /e/c/ już zwolniony
+    assert(kept.nodes == shared.nodes + 1);
+    listing = tree_snapshot_list(first, "/");
+    assert(strcmp(listing, "a,c") == 0);
+    free(listing);
+    listing = tree_snapshot_list(second, "/a/");
+    assert(strcmp(listing, "b,d") == 0);
+    free(listing);
+    assert(tree_snapshot_list(first, "/a/b/c/") == NULL && tree_snapshot_list(second, "/a/x/") == NULL);
+    tree_snapshot_free(first);
+    count.folders = count.depth_sum = 0;
+    assert(tree_snapshot_walk(second, "/", count_folder, &count, 2) == 0);
+    assert(count.folders == 4 && count.depth_sum == 1 + 2 + 2 + 3);
+    assert(tree_snapshot_walk(second, "/c/", count_folder, &count, 2) == ENOENT);
+    listing = tree_snapshot_list(second, "/a/b/");
+    assert(strcmp(listing, "c") == 0);
+    free(listing);
+    tree_snapshot_free(second);
+    tree_memory_stats(t, &kept);
+    assert(kept.nodes == shared.nodes); // bez /a/d/, z /e/
+    tree_free(t);
+
+    // Migawki robione w trakcie zmian z innych wątków: dwa przejścia tej
+    // samej migawki (różną liczbą wątków) widzą dokładnie te same foldery.
+    t = tree_new();
+    unsigned churn_seed = 0;
+    for (int i = 0; i < 100; i++) {
+        char path[16];
+        random_path(path, 1 + i % 3, &churn_seed);
+        tree_create(t, path);
+    }
+    atomic_int running = 3;
+    Churn churns[3];
+    pthread_t churn_threads[3];
+    for (unsigned i = 0; i < 3; i++) {
+        churns[i] = (Churn){ t, i + 1, &running };
+        assert(pthread_create(&churn_threads[i], NULL, churn_tree, &churns[i]) == 0);
+    }
+    PathSet walked[2] = { { .lock = PTHREAD_MUTEX_INITIALIZER }, { .lock = PTHREAD_MUTEX_INITIALIZER } };
+    while (atomic_load(&running) > 0) {
+        TreeSnapshot* snapshot = tree_snapshot(t);
+        for (int w = 0; w < 2; w++) {
+            assert(tree_snapshot_walk(snapshot, "/", collect_path, &walked[w], 3 - w) == 0);
+            qsort(walked[w].paths, walked[w].count, sizeof(char*), compare_paths);
+        }
+        assert(walked[0].count == walked[1].count);
+        for (size_t i = 0; i < walked[0].count; i++)
+            assert(strcmp(walked[0].paths[i], walked[1].paths[i]) == 0);
+        tree_snapshot_free(snapshot);
+        clear_paths(&walked[0]);
+        clear_paths(&walked[1]);
+    }
+    for (int i = 0; i < 3; i++)
+        pthread_join(churn_threads[i], NULL);
+    free(walked[0].paths);
+    free(walked[1].paths);
+    tree_free(t);
+
+    // Losowe operacje na krótkich ścieżkach: paczka kontra po kolei.
+    Tree *batched = tree_new(), *sequential = tree_new();
+    enum { RANDOM_OPS = 3000 };
+    static TreeOp random_ops[RANDOM_OPS];
+    static char random_paths[RANDOM_OPS][16];
+    static int batch_results[RANDOM_OPS];
+    unsigned seed = 7;
+    for (int i = 0; i < RANDOM_OPS; i++) {
+        int depth = 1 + rand_r(&seed) % 3;
+        char *p = random_paths[i];
+        *p++ = '/';
+        for (int d = 0; d < depth; d++) {
+            *p++ = 'a' + rand_r(&seed) % 3;
+            *p++ = '/';
+        }
+        *p = '\0';
+        random_ops[i].type = rand_r(&seed) % 2 ? TREE_OP_CREATE : TREE_OP_REMOVE;
+        random_ops[i].path = random_paths[i];
+    }
+    tree_batch(batched, random_ops, RANDOM_OPS, batch_results);
+    for (int i = 0; i < RANDOM_OPS; i++) {
+        int res = random_ops[i].type == TREE_OP_CREATE ? tree_create(sequential, random_ops[i].path)
+                                                       : tree_remove(sequential, random_ops[i].path);
+        assert(res == batch_results[i]);
+    }
+    for (int i = 0; i < RANDOM_OPS; i++) {
+        char *l1 = tree_list(batched, random_paths[i]), *l2 = tree_list(sequential, random_paths[i]);
+        assert((!l1 && !l2) || (l1 && l2 && strcmp(l1, l2) == 0));
+        free(l1);
+        free(l2);
+    }
+    tree_free(batched);
+    tree_free(sequential);
+
+#if !defined(TREE_USE_MALLOC) && !defined(TREE_ARENA)
+    NodePoolStats stats;
+    tree_pool_stats(&stats);
+    assert(stats.in_use == 0 && stats.gets == stats.puts && stats.gets > 0);
+    assert(stats.cached + stats.depot == stats.objects);
+#endif
     //printf("%s\n", tree_list(t, "/a/"));
     //printf("%s\n", tree_list(t, "/b/x/"));
 //    HashMap* map = hmap_new();
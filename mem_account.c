@@ -0,0 +1,87 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mem_account.h"
+#include "err.h"
+
+// liczba pasków liczników konta
+#define STRIPES 8
+
+#define FIELDS (sizeof(MemStats) / sizeof(size_t))
+
+_Static_assert(sizeof(MemStats) == FIELDS * sizeof(size_t), "MemStats must hold only size_t fields");
+
+/**
+ * liczniki są bez znaku i przekręcają się: ujemne zmiany dopisujemy
+ * jako dopełnienie, więc suma pasków wychodzi dobra, choć pojedynczy
+ * pasek (np. wątku, który tylko usuwa) może być "ujemny"
+ */
+typedef struct Stripe {
+    _Alignas(64) atomic_size_t counters[FIELDS];
+} Stripe;
+
+struct MemAccount {
+    Stripe stripes[STRIPES];
+};
+
+static atomic_uint next_stripe;
+static _Thread_local unsigned thread_stripe = STRIPES;
+
+static Stripe *my_stripe(MemAccount *account) {
+
+    if (thread_stripe == STRIPES)
+        thread_stripe = atomic_fetch_add_explicit(&next_stripe, 1, memory_order_relaxed) % STRIPES;
+    return &account->stripes[thread_stripe];
+}
+
+MemAccount *mem_account_new(void) {
+
+    MemAccount *account = aligned_alloc(_Alignof(MemAccount), sizeof(MemAccount));
+    if (!account)
+        syserr("allocation failed");
+    for (size_t s = 0; s < STRIPES; s++)
+        for (size_t i = 0; i < FIELDS; i++)
+            atomic_init(&account->stripes[s].counters[i], 0);
+    return account;
+}
+
+void mem_account_free(MemAccount *account) {
+
+    free(account);
+}
+
+static void change(MemAccount *account, const MemStats *delta, size_t sign) {
+
+    Stripe *stripe = my_stripe(account);
+    const size_t *values = (const size_t *) delta;
+    for (size_t i = 0; i < FIELDS; i++)
+        if (values[i])
+            atomic_fetch_add_explicit(&stripe->counters[i], sign * values[i], memory_order_relaxed);
+}
+
+void mem_account_add(MemAccount *account, const MemStats *delta) {
+
+    change(account, delta, 1);
+}
+
+void mem_account_sub(MemAccount *account, const MemStats *delta) {
+
+    change(account, delta, (size_t) -1);
+}
+
+void mem_account_read(MemAccount *account, MemStats *stats) {
+
+    size_t *values = (size_t *) stats;
+    memset(stats, 0, sizeof(MemStats));
+    for (size_t s = 0; s < STRIPES; s++)
+        for (size_t i = 0; i < FIELDS; i++)
+            values[i] += atomic_load_explicit(&account->stripes[s].counters[i], memory_order_relaxed);
+}
+
+void mem_stats_add(MemStats *sum, const MemStats *stats) {
+
+    size_t *values = (size_t *) sum;
+    const size_t *added = (const size_t *) stats;
+    for (size_t i = 0; i < FIELDS; i++)
+        values[i] += added[i];
+}
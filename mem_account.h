@@ -0,0 +1,42 @@
+#pragma once
+#include <stddef.h>
+
+/**
+ * Zużycie pamięci przez część drzewa, w bajtach.
+ */
+typedef struct MemStats {
+    size_t nodes;            // liczba wierzchołków
+    size_t node_bytes;       // struktury wierzchołków bez obiektów synchronizacji
+    size_t container_bytes;  // mapy dzieci: struktury, tablice kubełków i wpisy
+    size_t key_bytes;        // spakowane nazwy dzieci
+    size_t sync_bytes;       // zamki i zmienne warunkowe
+    size_t overhead_bytes;   // narzut alokatora: nagłówki bloków i zaokrąglenia
+} MemStats;
+
+/**
+ * Konto, na które wątki dopisują zmiany zużycia pamięci. Konto ma kilka
+ * pasków liczników, każdy w osobnej linii pamięci podręcznej, a wątek
+ * zawsze pisze do tego samego paska, więc dopisanie nie wymaga zamka
+ * i rzadko kiedy przerzuca linię między rdzeniami. Odczyt sumuje paski.
+ */
+typedef struct MemAccount MemAccount;
+
+MemAccount *mem_account_new(void);
+
+void mem_account_free(MemAccount *account);
+
+void mem_account_add(MemAccount *account, const MemStats *delta);
+
+void mem_account_sub(MemAccount *account, const MemStats *delta);
+
+/**
+ * Zapisuje do *stats stan konta. Przy równoległych zmianach wynik
+ * może nie odpowiadać żadnej chwili, ale każda zakończona zmiana
+ * jest w nim uwzględniona.
+ */
+void mem_account_read(MemAccount *account, MemStats *stats);
+
+/**
+ * Dodaje stats do *sum pole po polu.
+ */
+void mem_stats_add(MemStats *sum, const MemStats *stats);
@@ -0,0 +1,210 @@
+#include "name_match.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "err.h"
+
+// Bits 1-26 of a character set stand for 'a'-'z', as in packed names.
+#define ALL_CHARS (((uint32_t)1 << 27) - 2)
+
+// Size of the hash table from position sets to DFA states (a power of two,
+// at least twice NAME_MATCH_MAX_STATES).
+#define STATE_TABLE_SIZE (2 * NAME_MATCH_MAX_STATES)
+
+typedef struct Tokens {
+    size_t count;
+    uint32_t sets[NAME_MATCH_MAX_TOKENS];
+    bool stars[NAME_MATCH_MAX_TOKENS]; // '*': loops on sets[i] instead of moving on
+} Tokens;
+
+// Parse "[...]" starting at `*pattern` and move `*pattern` past it.
+static int parse_set(const char** pattern, uint32_t* set)
+{
+    const char* p = *pattern + 1;
+    bool negate = *p == '!' || *p == '^';
+    if (negate)
+        ++p;
+    uint32_t bits = 0;
+    while (*p != ']') {
+        if (*p < 'a' || *p > 'z')
+            return EINVAL;
+        char first = *p, last = *p;
+        if (p[1] == '-' && p[2] >= 'a' && p[2] <= 'z') {
+            last = p[2];
+            if (last < first)
+                return EINVAL;
+            p += 2;
+        }
+        for (char c = first; c <= last; ++c)
+            bits |= (uint32_t)1 << (c - 'a' + 1);
+        ++p;
+    }
+    if (!bits)
+        return EINVAL;
+    *set = negate ? ALL_CHARS & ~bits : bits;
+    *pattern = p + 1;
+    return 0;
+}
+
+static int parse_tokens(const char* p, Tokens* tokens)
+{
+    tokens->count = 0;
+    while (*p) {
+        uint32_t set;
+        bool star = *p == '*';
+        if (star) {
+            set = ALL_CHARS;
+            ++p;
+            if (tokens->count > 0 && tokens->stars[tokens->count - 1])
+                continue; // "**" is the same as "*"
+        } else if (*p == '?') {
+            set = ALL_CHARS;
+            ++p;
+        } else if (*p == '[') {
+            if (parse_set(&p, &set))
+                return EINVAL;
+        } else if (*p >= 'a' && *p <= 'z') {
+            set = (uint32_t)1 << (*p - 'a' + 1);
+            ++p;
+        } else {
+            return EINVAL;
+        }
+        if (tokens->count == NAME_MATCH_MAX_TOKENS)
+            return EINVAL;
+        tokens->sets[tokens->count] = set;
+        tokens->stars[tokens->count] = star;
+        ++tokens->count;
+    }
+    return 0;
+}
+
+// Add the positions reachable by skipping '*' tokens (they may match nothing).
+static uint64_t closure(const Tokens* tokens, uint64_t positions)
+{
+    for (size_t i = 0; i < tokens->count; ++i) {
+        if ((positions >> i & 1) && tokens->stars[i])
+            positions |= (uint64_t)1 << (i + 1);
+    }
+    return positions;
+}
+
+static uint64_t step(const Tokens* tokens, uint64_t positions, int c)
+{
+    uint64_t next = 0;
+    for (size_t i = 0; i < tokens->count; ++i) {
+        if ((positions >> i & 1) && (tokens->sets[i] >> c & 1))
+            next |= (uint64_t)1 << (tokens->stars[i] ? i : i + 1);
+    }
+    return closure(tokens, next);
+}
+
+typedef struct StateTable {
+    uint64_t subsets[NAME_MATCH_MAX_STATES];
+    uint16_t slots[STATE_TABLE_SIZE]; // 0 - empty, otherwise a state (state 0 is never stored)
+} StateTable;
+
+// Return the state for `positions`, adding it if it is new, or 0 if there
+// are too many states. The empty set is always state 0.
+static uint16_t find_state(StateTable* table, size_t* n_states, uint64_t positions)
+{
+    if (!positions)
+        return 0;
+    size_t i = (size_t)((positions * 0x9E3779B97F4A7C15ull) >> 40) & (STATE_TABLE_SIZE - 1);
+    for (;; i = (i + 1) & (STATE_TABLE_SIZE - 1)) {
+        uint16_t state = table->slots[i];
+        if (!state)
+            break;
+        if (table->subsets[state] == positions)
+            return state;
+    }
+    if (*n_states == NAME_MATCH_MAX_STATES)
+        return 0;
+    uint16_t state = (uint16_t)(*n_states)++;
+    table->subsets[state] = positions;
+    table->slots[i] = state;
+    return state;
+}
+
+int name_matcher_compile(NameMatcher* matcher, const char* pattern)
+{
+    size_t prefix_len = 0;
+    while (pattern[prefix_len] >= 'a' && pattern[prefix_len] <= 'z')
+        ++prefix_len;
+    if (!*pattern || prefix_len > PACKED_NAME_MAX_LENGTH)
+        return EINVAL;
+    Tokens tokens;
+    if (parse_tokens(pattern + prefix_len, &tokens))
+        return EINVAL;
+
+    PackedNameBuffer prefix;
+    packed_name_encode(&prefix.name, pattern, prefix_len);
+    matcher->prefix_len = prefix_len;
+    memcpy(matcher->prefix_words, prefix.name.words, packed_name_words(prefix_len) * sizeof(uint64_t));
+
+    StateTable* table = calloc(1, sizeof(StateTable));
+    uint16_t(*next)[27] = malloc(NAME_MATCH_MAX_STATES * sizeof(*next));
+    if (!table || !next)
+        syserr("allocation failed");
+
+    // Subset construction; states are numbered in the order they are found.
+    size_t n_states = 1;
+    table->subsets[0] = 0;
+    memset(next[0], 0, sizeof(next[0]));
+    matcher->start = find_state(table, &n_states, closure(&tokens, 1));
+    int err = 0;
+    for (size_t state = 1; state < n_states && !err; ++state) {
+        next[state][0] = 0;
+        for (int c = 1; c <= 26; ++c) {
+            uint64_t positions = step(&tokens, table->subsets[state], c);
+            next[state][c] = find_state(table, &n_states, positions);
+            if (positions && !next[state][c]) {
+                err = EINVAL;
+                break;
+            }
+        }
+    }
+
+    if (!err) {
+        matcher->n_states = n_states;
+        matcher->next = realloc(next, n_states * sizeof(*next));
+        matcher->accepting = malloc(n_states * sizeof(bool));
+        if (!matcher->next || !matcher->accepting)
+            syserr("allocation failed");
+        for (size_t state = 0; state < n_states; ++state)
+            matcher->accepting[state] = table->subsets[state] >> tokens.count & 1;
+    } else {
+        free(next);
+    }
+    free(table);
+    return err;
+}
+
+void name_matcher_free(NameMatcher* matcher)
+{
+    free(matcher->next);
+    free(matcher->accepting);
+}
+
+bool name_matcher_match(const NameMatcher* matcher, const PackedName* name)
+{
+    if (name->len < matcher->prefix_len)
+        return false;
+    size_t full_words = matcher->prefix_len / PACKED_NAME_CHARS_PER_WORD;
+    for (size_t w = 0; w < full_words; ++w) {
+        if (name->words[w] != matcher->prefix_words[w])
+            return false;
+    }
+    size_t rest = matcher->prefix_len % PACKED_NAME_CHARS_PER_WORD;
+    if (rest) {
+        unsigned shift = 5 * (PACKED_NAME_CHARS_PER_WORD - rest);
+        if (name->words[full_words] >> shift != matcher->prefix_words[full_words] >> shift)
+            return false;
+    }
+
+    unsigned state = matcher->start;
+    for (size_t i = matcher->prefix_len; i < name->len && state; ++i)
+        state = matcher->next[state][packed_name_char(name, i)];
+    return matcher->accepting[state];
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "packed_name.h"
+
+// Glob patterns over folder names. '*' matches any (possibly empty) run of
+// characters, '?' any single character, "[abc]", "[a-z]" and "[!a-z]" one
+// character from a set (or outside it), and 'a'-'z' themselves.
+//
+// A pattern is compiled once into a DFA over the 26 letters, so matching a
+// name costs one table lookup per character. The literal prefix before the
+// first special character is packed like a name: it is compared against the
+// packed name a whole word (12 characters) at a time, and the DFA starts
+// after it. Most names are rejected by the first word.
+
+// Each character token after the literal prefix is one NFA position; sets of
+// positions (DFA states) are kept as 64-bit masks, with one bit for "done".
+#define NAME_MATCH_MAX_TOKENS 63
+
+// Limit on the number of DFA states, so a pathological pattern fails to
+// compile instead of building a huge table.
+#define NAME_MATCH_MAX_STATES 4096
+
+typedef struct NameMatcher {
+    size_t prefix_len;
+    uint64_t prefix_words[PACKED_NAME_MAX_WORDS];
+    size_t n_states;
+    uint16_t (*next)[27]; // next[state][c] for c = 1-26; state 0 rejects everything
+    bool* accepting;
+    uint16_t start;       // The state after the prefix.
+} NameMatcher;
+
+// Compile `pattern` into `matcher`. Return 0, or EINVAL if the pattern is
+// empty, malformed, or too complex (see the limits above).
+int name_matcher_compile(NameMatcher* matcher, const char* pattern);
+
+void name_matcher_free(NameMatcher* matcher);
+
+// Return whether the whole `name` matches the pattern.
+bool name_matcher_match(const NameMatcher* matcher, const PackedName* name);
@@ -0,0 +1,273 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include "node_pool.h"
+#include "err.h"
+
+// liczba obiektów w płycie i w paczce przenoszonej do/z magazynu
+#define BATCH_SIZE 32
+// pojemność pamięci podręcznej wątku
+#define CACHE_CAPACITY (2 * BATCH_SIZE)
+
+typedef struct Batch Batch;
+struct Batch {
+    Batch *next;
+    size_t count;
+    void *objects[BATCH_SIZE];
+};
+
+typedef struct Slab Slab;
+struct Slab {
+    Slab *next;
+    // dalej BATCH_SIZE obiektów
+};
+
+typedef struct Cache Cache;
+struct Cache {
+    NodePool *pool;
+    Cache *next, *prev;  // lista pamięci podręcznych wątków puli
+    atomic_size_t count; // czytane przez node_pool_stats
+    atomic_size_t gets, puts;
+    void *objects[CACHE_CAPACITY];
+};
+
+struct NodePool {
+    size_t size;         // rozmiar obiektu zaokrąglony do wyrównania
+    size_t slab_bytes;
+    void (*init)(void *);
+    void (*destroy)(void *);
+    pthread_key_t key;
+    pthread_mutex_t lock; // chroni wszystko poniżej
+    Batch *depot;         // pełne (lub prawie) paczki wolnych obiektów
+    Batch *spare;         // puste paczki do ponownego użycia
+    size_t depot_objects;
+    Slab *slabs;
+    size_t n_slabs;
+    Cache *caches;
+    size_t retired_gets, retired_puts; // liczniki zakończonych wątków
+};
+
+static size_t align_up(size_t size) {
+
+    size_t align = _Alignof(max_align_t);
+    return (size + align - 1) / align * align;
+}
+
+static void *slab_object(NodePool *pool, Slab *slab, size_t i) {
+
+    return (char *) slab + align_up(sizeof(Slab)) + i * pool->size;
+}
+
+static void lock_pool(NodePool *pool) {
+
+    if (pthread_mutex_lock(&pool->lock) != 0)
+        syserr("pool lock failed");
+}
+
+static void unlock_pool(NodePool *pool) {
+
+    if (pthread_mutex_unlock(&pool->lock) != 0)
+        syserr("pool unlock failed");
+}
+
+/**
+ * przenosi count obiektów z końca pamięci podręcznej do magazynu,
+ * wołane z zablokowaną pulą
+ */
+static void flush_to_depot(NodePool *pool, Cache *cache, size_t count) {
+
+    Batch *batch = pool->spare;
+    if (batch)
+        pool->spare = batch->next;
+    else if (!(batch = malloc(sizeof(Batch))))
+        syserr("allocation failed");
+
+    size_t cached = atomic_load_explicit(&cache->count, memory_order_relaxed);
+    batch->count = count;
+    for (size_t i = 0; i < count; i++)
+        batch->objects[i] = cache->objects[cached - count + i];
+    atomic_store_explicit(&cache->count, cached - count, memory_order_relaxed);
+
+    batch->next = pool->depot;
+    pool->depot = batch;
+    pool->depot_objects += count;
+}
+
+static void release_cache(void *arg) {
+
+    Cache *cache = arg;
+    NodePool *pool = cache->pool;
+    lock_pool(pool);
+    size_t count;
+    while ((count = atomic_load_explicit(&cache->count, memory_order_relaxed)) > 0)
+        flush_to_depot(pool, cache, count < BATCH_SIZE ? count : BATCH_SIZE);
+    pool->retired_gets += atomic_load_explicit(&cache->gets, memory_order_relaxed);
+    pool->retired_puts += atomic_load_explicit(&cache->puts, memory_order_relaxed);
+    if (cache->prev)
+        cache->prev->next = cache->next;
+    else
+        pool->caches = cache->next;
+    if (cache->next)
+        cache->next->prev = cache->prev;
+    unlock_pool(pool);
+    free(cache);
+}
+
+static Cache *get_cache(NodePool *pool) {
+
+    Cache *cache = pthread_getspecific(pool->key);
+    if (cache)
+        return cache;
+
+    if (!(cache = calloc(1, sizeof(Cache))))
+        syserr("allocation failed");
+    cache->pool = pool;
+    if (pthread_setspecific(pool->key, cache) != 0)
+        syserr("setspecific failed");
+    lock_pool(pool);
+    cache->next = pool->caches;
+    if (pool->caches)
+        pool->caches->prev = cache;
+    pool->caches = cache;
+    unlock_pool(pool);
+    return cache;
+}
+
+/**
+ * uzupełnia pustą pamięć podręczną paczką z magazynu lub nową płytą
+ */
+static void refill(NodePool *pool, Cache *cache) {
+
+    lock_pool(pool);
+    Batch *batch = pool->depot;
+    if (batch) {
+        pool->depot = batch->next;
+        pool->depot_objects -= batch->count;
+        for (size_t i = 0; i < batch->count; i++)
+            cache->objects[i] = batch->objects[i];
+        atomic_store_explicit(&cache->count, batch->count, memory_order_relaxed);
+        batch->next = pool->spare;
+        pool->spare = batch;
+        unlock_pool(pool);
+        return;
+    }
+
+    Slab *slab = malloc(pool->slab_bytes);
+    if (!slab)
+        syserr("allocation failed");
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->n_slabs++;
+    unlock_pool(pool);
+
+    for (size_t i = 0; i < BATCH_SIZE; i++) {
+        cache->objects[i] = slab_object(pool, slab, i);
+        if (pool->init)
+            pool->init(cache->objects[i]);
+    }
+    atomic_store_explicit(&cache->count, BATCH_SIZE, memory_order_relaxed);
+}
+
+NodePool *node_pool_new(size_t size, void (*init)(void *), void (*destroy)(void *)) {
+
+    NodePool *pool = calloc(1, sizeof(NodePool));
+    if (!pool)
+        syserr("allocation failed");
+    pool->size = align_up(size);
+    pool->slab_bytes = align_up(sizeof(Slab)) + BATCH_SIZE * pool->size;
+    pool->init = init;
+    pool->destroy = destroy;
+    if (pthread_key_create(&pool->key, release_cache) != 0)
+        syserr("key create failed");
+    if (pthread_mutex_init(&pool->lock, NULL) != 0)
+        syserr("lock init failed");
+    return pool;
+}
+
+void node_pool_free(NodePool *pool) {
+
+    Cache *cache = pthread_getspecific(pool->key);
+    if (cache)
+        release_cache(cache);
+    if (pthread_key_delete(pool->key) != 0)
+        syserr("key delete failed");
+
+    for (Slab *slab = pool->slabs; slab;) {
+        Slab *next = slab->next;
+        if (pool->destroy)
+            for (size_t i = 0; i < BATCH_SIZE; i++)
+                pool->destroy(slab_object(pool, slab, i));
+        free(slab);
+        slab = next;
+    }
+    Batch *lists[] = { pool->depot, pool->spare };
+    for (int l = 0; l < 2; l++)
+        for (Batch *batch = lists[l]; batch;) {
+            Batch *next = batch->next;
+            free(batch);
+            batch = next;
+        }
+    for (cache = pool->caches; cache;) {
+        Cache *next = cache->next;
+        free(cache);
+        cache = next;
+    }
+    if (pthread_mutex_destroy(&pool->lock) != 0)
+        syserr("lock destroy failed");
+    free(pool);
+}
+
+void *node_pool_get(NodePool *pool) {
+
+    Cache *cache = get_cache(pool);
+    size_t count = atomic_load_explicit(&cache->count, memory_order_relaxed);
+    if (count == 0) {
+        refill(pool, cache);
+        count = atomic_load_explicit(&cache->count, memory_order_relaxed);
+    }
+    atomic_store_explicit(&cache->count, count - 1, memory_order_relaxed);
+    atomic_store_explicit(&cache->gets, atomic_load_explicit(&cache->gets, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    return cache->objects[count - 1];
+}
+
+void node_pool_put(NodePool *pool, void *object) {
+
+    Cache *cache = get_cache(pool);
+    size_t count = atomic_load_explicit(&cache->count, memory_order_relaxed);
+    if (count == CACHE_CAPACITY) {
+        lock_pool(pool);
+        flush_to_depot(pool, cache, BATCH_SIZE);
+        unlock_pool(pool);
+        count -= BATCH_SIZE;
+    }
+    cache->objects[count] = object;
+    atomic_store_explicit(&cache->count, count + 1, memory_order_relaxed);
+    atomic_store_explicit(&cache->puts, atomic_load_explicit(&cache->puts, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
+void node_pool_stats(NodePool *pool, NodePoolStats *stats) {
+
+    lock_pool(pool);
+    stats->slabs = pool->n_slabs;
+    stats->objects = pool->n_slabs * BATCH_SIZE;
+    stats->bytes = pool->n_slabs * pool->slab_bytes;
+    stats->depot = pool->depot_objects;
+    stats->gets = pool->retired_gets;
+    stats->puts = pool->retired_puts;
+    stats->cached = 0;
+    for (Cache *cache = pool->caches; cache; cache = cache->next) {
+        stats->cached += atomic_load_explicit(&cache->count, memory_order_relaxed);
+        stats->gets += atomic_load_explicit(&cache->gets, memory_order_relaxed);
+        stats->puts += atomic_load_explicit(&cache->puts, memory_order_relaxed);
+    }
+    unlock_pool(pool);
+    stats->in_use = stats->gets > stats->puts ? stats->gets - stats->puts : 0;
+}
+
+size_t node_pool_object_size(NodePool *pool) {
+
+    return pool->size;
+}
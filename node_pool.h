@@ -0,0 +1,53 @@
+#pragma once
+#include <stddef.h>
+
+/**
+ * Pula obiektów jednego rozmiaru (wierzchołków drzewa).
+ * Obiekty są wycinane z płyt (slabów) i inicjowane raz, przy wycięciu;
+ * zwolnione obiekty wracają do puli zainicjowane i są używane ponownie.
+ * Każdy wątek ma własną pamięć podręczną wolnych obiektów, a nadmiar
+ * (np. obiekty zwalniane przez inny wątek niż ten, który je pobrał)
+ * trafia paczkami do wspólnego magazynu.
+ */
+typedef struct NodePool NodePool;
+
+typedef struct NodePoolStats {
+    size_t slabs;       // liczba płyt
+    size_t objects;     // liczba obiektów we wszystkich płytach
+    size_t in_use;      // obiekty pobrane i nie zwrócone
+    size_t cached;      // wolne obiekty w pamięciach podręcznych wątków
+    size_t depot;       // wolne obiekty w magazynie
+    size_t gets, puts;  // liczba pobrań i zwrotów
+    size_t bytes;       // pamięć zajęta przez płyty
+} NodePoolStats;
+
+/**
+ * Tworzy pulę obiektów rozmiaru size. init jest wołane raz dla
+ * każdego obiektu przy wycinaniu płyty, destroy przy zwalnianiu puli.
+ */
+NodePool *node_pool_new(size_t size, void (*init)(void *), void (*destroy)(void *));
+
+/**
+ * Zwalnia pulę wraz z płytami. Wszystkie obiekty muszą być zwrócone,
+ * a wątki, które korzystały z puli, zakończone.
+ */
+void node_pool_free(NodePool *pool);
+
+/**
+ * Zwraca zainicjowany obiekt z puli.
+ */
+void *node_pool_get(NodePool *pool);
+
+/**
+ * Zwraca obiekt do puli. Obiekt musi być w stanie
+ * jak po init (np. z pustą zawartością).
+ */
+void node_pool_put(NodePool *pool, void *object);
+
+void node_pool_stats(NodePool *pool, NodePoolStats *stats);
+
+/**
+ * Rozmiar miejsca zajmowanego przez obiekt w płycie
+ * (rozmiar obiektu zaokrąglony do wyrównania).
+ */
+size_t node_pool_object_size(NodePool *pool);
@@ -0,0 +1,84 @@
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "node_sync.h"
+#include "err.h"
+
+static void futex_wait(atomic_uint *word, unsigned value) {
+
+    if (syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0) != 0
+        && errno != EAGAIN && errno != EINTR)
+        syserr("futex wait failed");
+}
+
+static void futex_wake(atomic_uint *word, int count) {
+
+    if (syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0) < 0)
+        syserr("futex wake failed");
+}
+
+void node_mutex_init(NodeMutex *mutex) {
+
+    atomic_init(&mutex->state, 0);
+}
+
+void node_mutex_lock(NodeMutex *mutex) {
+
+    unsigned c = 0;
+    if (atomic_compare_exchange_strong(&mutex->state, &c, 1))
+        return;
+    if (c != 2)
+        c = atomic_exchange(&mutex->state, 2);
+    while (c != 0) {
+        futex_wait(&mutex->state, 2);
+        c = atomic_exchange(&mutex->state, 2);
+    }
+}
+
+bool node_mutex_trylock(NodeMutex *mutex) {
+
+    unsigned c = 0;
+    return atomic_compare_exchange_strong(&mutex->state, &c, 1);
+}
+
+void node_mutex_unlock(NodeMutex *mutex) {
+
+    if (atomic_fetch_sub(&mutex->state, 1) != 1) {
+        atomic_store(&mutex->state, 0);
+        futex_wake(&mutex->state, 1);
+    }
+}
+
+void node_cond_init(NodeCond *cond) {
+
+    atomic_init(&cond->seq, 0);
+    cond->waiters = 0;
+}
+
+void node_cond_wait(NodeCond *cond, NodeMutex *mutex) {
+
+    unsigned seq = atomic_load(&cond->seq);
+    cond->waiters++;
+    node_mutex_unlock(mutex);
+    futex_wait(&cond->seq, seq);
+    node_mutex_lock(mutex);
+    cond->waiters--;
+}
+
+void node_cond_signal(NodeCond *cond) {
+
+    if (cond->waiters > 0) {
+        atomic_fetch_add(&cond->seq, 1);
+        futex_wake(&cond->seq, 1);
+    }
+}
+
+void node_cond_broadcast(NodeCond *cond) {
+
+    if (cond->waiters > 0) {
+        atomic_fetch_add(&cond->seq, 1);
+        futex_wake(&cond->seq, INT_MAX);
+    }
+}
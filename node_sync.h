@@ -0,0 +1,44 @@
+#pragma once
+#include <stdatomic.h>
+#include <stdbool.h>
+
+/**
+ * Lekkie odpowiedniki pthread_mutex_t i pthread_cond_t dla wierzchołków
+ * drzewa (Linux, futeksy). Zamek zajmuje jedno słowo, zmienna warunkowa
+ * dwa, a wątki czekają w kolejkach futeksów jądra, haszowanych po adresie
+ * słowa. Pamięć na oczekiwanie jest więc wspólna i używana tylko wtedy,
+ * gdy ktoś faktycznie czeka, a nieużywane wierzchołki nic na nią nie tracą.
+ */
+typedef struct NodeMutex {
+    atomic_uint state; // 0 - wolny, 1 - zajęty, 2 - zajęty i ktoś może czekać
+} NodeMutex;
+
+typedef struct NodeCond {
+    atomic_uint seq;   // zwiększane przy każdym budzeniu
+    unsigned waiters;  // chronione zamkiem, z którym się czeka
+} NodeCond;
+
+void node_mutex_init(NodeMutex *mutex);
+void node_mutex_lock(NodeMutex *mutex);
+bool node_mutex_trylock(NodeMutex *mutex);
+void node_mutex_unlock(NodeMutex *mutex);
+
+void node_cond_init(NodeCond *cond);
+
+/**
+ * Jak pthread_cond_wait: zwalnia mutex, czeka na sygnał i ponownie
+ * bierze mutex. Możliwe są fałszywe pobudki.
+ */
+void node_cond_wait(NodeCond *cond, NodeMutex *mutex);
+
+/**
+ * Budzi co najmniej jeden czekający wątek, o ile jakiś czeka.
+ * Trzeba trzymać mutex, z którym czekają wątki.
+ */
+void node_cond_signal(NodeCond *cond);
+
+/**
+ * Budzi wszystkie czekające wątki. Trzeba trzymać mutex,
+ * z którym czekają wątki.
+ */
+void node_cond_broadcast(NodeCond *cond);
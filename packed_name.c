@@ -0,0 +1,55 @@
+#include "packed_name.h"
+
+#include <assert.h>
+#include <string.h>
+
+void packed_name_encode(PackedName* dst, const char* src, size_t len)
+{
+    assert(len <= PACKED_NAME_MAX_LENGTH);
+    size_t n_words = packed_name_words(len);
+    uint64_t hash = len;
+    for (size_t w = 0; w < n_words; ++w) {
+        uint64_t word = 0;
+        for (size_t i = 0; i < PACKED_NAME_CHARS_PER_WORD; ++i) {
+            size_t pos = w * PACKED_NAME_CHARS_PER_WORD + i;
+            uint64_t c = pos < len ? (uint64_t)(src[pos] - 'a' + 1) : 0;
+            assert(c <= 26);
+            word = (word << 5) | c;
+        }
+        dst->words[w] = word;
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 29;
+    }
+    dst->len = len;
+    dst->hash = (uint32_t)(hash ^ (hash >> 32));
+}
+
+size_t packed_name_decode(const PackedName* name, char* dst)
+{
+    size_t pos = 0;
+    for (size_t w = 0; pos < name->len; ++w) {
+        uint64_t word = name->words[w];
+        for (int shift = 5 * (PACKED_NAME_CHARS_PER_WORD - 1); shift >= 0 && pos < name->len; shift -= 5)
+            dst[pos++] = 'a' - 1 + ((word >> shift) & 31);
+    }
+    dst[pos] = '\0';
+    return pos;
+}
+
+bool packed_name_equal(const PackedName* a, const PackedName* b)
+{
+    return a->hash == b->hash && a->len == b->len
+        && memcmp(a->words, b->words, packed_name_words(a->len) * sizeof(uint64_t)) == 0;
+}
+
+int packed_name_compare(const PackedName* a, const PackedName* b)
+{
+    size_t a_words = packed_name_words(a->len), b_words = packed_name_words(b->len);
+    size_t n_words = a_words < b_words ? a_words : b_words;
+    for (size_t w = 0; w < n_words; ++w) {
+        if (a->words[w] != b->words[w])
+            return a->words[w] < b->words[w] ? -1 : 1;
+    }
+    // A common prefix of whole words: the longer name is greater.
+    return (a->len > b->len) - (a->len < b->len);
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Folder names consist of 'a'-'z' characters only (see `is_path_valid`), so each
+// character fits in 5 bits. A packed name stores 12 characters per 64-bit word,
+// the first character in the most significant bits ('a' is 1, unused positions
+// are 0). Comparing words as integers thus compares names lexicographically, and
+// hashing and equality work on whole words instead of single characters.
+
+// Max length of a packed name, the same as MAX_FOLDER_NAME_LENGTH.
+#define PACKED_NAME_MAX_LENGTH 255
+
+#define PACKED_NAME_CHARS_PER_WORD 12
+
+#define PACKED_NAME_MAX_WORDS \
+    ((PACKED_NAME_MAX_LENGTH + PACKED_NAME_CHARS_PER_WORD - 1) / PACKED_NAME_CHARS_PER_WORD)
+
+typedef struct PackedName {
+    uint32_t hash;
+    uint32_t len; // Number of characters.
+    uint64_t words[];
+} PackedName;
+
+// Storage for a packed name of any length, e.g. on the stack:
+//     PackedNameBuffer buf;
+//     packed_name_encode(&buf.name, "foo", 3);
+typedef union PackedNameBuffer {
+    PackedName name;
+    uint64_t space[1 + PACKED_NAME_MAX_WORDS];
+} PackedNameBuffer;
+
+// Return the number of words used by a name of length `len`.
+static inline size_t packed_name_words(size_t len)
+{
+    return (len + PACKED_NAME_CHARS_PER_WORD - 1) / PACKED_NAME_CHARS_PER_WORD;
+}
+
+// Return the size in bytes of a packed name of length `len`.
+static inline size_t packed_name_size(size_t len)
+{
+    return sizeof(PackedName) + packed_name_words(len) * sizeof(uint64_t);
+}
+
+// Return the `i`-th character of `name` as 1-26 for 'a'-'z', or 0 if `i` is past its end.
+static inline int packed_name_char(const PackedName* name, size_t i)
+{
+    if (i >= name->len)
+        return 0;
+    unsigned shift = 5 * (PACKED_NAME_CHARS_PER_WORD - 1 - i % PACKED_NAME_CHARS_PER_WORD);
+    return (name->words[i / PACKED_NAME_CHARS_PER_WORD] >> shift) & 31;
+}
+
+// Pack `len` characters of `src` into `dst`, which must have at least
+// packed_name_size(len) bytes. Also computes the hash.
+void packed_name_encode(PackedName* dst, const char* src, size_t len);
+
+// Write the characters of `name` followed by a null character into `dst`.
+// Return the number of characters written (excluding the null character).
+size_t packed_name_decode(const PackedName* name, char* dst);
+
+// Return whether the names are equal.
+bool packed_name_equal(const PackedName* a, const PackedName* b);
+
+// Compare names like strcmp compares their decoded forms.
+int packed_name_compare(const PackedName* a, const PackedName* b);
@@ -1,6 +1,7 @@
 #include "path_utils.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -64,63 +65,194 @@ char* make_path_to_parent(const char* path, char* component)
     return result;
 }
 
-// A wrapper for using strcmp in qsort.
-// The arguments here are actually pointers to (const char*).
-static int compare_string_pointers(const void* p1, const void* p2)
+// Per-thread array reused by make_map_contents_views.
+typedef struct ViewScratch {
+    const PackedName** views;
+    size_t capacity;
+} ViewScratch;
+
+static pthread_key_t scratch_key;
+static pthread_once_t scratch_once = PTHREAD_ONCE_INIT;
+
+static void free_scratch(void* p)
 {
-    return strcmp(*(const char**)p1, *(const char**)p2);
+    ViewScratch* scratch = p;
+    free(scratch->views);
+    free(scratch);
 }
 
-char** make_map_contents_array(HashMap* map)
+static void make_scratch_key(void)
+{
+    if (pthread_key_create(&scratch_key, free_scratch) != 0)
+        exit(1);
+}
+
+static ViewScratch* get_scratch(size_t capacity)
+{
+    pthread_once(&scratch_once, make_scratch_key);
+    ViewScratch* scratch = pthread_getspecific(scratch_key);
+    if (!scratch) {
+        scratch = calloc(1, sizeof(ViewScratch));
+        if (!scratch || pthread_setspecific(scratch_key, scratch) != 0)
+            exit(1);
+    }
+    if (scratch->capacity < capacity) {
+        size_t new_capacity = scratch->capacity ? scratch->capacity : 16;
+        while (new_capacity < capacity)
+            new_capacity *= 2;
+        free(scratch->views);
+        scratch->views = malloc(new_capacity * sizeof(const PackedName*));
+        if (!scratch->views)
+            exit(1);
+        scratch->capacity = new_capacity;
+    }
+    return scratch;
+}
+
+// Buckets smaller than this are sorted by insertion sort.
+#define RADIX_CUTOFF 32
+
+// Number of radix buckets: one for names ending before the sorted position
+// and one for each of the letters 'a'-'z'.
+#define RADIX_BUCKETS 27
+
+static void insertion_sort_names(const PackedName** names, size_t n)
+{
+    for (size_t i = 1; i < n; ++i) {
+        const PackedName* name = names[i];
+        size_t j = i;
+        while (j > 0 && packed_name_compare(names[j - 1], name) > 0) {
+            names[j] = names[j - 1];
+            j--;
+        }
+        names[j] = name;
+    }
+}
+
+// Sort names having a common prefix of length `depth`.
+static void radix_sort_names(const PackedName** names, const PackedName** aux, size_t n, size_t depth)
+{
+    if (n < RADIX_CUTOFF) {
+        insertion_sort_names(names, n); // Compares whole words, the prefix costs little.
+        return;
+    }
+    size_t start[RADIX_BUCKETS + 1] = { 0 };
+    for (size_t i = 0; i < n; ++i)
+        start[packed_name_char(names[i], depth) + 1]++;
+    for (int d = 0; d < RADIX_BUCKETS; ++d)
+        start[d + 1] += start[d];
+
+    size_t position[RADIX_BUCKETS];
+    memcpy(position, start, sizeof(position));
+    for (size_t i = 0; i < n; ++i)
+        aux[position[packed_name_char(names[i], depth)]++] = names[i];
+    memcpy(names, aux, n * sizeof(const PackedName*));
+
+    // Bucket 0 holds names equal to the common prefix, so at most one name.
+    for (int d = 1; d < RADIX_BUCKETS; ++d)
+        if (start[d + 1] - start[d] > 1)
+            radix_sort_names(names + start[d], aux, start[d + 1] - start[d], depth + 1);
+}
+
+void sort_packed_names(const PackedName** names, const PackedName** aux, size_t n)
+{
+    radix_sort_names(names, aux, n, 0);
+}
+
+const PackedName** make_map_contents_views(HashMap* map, size_t* count)
 {
+    const HashMapIndex* index = hmap_index(map);
+    if (index) {
+        // Already sorted (by make_map_index) and kept sorted by modifications.
+        *count = index->count;
+        return (const PackedName**)index->keys;
+    }
     size_t n_keys = hmap_size(map);
-    char** result = calloc(n_keys + 1, sizeof(char*));
+    ViewScratch* scratch = get_scratch(2 * n_keys); // Keys and space for sorting them.
     HashMapIterator it = hmap_iterator(map);
-    char** key = result;
+    const PackedName** view = scratch->views;
     void* value = NULL;
-    while (hmap_next(map, &it, (const char **) key, &value)) {
-        key++;
+    while (hmap_next(map, &it, view, &value))
+        view++;
+    assert(view == scratch->views + n_keys);
+    sort_packed_names(scratch->views, scratch->views + n_keys, n_keys);
+    *count = n_keys;
+    return scratch->views;
+}
+
+const HashMapIndex* make_map_index(HashMap* map, bool* built)
+{
+    const HashMapIndex* index = hmap_index(map);
+    *built = false;
+    if (index)
+        return index;
+    HashMapIndex* new_index = hmap_index_new(map);
+    ViewScratch* scratch = get_scratch(new_index->count);
+    sort_packed_names(new_index->keys, scratch->views, new_index->count);
+    index = hmap_install_index(map, new_index);
+    *built = index == new_index;
+    return index;
+}
+
+char** make_map_contents_array(HashMap* map)
+{
+    size_t n_keys;
+    const PackedName** views = make_map_contents_views(map, &n_keys);
+    size_t chars_size = 0;
+    for (size_t i = 0; i < n_keys; ++i)
+        chars_size += views[i]->len + 1;
+
+    char** result = malloc((n_keys + 1) * sizeof(char*) + chars_size);
+    if (!result)
+        exit(1);
+    char* position = (char*)(result + n_keys + 1);
+    for (size_t i = 0; i < n_keys; ++i) {
+        result[i] = position;
+        position += packed_name_decode(views[i], position) + 1;
     }
-    *key = NULL; // Set last array element to NULL.
-    qsort(result, n_keys, sizeof(char*), compare_string_pointers);
+    result[n_keys] = NULL; // Set last array element to NULL.
     return result;
 }
 
-char* make_map_contents_string(HashMap* map)
+// Size of the comma-separated listing of `views`, including the null character.
+static size_t joined_size(const PackedName** views, size_t count)
 {
-    char** keys = make_map_contents_array(map);
-
-    unsigned int result_size = 0; // Including ending null character.
-    for (char** key = keys; *key; ++key)
-        result_size += strlen(*key) + 1;
+    size_t size = count ? 0 : 1;
+    for (size_t i = 0; i < count; ++i)
+        size += views[i]->len + 1;
+    return size;
+}
 
-    // Return empty string if map is empty.
-    if (!result_size) {
-        // Note we can't just return "", as it can't be free'd.
-        char* result = malloc(1);
-        if (!result)
-            exit(1);
-        for (char** key = keys; *key; ++key)
-            free(*key);
-        free(keys);
-        *result = '\0';
-        return result;
+// Decode `views` into `buf` (of size at least joined_size), separated with commas.
+static void write_joined(const PackedName** views, size_t count, char* buf)
+{
+    char* position = buf;
+    for (size_t i = 0; i < count; ++i) {
+        if (i > 0)
+            *position++ = ',';
+        position += packed_name_decode(views[i], position);
     }
+    *position = '\0';
+}
 
-    char* result = malloc(result_size);
+size_t make_map_contents_into(HashMap* map, char* buf, size_t size)
+{
+    size_t count;
+    const PackedName** views = make_map_contents_views(map, &count);
+    size_t needed = joined_size(views, count);
+    if (needed <= size)
+        write_joined(views, count, buf);
+    return needed;
+}
+
+char* make_map_contents_string(HashMap* map)
+{
+    size_t count;
+    const PackedName** views = make_map_contents_views(map, &count);
+    // Note we can't just return "" for an empty map, as it can't be free'd.
+    char* result = malloc(joined_size(views, count));
     if (!result)
         exit(1);
-    char* position = result;
-    for (char** key = keys; *key; ++key) {
-        size_t keylen = strlen(*key);
-        assert(position + keylen <= result + result_size);
-        strcpy(position, *key); // NOLINT: array size already checked.
-        position += keylen;
-        *position = ',';
-        position++;
-    }
-    position--;
-    *position = '\0';
-    free(keys);
+    write_joined(views, count, result);
     return result;
 }
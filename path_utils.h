@@ -41,10 +41,32 @@ char* make_path_to_parent(const char* path, char* component);
 
 // Return an array containing all keys, lexicographically sorted.
 // The result is null-terminated.
-// Keys are not copied, they are only valid as long as the map.
-// The caller should free the result.
+// Keys are decoded into the same allocation, so the caller should free
+// only the result.
 char** make_map_contents_array(HashMap* map);
 
+// Sort `n` packed names lexicographically, using `aux` (of size at least `n`)
+// as temporary space. This is an MSD radix sort with 26 buckets per character,
+// switching to insertion sort for small buckets.
+void sort_packed_names(const PackedName** names, const PackedName** aux, size_t n);
+
+// Return an array of all keys in map, lexicographically sorted, and set `*count`
+// to their number. The array is owned by the calling thread and reused by its
+// next call, so listing does not allocate once the array is large enough. If the
+// map has a cached index (see `make_map_index`), that is returned instead, without
+// sorting. Keys are not copied, they are only valid as long as the map.
+const PackedName** make_map_contents_views(HashMap* map, size_t* count);
+
+// Return the index of keys in map, lexicographically sorted. The index is cached in
+// the map (see `hmap_install_index`) and kept sorted by its modifications, so it is
+// sorted only once; `*built` is set to whether this call built and cached it.
+const HashMapIndex* make_map_index(HashMap* map, bool* built);
+
+// Write all keys in map, sorted, comma-separated and null-terminated into `buf`
+// of size `size`. Return the size needed for that (including the null character);
+// if it is greater than `size`, nothing is written.
+size_t make_map_contents_into(HashMap* map, char* buf, size_t size);
+
 // Return a string containing all keys in map, sorted, comma-separated.
 // The result has no trailing comma. An empty map yields an empty string.
 // The caller should free the result.
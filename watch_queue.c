@@ -0,0 +1,100 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "watch_queue.h"
+#include "err.h"
+
+/**
+ * slot o pozycji pos (licząc od początku kolejki, bez zawijania) jest
+ * wolny dla piszącego, gdy seq == pos, a gotowy dla odbiorcy, gdy
+ * seq == pos + 1; po odebraniu dostaje seq = pos + pojemność
+ */
+typedef struct Slot {
+    atomic_size_t seq;
+    TreeEvent event;
+} Slot;
+
+struct WatchQueue {
+    _Alignas(64) atomic_size_t tail; // następna pozycja do zapisu
+    _Alignas(64) size_t head;        // następna pozycja do odczytu
+    atomic_size_t dropped;
+    size_t mask;
+    Slot *slots;
+};
+
+WatchQueue *watch_queue_new(size_t capacity) {
+
+    size_t size = 2;
+    while (size < capacity)
+        size *= 2;
+    WatchQueue *queue = aligned_alloc(_Alignof(WatchQueue), sizeof(WatchQueue));
+    Slot *slots = malloc(size * sizeof(Slot));
+    if (!queue || !slots)
+        syserr("allocation failed");
+    for (size_t i = 0; i < size; i++)
+        atomic_init(&slots[i].seq, i);
+    atomic_init(&queue->tail, 0);
+    queue->head = 0;
+    atomic_init(&queue->dropped, 0);
+    queue->mask = size - 1;
+    queue->slots = slots;
+    return queue;
+}
+
+void watch_queue_free(WatchQueue *queue) {
+
+    TreeEvent event;
+    while (watch_queue_pop(queue, &event))
+        free(event.path);
+    free(queue->slots);
+    free(queue);
+}
+
+bool watch_queue_push(WatchQueue *queue, TreeEventType type, uint64_t cookie, const char *path, size_t len) {
+
+    size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+        slot = &queue->slots[pos & queue->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) { // slot z poprzedniego okrążenia nie został odebrany
+            atomic_fetch_add_explicit(&queue->dropped, 1, memory_order_relaxed);
+            return false;
+        } else {
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        }
+    }
+
+    char *copy = malloc(len + 1);
+    if (!copy)
+        syserr("allocation failed");
+    memcpy(copy, path, len);
+    copy[len] = '\0';
+    slot->event.type = type;
+    slot->event.cookie = cookie;
+    slot->event.path = copy;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return true;
+}
+
+bool watch_queue_pop(WatchQueue *queue, TreeEvent *event) {
+
+    Slot *slot = &queue->slots[queue->head & queue->mask];
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != queue->head + 1)
+        return false;
+    *event = slot->event;
+    atomic_store_explicit(&slot->seq, queue->head + queue->mask + 1, memory_order_release);
+    queue->head++;
+    return true;
+}
+
+size_t watch_queue_dropped(WatchQueue *queue) {
+
+    return atomic_load_explicit(&queue->dropped, memory_order_relaxed);
+}
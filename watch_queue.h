@@ -0,0 +1,58 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Zdarzenia o zmianach w drzewie dla obserwatorów (tree_watch).
+ */
+typedef enum TreeEventType {
+    TREE_EVENT_CREATE,     // utworzenie folderu (przy tree_copy całego poddrzewa)
+    TREE_EVENT_REMOVE,     // usunięcie folderu (przy tree_remove_recursive z poddrzewem)
+    TREE_EVENT_MOVE_FROM,  // folder przeniesiony spod obserwowanego miejsca
+    TREE_EVENT_MOVE_TO,    // folder przeniesiony pod obserwowane miejsce
+} TreeEventType;
+
+typedef struct TreeEvent {
+    TreeEventType type;
+    uint64_t cookie; // wspólne dla MOVE_FROM i MOVE_TO jednego przeniesienia
+    char *path;      // pełna ścieżka folderu, do zwolnienia przez odbiorcę
+} TreeEvent;
+
+/**
+ * Kolejka zdarzeń jednego odbiorcy: ograniczony bufor cykliczny, do którego
+ * bez zamków piszą wątki zmieniające drzewo (każdy rezerwuje slot przez CAS
+ * na końcu kolejki), a czyta tylko odbiorca. Każdy slot ma numer sekwencji,
+ * po którym piszący i czytający poznają, czyja jest teraz jego kolej.
+ * Gdy kolejka jest pełna, zdarzenie jest gubione i liczone w dropped,
+ * więc zmiana drzewa nigdy nie czeka na odbiorcę.
+ */
+typedef struct WatchQueue WatchQueue;
+
+/**
+ * Tworzy pustą kolejkę na co najmniej capacity zdarzeń.
+ */
+WatchQueue *watch_queue_new(size_t capacity);
+
+/**
+ * Zwalnia kolejkę z nieodebranymi zdarzeniami; nie może już być
+ * obserwatorem żadnego folderu.
+ */
+void watch_queue_free(WatchQueue *queue);
+
+/**
+ * Dokłada zdarzenie (kopiując path[0..len)); false, gdy kolejka jest pełna.
+ */
+bool watch_queue_push(WatchQueue *queue, TreeEventType type, uint64_t cookie, const char *path, size_t len);
+
+/**
+ * Zdejmuje najstarsze zdarzenie do *event (tylko odbiorca); false, gdy
+ * kolejka jest pusta.
+ */
+bool watch_queue_pop(WatchQueue *queue, TreeEvent *event);
+
+/**
+ * Liczba zgubionych zdarzeń od utworzenia kolejki; jej wzrost oznacza,
+ * że odbiorca musi odczytać stan drzewa od nowa.
+ */
+size_t watch_queue_dropped(WatchQueue *queue);
@@ -0,0 +1,183 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "work_pool.h"
+#include "err.h"
+
+// górne ograniczenie liczby wątków puli
+#define MAX_WORKERS 64
+
+typedef struct Task Task;
+struct Task {
+    Task *next;
+    WorkGroup *group;
+    WorkFunction run;
+    void *arg;
+};
+
+/**
+ * pending liczy niezakończone zadania i właściciela grupy (dopóki
+ * na nią nie poczeka lub jej nie porzuci); kto sprowadzi je do zera,
+ * ten zwalnia grupę
+ */
+struct WorkGroup {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    size_t pending;
+};
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_work = PTHREAD_COND_INITIALIZER;
+static Task *head, *tail;
+static atomic_size_t idle, queued; // czytane bez zamka przez work_pool_idle
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static size_t workers;
+
+static void lock(pthread_mutex_t *mutex) {
+
+    if (pthread_mutex_lock(mutex) != 0)
+        syserr("mutex lock failed");
+}
+
+static void unlock(pthread_mutex_t *mutex) {
+
+    if (pthread_mutex_unlock(mutex) != 0)
+        syserr("mutex unlock failed");
+}
+
+static void group_free(WorkGroup *group) {
+
+    if (pthread_cond_destroy(&group->done) != 0 || pthread_mutex_destroy(&group->lock) != 0)
+        syserr("group destroy failed");
+    free(group);
+}
+
+/**
+ * zmniejsza pending; budzi właściciela, gdy zostaje tylko on
+ */
+static void group_release(WorkGroup *group) {
+
+    lock(&group->lock);
+    size_t pending = --group->pending;
+    if (pending == 1 && pthread_cond_broadcast(&group->done) != 0)
+        syserr("cond broadcast failed");
+    unlock(&group->lock);
+    if (pending == 0)
+        group_free(group);
+}
+
+static void *worker(void *arg) {
+
+    (void) arg;
+    lock(&queue_lock);
+    while (true) {
+        while (!head) {
+            atomic_fetch_add(&idle, 1);
+            if (pthread_cond_wait(&queue_work, &queue_lock) != 0)
+                syserr("cond wait failed");
+            atomic_fetch_sub(&idle, 1);
+        }
+        Task *task = head;
+        head = task->next;
+        if (!head)
+            tail = NULL;
+        atomic_fetch_sub(&queued, 1);
+        unlock(&queue_lock);
+
+        task->run(task->group, task->arg);
+        group_release(task->group);
+        free(task);
+        lock(&queue_lock);
+    }
+    return NULL;
+}
+
+static void start_pool(void) {
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    workers = cpus < 1 ? 1 : cpus > MAX_WORKERS ? MAX_WORKERS : (size_t) cpus;
+
+    pthread_attr_t attr;
+    if (pthread_attr_init(&attr) != 0 || pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0)
+        syserr("attr init failed");
+    for (size_t i = 0; i < workers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, worker, NULL) != 0)
+            syserr("create failed");
+    }
+    if (pthread_attr_destroy(&attr) != 0)
+        syserr("attr destroy failed");
+}
+
+WorkGroup *work_group_new(void) {
+
+    WorkGroup *group = malloc(sizeof(WorkGroup));
+    if (!group)
+        syserr("allocation failed");
+    if (pthread_mutex_init(&group->lock, NULL) != 0 || pthread_cond_init(&group->done, NULL) != 0)
+        syserr("group init failed");
+    group->pending = 1;
+    return group;
+}
+
+void work_submit(WorkGroup *group, WorkFunction run, void *arg) {
+
+    pthread_once(&pool_once, start_pool);
+    Task *task = malloc(sizeof(Task));
+    if (!task)
+        syserr("allocation failed");
+    task->next = NULL;
+    task->group = group;
+    task->run = run;
+    task->arg = arg;
+
+    lock(&group->lock);
+    group->pending++;
+    unlock(&group->lock);
+
+    lock(&queue_lock);
+    if (tail)
+        tail->next = task;
+    else
+        head = task;
+    tail = task;
+    atomic_fetch_add(&queued, 1);
+    if (pthread_cond_signal(&queue_work) != 0)
+        syserr("cond signal failed");
+    unlock(&queue_lock);
+}
+
+void work_group_drain(WorkGroup *group) {
+
+    lock(&group->lock);
+    while (group->pending > 1)
+        if (pthread_cond_wait(&group->done, &group->lock) != 0)
+            syserr("cond wait failed");
+    unlock(&group->lock);
+}
+
+void work_group_wait(WorkGroup *group) {
+
+    work_group_drain(group);
+    group_free(group);
+}
+
+void work_group_detach(WorkGroup *group) {
+
+    group_release(group);
+}
+
+size_t work_pool_size(void) {
+
+    pthread_once(&pool_once, start_pool);
+    return workers;
+}
+
+size_t work_pool_idle(void) {
+
+    pthread_once(&pool_once, start_pool);
+    size_t n_idle = atomic_load(&idle), n_queued = atomic_load(&queued);
+    return n_idle > n_queued ? n_idle - n_queued : 0;
+}
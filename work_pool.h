@@ -0,0 +1,47 @@
+#pragma once
+#include <stddef.h>
+
+/**
+ * Wspólna dla procesu pula wątków roboczych, uruchamiana przy pierwszym
+ * użyciu (tyle wątków, ile procesorów). Zadania są grupowane: na grupę
+ * można poczekać albo ją porzucić, wtedy zwolni się sama po ostatnim
+ * zadaniu. Zadanie może zlecać kolejne zadania w swojej grupie, np. oddając
+ * część pracy, gdy work_pool_idle() pokazuje bezczynne wątki.
+ */
+typedef struct WorkGroup WorkGroup;
+
+typedef void (*WorkFunction)(WorkGroup *group, void *arg);
+
+WorkGroup *work_group_new(void);
+
+/**
+ * Zleca wykonanie run(group, arg) w puli.
+ */
+void work_submit(WorkGroup *group, WorkFunction run, void *arg);
+
+/**
+ * Czeka na zakończenie wszystkich zadań grupy (także zleconych przez
+ * same zadania) i zwalnia grupę.
+ */
+void work_group_wait(WorkGroup *group);
+
+/**
+ * Jak work_group_wait, ale nie zwalnia grupy; można w niej dalej
+ * zlecać zadania.
+ */
+void work_group_drain(WorkGroup *group);
+
+/**
+ * Porzuca grupę bez czekania; zwolni ją ostatnie zadanie.
+ */
+void work_group_detach(WorkGroup *group);
+
+/**
+ * Liczba wątków puli.
+ */
+size_t work_pool_size(void);
+
+/**
+ * Liczba bezczynnych wątków puli, na które nie czeka jeszcze żadne zadanie.
+ */
+size_t work_pool_idle(void);
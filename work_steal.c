@@ -0,0 +1,69 @@
+#include <stdlib.h>
+#include "work_steal.h"
+#include "err.h"
+
+#define INITIAL_CAPACITY 64
+
+void work_deque_init(WorkDeque *deque) {
+
+    node_mutex_init(&deque->lock);
+    deque->items = malloc(INITIAL_CAPACITY * sizeof(void *));
+    if (!deque->items)
+        syserr("allocation failed");
+    deque->capacity = INITIAL_CAPACITY;
+    deque->top = 0;
+    deque->count = 0;
+}
+
+void work_deque_destroy(WorkDeque *deque) {
+
+    free(deque->items);
+}
+
+/**
+ * podwaja bufor, przepisując zadania od top na początek
+ */
+static void grow(WorkDeque *deque) {
+
+    void **items = malloc(2 * deque->capacity * sizeof(void *));
+    if (!items)
+        syserr("allocation failed");
+    for (size_t i = 0; i < deque->count; i++)
+        items[i] = deque->items[(deque->top + i) & (deque->capacity - 1)];
+    free(deque->items);
+    deque->items = items;
+    deque->capacity *= 2;
+    deque->top = 0;
+}
+
+void work_deque_push(WorkDeque *deque, void *item) {
+
+    node_mutex_lock(&deque->lock);
+    if (deque->count == deque->capacity)
+        grow(deque);
+    deque->items[(deque->top + deque->count++) & (deque->capacity - 1)] = item;
+    node_mutex_unlock(&deque->lock);
+}
+
+void *work_deque_pop(WorkDeque *deque) {
+
+    void *item = NULL;
+    node_mutex_lock(&deque->lock);
+    if (deque->count > 0)
+        item = deque->items[(deque->top + --deque->count) & (deque->capacity - 1)];
+    node_mutex_unlock(&deque->lock);
+    return item;
+}
+
+void *work_deque_steal(WorkDeque *deque) {
+
+    void *item = NULL;
+    node_mutex_lock(&deque->lock);
+    if (deque->count > 0) {
+        item = deque->items[deque->top];
+        deque->top = (deque->top + 1) & (deque->capacity - 1);
+        deque->count--;
+    }
+    node_mutex_unlock(&deque->lock);
+    return item;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <stddef.h>
+#include "node_sync.h"
+
+/**
+ * Kolejka dwustronna zadań jednego wątku w schemacie podkradania pracy:
+ * właściciel dokłada i zdejmuje zadania z dołu (najnowsze, więc zwykle
+ * głębiej w drzewie i w jego pamięci podręcznej), a wątki bez pracy
+ * podkradają z góry (najstarsze, zwykle z większymi poddrzewami).
+ * Kolejkę chroni lekki zamek; dostęp z obu końców jest krótki, a kradzieże
+ * są rzadkie, więc zamek prawie zawsze jest wolny.
+ */
+typedef struct WorkDeque {
+    NodeMutex lock;
+    void **items;     // bufor cykliczny
+    size_t capacity;  // potęga dwójki
+    size_t top;       // indeks najstarszego zadania
+    size_t count;
+} WorkDeque;
+
+void work_deque_init(WorkDeque *deque);
+
+void work_deque_destroy(WorkDeque *deque);
+
+/**
+ * Dokłada zadanie na dół (tylko właściciel).
+ */
+void work_deque_push(WorkDeque *deque, void *item);
+
+/**
+ * Zdejmuje zadanie z dołu (tylko właściciel); NULL, gdy kolejka jest pusta.
+ */
+void *work_deque_pop(WorkDeque *deque);
+
+/**
+ * Zabiera zadanie z góry (dowolny wątek); NULL, gdy kolejka jest pusta.
+ */
+void *work_deque_steal(WorkDeque *deque);